@@ -47,10 +47,16 @@ int main()
 
 	printf("\n\n");
 
+    printf("==== NFA Reduction ===========================\n");
+    auto nfa_r = ReduceNfa(*nfa);
+    PrintNfa(*nfa_r);
+
+	printf("\n\n");
+
     printf("==== DFA Construction ===========================\n");
 	if (nfa_e->DfaCompatible())
 	{
-		auto dfa = GenerateDfa(*nfa_e);
+		auto dfa = GenerateDfa(*nfa_r);
 		PrintDfa(*dfa);
 	}
 	else
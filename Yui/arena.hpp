@@ -1,5 +1,6 @@
 #pragma once
 #include <cassert>
+#include <cstddef>
 #include <deque>
 #include <algorithm>
 #include <type_traits>
@@ -17,11 +18,15 @@ namespace yui
         Arena(Arena&& other)
         {
             allocated_ = std::move(other.allocated_);
+            allocated_bytes_ = other.allocated_bytes_;
+            other.allocated_bytes_ = 0;
         }
         Arena& operator=(Arena&& other)
         {
             Clear();
             allocated_ = std::move(other.allocated_);
+            allocated_bytes_ = other.allocated_bytes_;
+            other.allocated_bytes_ = 0;
             
             return *this;
         }
@@ -42,6 +47,14 @@ namespace yui
             }
 
             allocated_.clear();
+            allocated_bytes_ = 0;
+        }
+
+        // bytes taken by objects in this arena and their bookkeeping
+        // NOTE memory those objects allocate on their own is not counted
+        size_t AllocatedBytes() const
+        {
+            return allocated_bytes_;
         }
 
         template <typename T>
@@ -52,6 +65,7 @@ namespace yui
                 : [](void* p) { reinterpret_cast<T*>(p)->~T(); };
 
             allocated_.push_back(ArenaObject{ ptr, cleaner });
+            allocated_bytes_ += sizeof(T) + sizeof(ArenaObject);
         }
 
         template <typename T>
@@ -64,7 +78,10 @@ namespace yui
                 [=](const auto& item) { return item.ptr == decayed_ptr; });
 
             if(iter != allocated_.end())
+            {
                 allocated_.erase(iter);
+                allocated_bytes_ -= sizeof(T) + sizeof(ArenaObject);
+            }
         }
 
         template <typename T, typename ...TArgs>
@@ -89,5 +106,6 @@ namespace yui
         };
 
         std::deque<ArenaObject> allocated_;
+        size_t allocated_bytes_ = 0;
     };
 }
\ No newline at end of file
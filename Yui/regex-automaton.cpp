@@ -1,8 +1,8 @@
 #include "regex-automaton.h"
-#include "flat-set.hpp"
 #include <functional>
 #include <map>
 #include <set>
+#include <algorithm>
 
 using namespace std;
 
@@ -36,6 +36,10 @@ namespace yui
     {
         return ConstructTransition(branch, TransitionType::Entity, value);
     }
+    NfaTransition* NfaBuilder::NewClassTransition(NfaBranch branch, const CharClass& value)
+    {
+        return ConstructTransition(branch, TransitionType::Class, value);
+    }
     NfaTransition* NfaBuilder::NewAnchorTransition(NfaBranch branch, AnchorType anchor)
     {
         return ConstructTransition(branch, TransitionType::Anchor, anchor);
@@ -44,22 +48,18 @@ namespace yui
     {
         return ConstructTransition(branch, TransitionType::BeginCapture, id);
     }
-	NfaTransition* NfaBuilder::NewEndCaptureTransition(NfaBranch branch)
+	NfaTransition* NfaBuilder::NewEndCaptureTransition(NfaBranch branch, unsigned id)
 	{
-		return ConstructTransition(branch, TransitionType::EndCapture, {});
+		return ConstructTransition(branch, TransitionType::EndCapture, id);
 	}
     NfaTransition* NfaBuilder::NewReferenceTransition(NfaBranch branch, unsigned id)
     {
         return ConstructTransition(branch, TransitionType::Reference, id);
     }
-    NfaTransition* NfaBuilder::NewBeginAssertionTransition(NfaBranch branch, AssertionType type)
+    NfaTransition* NfaBuilder::NewAssertionTransition(NfaBranch branch, AssertionType type, std::shared_ptr<const DfaAutomaton> body)
     {
-        return ConstructTransition(branch, TransitionType::BeginAssertion, type);
+        return ConstructTransition(branch, TransitionType::Assertion, AssertionData{ type, std::move(body) });
     }
-	NfaTransition* NfaBuilder::NewEndAssertionTransition(NfaBranch branch)
-	{
-		return ConstructTransition(branch, TransitionType::EndAssertion, {});
-	}
 
     NfaTransition* NfaBuilder::CloneTransition(NfaBranch branch, const NfaTransition* transition)
     {
@@ -109,7 +109,9 @@ namespace yui
             switch (type)
             {
 			case TransitionType::Entity:
+			case TransitionType::Class:
 			case TransitionType::Epsilon:
+			case TransitionType::Anchor:
 				break;
 
 			default:
@@ -138,37 +140,97 @@ namespace yui
 
 	NfaAutomaton::Ptr NfaBuilder::Build(NfaState* start)
 	{
-		return make_unique<NfaAutomaton>(std::move(arena_), start, has_epsilon_, dfa_compatible_);
+		return make_unique<NfaAutomaton>(std::move(arena_), start, has_epsilon_, dfa_compatible_, simulation_compatible_, simplified_);
 	}
 
-    // Implementation of DfaBuilder
+    // Implementation of ByteClassBuilder
     //
-    DfaState DfaBuilder::NewState(bool accepting)
+    void ByteClassBuilder::AddRange(CharRange range)
     {
-		acceptance_lookup_.push_back(-1);
-        jumptable_.resize(jumptable_.size() + kDfaJumptableWidth, kInvalidDfaState);
-        int id = next_state_++;
+        assert(range.Min() >= 0 && range.Max() < static_cast<int>(kDfaAlphabetSize));
 
-        if (accepting)
+        boundaries_.set(range.Min());
+        if (range.Max() + 1 < static_cast<int>(kDfaAlphabetSize))
         {
-            // TODO: name the magic number 0
-            acceptance_lookup_[id] = 0;
+            boundaries_.set(range.Max() + 1);
+        }
+    }
+
+    void ByteClassBuilder::AddClass(const CharClass& cls)
+    {
+        // a class starts wherever membership changes
+        for (unsigned ch = 1; ch < kDfaAlphabetSize; ++ch)
+        {
+            if (cls.Contain(ch) != cls.Contain(ch - 1))
+            {
+                boundaries_.set(ch);
+            }
+        }
+    }
+
+    void ByteClassBuilder::AddTransition(const NfaTransition* edge)
+    {
+        assert(IsConsumingTransition(edge));
+
+        if (edge->type == TransitionType::Entity)
+        {
+            AddRange(std::get<CharRange>(edge->data));
+        }
+        else
+        {
+            AddClass(std::get<CharClass>(edge->data));
+        }
+    }
+
+    ByteClasses ByteClassBuilder::Build() const
+    {
+        ByteClasses result;
+
+        unsigned current = 0;
+        for (unsigned ch = 0; ch < kDfaAlphabetSize; ++ch)
+        {
+            if (ch != 0 && boundaries_.test(ch))
+            {
+                current += 1;
+            }
+
+            result.class_of[ch] = static_cast<uint8_t>(current);
         }
 
-        return id;
+        result.count = current + 1;
+        return result;
+    }
+
+    // Implementation of DfaBuilder
+    //
+    DfaState DfaBuilder::NewState(unsigned accepting_lookahead)
+    {
+        assert(accepting_lookahead < (1u << kLookKindCount));
+
+		acceptance_lookup_.push_back(static_cast<uint8_t>(accepting_lookahead));
+        jumptable_.resize(jumptable_.size() + classes_.count, kInvalidDfaState);
+
+        return next_state_++;
     }
 
-    void DfaBuilder::NewTransition(DfaState src, DfaState target, int ch)
+    void DfaBuilder::NewTransition(DfaState src, DfaState target, unsigned byte_class)
     {
         assert(src < next_state_ && target < next_state_);
-        assert(ch > 0 && ch < 128);
+        assert(byte_class < classes_.count);
 
-        jumptable_[src * kDfaJumptableWidth + ch] = target;
+        jumptable_[src * classes_.count + byte_class] = target;
+    }
+
+    void DfaBuilder::SetInitialState(LookKind behind, DfaState state)
+    {
+        assert(state < next_state_);
+
+        initial_lookup_[static_cast<unsigned>(behind)] = state;
     }
 
     DfaAutomaton::Ptr DfaBuilder::Build()
     {
-        return make_unique<DfaAutomaton>(acceptance_lookup_, jumptable_);
+        return make_unique<DfaAutomaton>(classes_, initial_lookup_, acceptance_lookup_, jumptable_, has_lookaround_);
     }
 
     // Algorithms
@@ -226,6 +288,17 @@ namespace yui
         }
     }
 
+    NfaSize MeasureNfa(const NfaAutomaton& atm)
+    {
+        NfaSize result = { 0, 0 };
+        EnumerateNfa(atm.IntialState(), [&](const NfaState* state) {
+            result.state_count += 1;
+            result.transition_count += state->exits.size();
+        });
+
+        return result;
+    }
+
     // copies transitions from a state into an output vector and sorts them
     void ExpandTransitions(std::vector<const NfaTransition*>& output, const NfaState* start)
     {
@@ -337,6 +410,16 @@ namespace yui
         NfaBuilder builder;
         std::unordered_map<const NfaState*, NfaState*> state_map; // maps an old solid state to a new one
 
+        if (!atm.SimulationCompatible())
+        {
+            builder.DisableSimulation();
+        }
+
+        if (atm.Simplified())
+        {
+            builder.MarkSimplified();
+        }
+
         // first iteration: clone states
         for (const NfaState* state : eval.solid_states)
         {
@@ -369,93 +452,951 @@ namespace yui
         return builder.Build(state_map[eval.initial_state]);
     }
 
-    // generates a DFA from a NFA
-    DfaAutomaton::Ptr GenerateDfa(const NfaAutomaton &atm)
+    // NFA Reduction
+    //
+
+    // tests if two transitions are taken in the same way, regardless of their states
+    static bool SameTransitionLabel(const NfaTransition* lhs, const NfaTransition* rhs)
     {
-        assert(atm.DfaCompatible());
+        if (lhs->type != rhs->type)
+        {
+            return false;
+        }
 
-        NfaEvaluationResult eval = EvaluateNfa(atm);
-        DfaBuilder builder{};
+        switch (lhs->type)
+        {
+        case TransitionType::Epsilon:
+            return get<EpsilonPriority>(lhs->data) == get<EpsilonPriority>(rhs->data);
+        case TransitionType::Entity:
+        {
+            auto x = get<CharRange>(lhs->data), y = get<CharRange>(rhs->data);
+            return x.Min() == y.Min() && x.Max() == y.Max();
+        }
+        case TransitionType::Class:
+            return get<CharClass>(lhs->data) == get<CharClass>(rhs->data);
+        case TransitionType::Anchor:
+            return get<AnchorType>(lhs->data) == get<AnchorType>(rhs->data);
+        case TransitionType::Assertion:
+        {
+            const auto& x = get<AssertionData>(lhs->data);
+            const auto& y = get<AssertionData>(rhs->data);
+            return x.type == y.type && x.body == y.body;
+        }
+        default: // captures and references
+            return get<unsigned>(lhs->data) == get<unsigned>(rhs->data);
+        }
+    }
 
-        using NfaStateSet = FlatSet<const NfaState*>;
-        std::map<NfaStateSet, DfaState> id_map; // maps a set of NFA states to a DFA state
-        std::queue<NfaStateSet> waitlist;
+    static size_t HashTransitionLabel(const NfaTransition* edge)
+    {
+        size_t result = static_cast<size_t>(edge->type);
+        const auto Combine = [&](size_t value) {
+            result ^= value + 0x9e3779b9 + (result << 6) + (result >> 2);
+        };
 
-        const auto TestAccepting =
-            [&](const NfaState* state)
+        switch (edge->type)
         {
-            return eval.accepting_states.find(state) != eval.accepting_states.end();
-        };
+        case TransitionType::Entity:
+        {
+            auto range = get<CharRange>(edge->data);
+            Combine(range.Min());
+            Combine(range.Max());
+        }
+            break;
+        case TransitionType::Class:
+            for (auto range : get<CharClass>(edge->data).Ranges())
+            {
+                Combine(range.Min());
+                Combine(range.Max());
+            }
+            break;
+        case TransitionType::BeginCapture:
+        case TransitionType::EndCapture:
+        case TransitionType::Reference:
+            Combine(get<unsigned>(edge->data));
+            break;
+        default:
+            break;
+        }
 
-		// TODO: should empty string be allowed to be a match?
-        // process initial state
-        // initial state cannot be accepting as regex cannot match empty string
-        assert(!TestAccepting(eval.initial_state));
-        DfaState initial_id = builder.NewState(false);
-        NfaStateSet initial_set = NfaStateSet{ eval.initial_state };
-        id_map.insert_or_assign(initial_set, initial_id);
+        return result;
+    }
+
+    // a state of the NFA under reduction, where labels and states are referred by index
+    struct ReducingState
+    {
+        bool is_final;
+        bool removed;
+        vector<pair<size_t, size_t>> exits;     // label and target of each transition in priority order
+    };
+
+    // NOTE a transition less prior than an identical one is never useful, as it leads to the same paths
+    static void RemoveDuplicateExits(vector<pair<size_t, size_t>>& exits)
+    {
+        set<pair<size_t, size_t>> seen;
+        auto new_end = remove_if(exits.begin(), exits.end(),
+            [&](const pair<size_t, size_t>& exit) { return !seen.insert(exit).second; });
+
+        exits.erase(new_end, exits.end());
+    }
+
+    // drops states removed and renumbers the rest, keeping the initial state at 0
+    static void CompactStates(vector<ReducingState>& states)
+    {
+        vector<size_t> mapping(states.size());
+        size_t count = 0;
+        for (size_t i = 0; i < states.size(); ++i)
+        {
+            mapping[i] = count;
+            if (!states[i].removed)
+            {
+                if (count != i)
+                {
+                    states[count] = std::move(states[i]);
+                }
+
+                ++count;
+            }
+        }
+
+        states.resize(count);
+        for (auto& state : states)
+        {
+            for (auto& exit : state.exits)
+            {
+                exit.second = mapping[exit.second];
+            }
+        }
+    }
+
+    // merges states with the same future, i.e. both accepting or not, and taking the same transitions
+    // in the same order into states with the same future
+    // it's done by partition refinement, a block of which is a set of states not yet told apart
+    static bool MergeForwardBisimilar(vector<ReducingState>& states)
+    {
+        // it starts from telling accepting states apart from others
+        vector<size_t> blocks(states.size());
+        for (size_t i = 0; i < states.size(); ++i)
+        {
+            blocks[i] = states[i].is_final ? 1 : 0;
+        }
+
+        size_t block_count = 0;     // not counted yet, so the first refinement always runs
+
+        while (true)
+        {
+            // blocks are numbered in order of their first state, so the initial state stays in block 0
+            map<pair<size_t, vector<pair<size_t, size_t>>>, size_t> signatures;
+            vector<size_t> new_blocks(states.size());
+            for (size_t i = 0; i < states.size(); ++i)
+            {
+                auto exits = states[i].exits;
+                for (auto& exit : exits)
+                {
+                    exit.second = blocks[exit.second];
+                }
+
+                RemoveDuplicateExits(exits);
+
+                auto key = make_pair(blocks[i], std::move(exits));
+                new_blocks[i] = signatures.try_emplace(std::move(key), signatures.size()).first->second;
+            }
+
+            // a refinement never joins blocks, so it's stable once no block is split
+            bool stable = signatures.size() == block_count;
+
+            blocks = std::move(new_blocks);
+            block_count = signatures.size();
+
+            if (stable)
+            {
+                break;
+            }
+        }
+
+        if (block_count == states.size())
+        {
+            return false;
+        }
+
+        // the first state of each block represents it
+        vector<ReducingState> merged(block_count, ReducingState{ false, true, {} });
+        for (size_t i = 0; i < states.size(); ++i)
+        {
+            auto& target = merged[blocks[i]];
+            if (target.removed)
+            {
+                target = ReducingState{ states[i].is_final, false, std::move(states[i].exits) };
+                for (auto& exit : target.exits)
+                {
+                    exit.second = blocks[exit.second];
+                }
+
+                RemoveDuplicateExits(target.exits);
+            }
+        }
+
+        states = std::move(merged);
+        return true;
+    }
+
+    // merges states with the same past, i.e. reached by the same transitions from the same states
+    // NOTE to keep priority, it only merges a pair of states where each transition into the latter
+    //      comes right after one into the former, so that paths through the latter take over
+    //      where those through the former end
+    static bool MergeBackwardBisimilar(vector<ReducingState>& states)
+    {
+        bool merged_any = false;
+        for (bool merged = true; merged; )
+        {
+            merged = false;
+
+            // transitions into each state as the source and the index of the exit
+            vector<vector<pair<size_t, size_t>>> incomings(states.size());
+            for (size_t source = 0; source < states.size(); ++source)
+            {
+                const auto& exits = states[source].exits;
+                for (size_t i = 0; i < exits.size(); ++i)
+                {
+                    incomings[exits[i].second].emplace_back(source, i);
+                }
+            }
+
+            const auto CanMerge = [&](size_t former, size_t latter) {
+                // the initial state has a past of its own
+                if (former == latter || former == 0 || latter == 0
+                    || states[former].is_final != states[latter].is_final
+                    || incomings[former].size() != incomings[latter].size())
+                {
+                    return false;
+                }
+
+                for (auto [source, i] : incomings[former])
+                {
+                    const auto& exits = states[source].exits;
+                    if (i + 1 >= exits.size() || exits[i + 1] != make_pair(exits[i].first, latter))
+                    {
+                        return false;
+                    }
+                }
+
+                return true;
+            };
+
+            for (size_t source = 0; source < states.size() && !merged; ++source)
+            {
+                const auto& exits = states[source].exits;
+                for (size_t i = 0; i + 1 < exits.size(); ++i)
+                {
+                    auto former = exits[i].second, latter = exits[i + 1].second;
+                    if (exits[i].first != exits[i + 1].first || !CanMerge(former, latter))
+                    {
+                        continue;
+                    }
+
+                    // drop transitions into the latter, from the back so that indices stay valid
+                    const auto& paired = incomings[former];
+                    for (auto it = paired.rbegin(); it != paired.rend(); ++it)
+                    {
+                        auto& source_exits = states[it->first].exits;
+                        source_exits.erase(source_exits.begin() + it->second + 1);
+                    }
+
+                    // then the former continues with paths of the latter
+                    for (auto exit : states[latter].exits)
+                    {
+                        states[former].exits.emplace_back(exit.first, exit.second == latter ? former : exit.second);
+                    }
+
+                    RemoveDuplicateExits(states[former].exits);
+
+                    states[latter].removed = true;
+                    states[latter].exits.clear();
+
+                    merged = merged_any = true;
+                    break;
+                }
+            }
+        }
+
+        if (merged_any)
+        {
+            CompactStates(states);
+        }
+
+        return merged_any;
+    }
+
+    NfaAutomaton::Ptr ReduceNfa(const NfaAutomaton& atm)
+    {
+        assert(!atm.HasEpsilon());
+
+        // index states reachable from the initial state, which comes first
+        vector<const NfaState*> originals;
+        unordered_map<const NfaState*, size_t> state_index;
+        EnumerateNfa(atm.IntialState(), [&](const NfaState* state) {
+            state_index.insert_or_assign(state, originals.size());
+            originals.push_back(state);
+        });
+
+        // find states that could lead to a match by walking backwards from final states
+        vector<vector<size_t>> predecessors(originals.size());
+        vector<bool> live(originals.size(), false);
+        queue<size_t> waitlist;
+        for (size_t i = 0; i < originals.size(); ++i)
+        {
+            for (const NfaTransition* edge : originals[i]->exits)
+            {
+                predecessors[state_index[edge->target]].push_back(i);
+            }
 
-        waitlist.push(initial_set);
+            if (originals[i]->is_final)
+            {
+                live[i] = true;
+                waitlist.push(i);
+            }
+        }
 
         while (!waitlist.empty())
         {
-            // fetch source set from the queue
-            auto source_set = std::move(waitlist.front());
+            auto target = waitlist.front();
             waitlist.pop();
 
-            // lookup source id
-            auto source_id = id_map[source_set];
+            for (auto source : predecessors[target])
+            {
+                if (!live[source])
+                {
+                    live[source] = true;
+                    waitlist.push(source);
+                }
+            }
+        }
 
-            // make a copy of all outgoing transitions
-            std::vector<const NfaTransition*> transitions;
-            for (const NfaState* state : source_set)
+        // identical transitions share a label
+        vector<const NfaTransition*> labels;
+        unordered_multimap<size_t, size_t> label_lookup;
+        const auto LookupLabel = [&](const NfaTransition* edge) {
+            auto hash = HashTransitionLabel(edge);
+            auto range = label_lookup.equal_range(hash);
+            for (auto it = range.first; it != range.second; ++it)
             {
-                auto range = eval.outbounds.equal_range(state);
-                std::transform(range.first, range.second, std::back_inserter(transitions),
-                    [](auto iter) { return iter.second; });
+                if (SameTransitionLabel(labels[it->second], edge))
+                {
+                    return it->second;
+                }
             }
 
-            // for each possible character in alphabet
-            for (int ch = 0; ch < 128; ++ch)
+            label_lookup.insert({ hash, labels.size() });
+            labels.push_back(edge);
+            return labels.size() - 1;
+        };
+
+        // trim states that are not live, along with transitions into them
+        // NOTE the initial state is always kept
+        vector<ReducingState> states;
+        for (size_t i = 0; i < originals.size(); ++i)
+        {
+            ReducingState state{ originals[i]->is_final, i != 0 && !live[i], {} };
+            if (!state.removed)
             {
-                // calculate target dfa state
-                NfaStateSet target_set;
-                for (const NfaTransition* edge : transitions)
+                for (const NfaTransition* edge : originals[i]->exits)
                 {
-                    if (std::get<CharRange>(edge->data).Contain(ch))
+                    auto target = state_index[edge->target];
+                    if (live[target])
                     {
-                        target_set.insert(edge->target);
+                        state.exits.emplace_back(LookupLabel(edge), target);
                     }
                 }
+            }
+
+            states.push_back(std::move(state));
+        }
+
+        CompactStates(states);
+
+        // merging either way may enable merging the other way
+        for (bool changed = true; changed; )
+        {
+            changed = MergeForwardBisimilar(states);
+            changed = MergeBackwardBisimilar(states) || changed;
+        }
+
+        // merged states change the shape the backtracker depends on
+        NfaBuilder builder;
+        builder.DisableSimulation();
+
+        vector<NfaState*> mapped_states;
+        for (const auto& state : states)
+        {
+            mapped_states.push_back(builder.NewState(state.is_final));
+        }
+
+        for (size_t i = 0; i < states.size(); ++i)
+        {
+            for (auto [label, target] : states[i].exits)
+            {
+                builder.CloneTransition(NfaBranch{ mapped_states[i], mapped_states[target] }, labels[label]);
+            }
+        }
+
+        return builder.Build(mapped_states[0]);
+    }
+
+    // Implementation of DfaSubsetTable
+    //
 
-                // empty target_set is invalid, so discard it
-                if (!target_set.empty())
+    pair<DfaState, bool> DfaSubsetTable::Insert(const vector<unsigned>& subset, LookKind behind)
+    {
+        if ((entries_.size() + 1) * 2 > slots_.size())
+        {
+            Rehash(max<size_t>(slots_.size() * 2, 64));
+        }
+
+        auto hash = Hash(subset, behind);
+        auto mask = slots_.size() - 1;
+        for (size_t i = hash & mask; ; i = (i + 1) & mask)
+        {
+            auto id = slots_[i];
+            if (id == kInvalidDfaState)
+            {
+                id = static_cast<DfaState>(entries_.size());
+                slots_[i] = id;
+
+                entries_.push_back(SubsetEntry{ hash, pool_.size(), subset.size(), behind });
+                pool_.insert(pool_.end(), subset.begin(), subset.end());
+                return { id, true };
+            }
+
+            const auto& entry = entries_[id];
+            if (entry.hash == hash && entry.behind == behind && entry.length == subset.size()
+                && equal(subset.begin(), subset.end(), pool_.begin() + entry.offset))
+            {
+                return { id, false };
+            }
+        }
+    }
+
+    DfaState DfaSubsetTable::Find(const vector<unsigned>& subset, LookKind behind) const
+    {
+        if (slots_.empty())
+        {
+            return kInvalidDfaState;
+        }
+
+        auto hash = Hash(subset, behind);
+        auto mask = slots_.size() - 1;
+        for (size_t i = hash & mask; slots_[i] != kInvalidDfaState; i = (i + 1) & mask)
+        {
+            const auto& entry = entries_[slots_[i]];
+            if (entry.hash == hash && entry.behind == behind && entry.length == subset.size()
+                && equal(subset.begin(), subset.end(), pool_.begin() + entry.offset))
+            {
+                return slots_[i];
+            }
+        }
+
+        return kInvalidDfaState;
+    }
+
+    size_t DfaSubsetTable::Hash(const vector<unsigned>& subset, LookKind behind)
+    {
+        // FNV-1a over indices
+        uint64_t result = 14695981039346656037ull ^ static_cast<uint64_t>(behind);
+        for (auto index : subset)
+        {
+            result = (result ^ index) * 1099511628211ull;
+        }
+
+        return static_cast<size_t>(result ^ (result >> 32));
+    }
+
+    void DfaSubsetTable::Rehash(size_t capacity)
+    {
+        slots_.assign(capacity, kInvalidDfaState);
+
+        auto mask = capacity - 1;
+        for (DfaState id = 0; id < entries_.size(); ++id)
+        {
+            auto i = entries_[id].hash & mask;
+            while (slots_[i] != kInvalidDfaState)
+            {
+                i = (i + 1) & mask;
+            }
+
+            slots_[i] = id;
+        }
+    }
+
+    // Implementation of SubsetConstructor
+    //
+
+    SubsetConstructor::SubsetConstructor(const NfaAutomaton& atm)
+    {
+        assert(atm.DfaCompatible());
+
+        NfaEvaluationResult eval = EvaluateNfa(atm);
+
+        // partition the alphabet with all ranges involved
+        has_lookaround_ = false;
+        ByteClassBuilder class_builder;
+        for (const auto& pair : eval.outbounds)
+        {
+            const NfaTransition* edge = pair.second;
+            if (edge->type == TransitionType::Anchor)
+            {
+                has_lookaround_ = true;
+            }
+            else
+            {
+                class_builder.AddTransition(edge);
+            }
+        }
+
+        // anchors need to tell line breaks and word bytes from others
+        if (has_lookaround_)
+        {
+            for (auto range : { CharRange{ '\n', '\n' }, CharRange{ '0', '9' }, CharRange{ 'A', 'Z' }, CharRange{ '_', '_' }, CharRange{ 'a', 'z' } })
+            {
+                class_builder.AddRange(range);
+            }
+        }
+
+        classes_ = class_builder.Build();
+
+        // a byte representing each class, and the kind of look it gives
+        std::vector<int> class_representative(classes_.count);
+        for (int ch = kDfaAlphabetSize - 1; ch >= 0; --ch)
+        {
+            class_representative[classes_.class_of[ch]] = ch;
+        }
+
+        class_look_.assign(classes_.count, LookKind::LineBreak);
+        if (has_lookaround_)
+        {
+            for (unsigned byte_class = 0; byte_class < classes_.count; ++byte_class)
+            {
+                class_look_[byte_class] = ClassifyLook(class_representative[byte_class]);
+            }
+        }
+
+        // index solid states so that a subset is an array of indices
+        std::vector<const NfaState*> solid_states(eval.solid_states.begin(), eval.solid_states.end());
+        std::unordered_map<const NfaState*, unsigned> solid_index;
+        for (unsigned i = 0; i < solid_states.size(); ++i)
+        {
+            solid_index.insert_or_assign(solid_states[i], i);
+        }
+
+        initial_index_ = solid_index.at(eval.initial_state);
+
+        solids_.resize(solid_states.size());
+        for (unsigned i = 0; i < solid_states.size(); ++i)
+        {
+            auto& solid = solids_[i];
+            solid.accepting = eval.accepting_states.find(solid_states[i]) != eval.accepting_states.end();
+
+            auto range = eval.outbounds.equal_range(solid_states[i]);
+            for (auto it = range.first; it != range.second; ++it)
+            {
+                const NfaTransition* edge = it->second;
+                auto target = solid_index.at(edge->target);
+                if (edge->type == TransitionType::Anchor)
                 {
-                    // calculate dfa id for target_set
-                    DfaState target_id;
-                    auto id_iter = id_map.find(target_set);
-                    if (id_iter != id_map.end())
+                    solid.anchors.emplace_back(std::get<AnchorType>(edge->data), target);
+                }
+                else if (IsConsumingTransition(edge))
+                {
+                    std::vector<unsigned> edge_classes;
+                    for (unsigned byte_class = 0; byte_class < classes_.count; ++byte_class)
                     {
-                        target_id = id_iter->second;
+                        if (TestTransitionByte(edge, class_representative[byte_class]))
+                        {
+                            edge_classes.push_back(byte_class);
+                        }
                     }
-                    else
+
+                    solid.entities.emplace_back(std::move(edge_classes), target);
+                }
+            }
+        }
+    }
+
+    void SubsetConstructor::ExpandAnchors(const vector<unsigned>& subset, LookKind behind, LookKind ahead, vector<unsigned>& output) const
+    {
+        output = subset;
+        if (!has_lookaround_)
+        {
+            return;
+        }
+
+        // a state is in the output if its mark equals the stamp of the expansion
+        // NOTE marks are kept per thread, and a stamp is never reused until they're cleared
+        thread_local vector<unsigned> marks;
+        thread_local unsigned stamp = 0;
+        if (marks.size() < solids_.size())
+        {
+            marks.resize(solids_.size(), 0);
+        }
+
+        if (++stamp == 0)
+        {
+            fill(marks.begin(), marks.end(), 0);
+            stamp = 1;
+        }
+
+        for (auto index : subset)
+        {
+            marks[index] = stamp;
+        }
+
+        for (size_t i = 0; i < output.size(); ++i)
+        {
+            for (auto [anchor, target] : solids_[output[i]].anchors)
+            {
+                if (marks[target] != stamp && TestAnchor(anchor, behind, ahead))
+                {
+                    marks[target] = stamp;
+                    output.push_back(target);
+                }
+            }
+        }
+    }
+
+    unsigned SubsetConstructor::AcceptingLookahead(const vector<unsigned>& subset, LookKind behind) const
+    {
+        thread_local vector<unsigned> expanded;
+
+        unsigned result = 0;
+        for (unsigned ahead = 0; ahead < kLookKindCount; ++ahead)
+        {
+            ExpandAnchors(subset, behind, static_cast<LookKind>(ahead), expanded);
+            if (any_of(expanded.begin(), expanded.end(), [&](unsigned index) { return solids_[index].accepting; }))
+            {
+                result |= 1u << ahead;
+            }
+        }
+
+        return result;
+    }
+
+    void SubsetConstructor::Step(const vector<unsigned>& subset, LookKind behind, vector<vector<unsigned>>& buckets) const
+    {
+        thread_local vector<unsigned> expanded;
+
+        // anchors passed before consuming a byte depend on the kind of it
+        for (unsigned ahead = 0; ahead < kLookKindCount; ++ahead)
+        {
+            ExpandAnchors(subset, behind, static_cast<LookKind>(ahead), expanded);
+            for (auto index : expanded)
+            {
+                for (const auto& [edge_classes, target] : solids_[index].entities)
+                {
+                    for (auto byte_class : edge_classes)
                     {
-                        // state not found in cache
-                        // so create a new one
-                        bool accepting = std::any_of(target_set.begin(), target_set.end(), TestAccepting);
-                        target_id = builder.NewState(accepting);
-                        id_map.insert_or_assign(target_set, target_id);
-
-                        // queue it
-                        waitlist.push(std::move(target_set));
+                        if (class_look_[byte_class] == static_cast<LookKind>(ahead))
+                        {
+                            buckets[byte_class].push_back(target);
+                        }
                     }
+                }
+            }
 
-                    // make transition
-                    builder.NewTransition(source_id, target_id, ch);
+            if (!has_lookaround_)
+            {
+                break;
+            }
+        }
+
+        for (auto& target_subset : buckets)
+        {
+            sort(target_subset.begin(), target_subset.end());
+            target_subset.erase(unique(target_subset.begin(), target_subset.end()), target_subset.end());
+        }
+    }
+
+    void SubsetConstructor::StepClass(const vector<unsigned>& subset, LookKind behind, unsigned byte_class, vector<unsigned>& output) const
+    {
+        thread_local vector<unsigned> expanded;
+
+        output.clear();
+        ExpandAnchors(subset, behind, class_look_[byte_class], expanded);
+        for (auto index : expanded)
+        {
+            for (const auto& [edge_classes, target] : solids_[index].entities)
+            {
+                if (binary_search(edge_classes.begin(), edge_classes.end(), byte_class))
+                {
+                    output.push_back(target);
                 }
             }
         }
 
+        sort(output.begin(), output.end());
+        output.erase(unique(output.begin(), output.end()), output.end());
+    }
+
+    // generates a DFA from a NFA, see SubsetConstructor
+    // NOTE construction stops as soon as the state limit is exceeded, so the budget bounds memory as well
+    DfaAutomaton::Ptr GenerateDfa(const NfaAutomaton &atm, size_t state_limit)
+    {
+        SubsetConstructor constructor{ atm };
+
+        const auto& classes = constructor.Classes();
+        DfaBuilder builder{ classes, constructor.HasLookaround() };
+
+        DfaSubsetTable subsets;
+        bool exceeded = false;
+
+        const auto LookupState =
+            [&](const std::vector<unsigned>& subset, LookKind behind)
+        {
+            auto [id, inserted] = subsets.Insert(subset, behind);
+            if (!inserted)
+            {
+                return id;
+            }
+
+            if (subsets.Size() > state_limit)
+            {
+                exceeded = true;
+                return kInvalidDfaState;
+            }
+
+            // the builder numbers states in the same order
+            auto builder_id = builder.NewState(constructor.AcceptingLookahead(subset, behind));
+            assert(builder_id == id);
+            (void)builder_id;
+
+            return id;
+        };
+
+		// TODO: should empty string be allowed to be a match?
+        // process initial states, one for each kind of byte before start position
+        // NOTE acceptance of an initial state is only tested for bodies of assertions
+        //      as regex cannot match empty string
+        for (unsigned behind = 0; behind < kLookKindCount; ++behind)
+        {
+            auto key_behind = constructor.InitialBehind(static_cast<LookKind>(behind));
+            auto initial_id = LookupState(constructor.InitialSubset(), key_behind);
+            if (exceeded)
+            {
+                return nullptr;
+            }
+
+            builder.SetInitialState(static_cast<LookKind>(behind), initial_id);
+        }
+
+        // states are processed in the order they're added
+        std::vector<unsigned> source_subset;
+        std::vector<std::vector<unsigned>> buckets(classes.count);
+        for (DfaState source_id = 0; source_id < subsets.Size(); ++source_id)
+        {
+            subsets.CopySubset(source_id, source_subset);
+            constructor.Step(source_subset, subsets.Behind(source_id), buckets);
+
+            for (unsigned byte_class = 0; byte_class < classes.count; ++byte_class)
+            {
+                auto& target_subset = buckets[byte_class];
+
+                // empty target subset is invalid, so discard it
+                if (target_subset.empty())
+                {
+                    continue;
+                }
+
+                // the consumed byte becomes look-behind of the target
+                DfaState target_id = LookupState(target_subset, constructor.ClassLook(byte_class));
+                if (exceeded)
+                {
+                    return nullptr;
+                }
+
+                builder.NewTransition(source_id, target_id, byte_class);
+
+                target_subset.clear();
+            }
+        }
+
         return builder.Build();
     }
+
+    // paths leaving a state via epsilon and capture transitions
+    struct OnePassClosure
+    {
+        std::vector<std::pair<const NfaTransition*, OnePassActions>> entities; // entity transitions reached
+        bool accepting = false;
+        OnePassActions accepting_actions;
+    };
+
+    // returns false if a state is reached with different actions
+    // or a transition not supported by one-pass DFA is met
+    static bool ComputeOnePassClosure(const NfaState* start, OnePassClosure& output)
+    {
+        std::unordered_map<const NfaState*, OnePassActions> visited;
+        std::vector<std::pair<const NfaState*, OnePassActions>> waitlist{ { start, {} } };
+
+        while (!waitlist.empty())
+        {
+            auto [state, actions] = std::move(waitlist.back());
+            waitlist.pop_back();
+
+            // an epsilon cycle brings back the same actions, which is harmless
+            // otherwise the state is reached by two paths distinguishable by captures
+            auto [iter, inserted] = visited.try_emplace(state, actions);
+            if (!inserted)
+            {
+                if (iter->second != actions)
+                {
+                    return false;
+                }
+
+                continue;
+            }
+
+            if (state->is_final)
+            {
+                if (output.accepting && output.accepting_actions != actions)
+                {
+                    return false;
+                }
+
+                output.accepting = true;
+                output.accepting_actions = actions;
+            }
+
+            for (const NfaTransition* edge : state->exits)
+            {
+                switch (edge->type)
+                {
+                case TransitionType::Epsilon:
+                    waitlist.emplace_back(edge->target, actions);
+                    break;
+
+                case TransitionType::BeginCapture:
+                case TransitionType::EndCapture:
+                {
+                    auto id = std::get<unsigned>(edge->data);
+                    auto slot = edge->type == TransitionType::BeginCapture ? id * 2 : id * 2 + 1;
+
+                    OnePassActions new_actions = actions;
+                    new_actions.push_back(slot);
+                    waitlist.emplace_back(edge->target, std::move(new_actions));
+                }
+                    break;
+
+                case TransitionType::Entity:
+                case TransitionType::Class:
+                    output.entities.emplace_back(edge, actions);
+                    break;
+
+                default:
+                    return false;
+                }
+            }
+        }
+
+        return true;
+    }
+
+    // generates a one-pass DFA from a NFA
+    //
+    // states of the DFA are the initial state and targets of entity transitions of the NFA
+    // for every such state, epsilons and captures are followed to find entity transitions it could take
+    // where captures passed become actions of the transition
+    OnePassAutomaton::Ptr GenerateOnePassDfa(const NfaAutomaton &atm)
+    {
+        // partition the alphabet and count capture slots
+        ByteClassBuilder class_builder;
+        size_t slot_count = 0;
+        EnumerateNfa(atm.IntialState(), [&](const NfaState* state) {
+            for (const NfaTransition* edge : state->exits)
+            {
+                if (IsConsumingTransition(edge))
+                {
+                    class_builder.AddTransition(edge);
+                }
+                else if (edge->type == TransitionType::BeginCapture || edge->type == TransitionType::EndCapture)
+                {
+                    slot_count = std::max<size_t>(slot_count, std::get<unsigned>(edge->data) * 2 + 2);
+                }
+            }
+        });
+
+        auto classes = class_builder.Build();
+
+        // a byte representing each class
+        std::vector<int> class_representative(classes.count);
+        for (int ch = kDfaAlphabetSize - 1; ch >= 0; --ch)
+        {
+            class_representative[classes.class_of[ch]] = ch;
+        }
+
+        std::vector<unsigned> acceptance_lookup;
+        std::vector<OnePassTransition> jumptable;
+        std::vector<OnePassActions> actions_list{ {} };
+        std::map<OnePassActions, unsigned> actions_lookup{ { {}, 0 } };
+
+        std::unordered_map<const NfaState*, DfaState> state_map;
+        std::vector<const NfaState*> states;
+
+        const auto LookupActions = [&](const OnePassActions& actions) {
+            auto [iter, inserted] = actions_lookup.try_emplace(actions, static_cast<unsigned>(actions_list.size()));
+            if (inserted)
+            {
+                actions_list.push_back(actions);
+            }
+
+            return iter->second;
+        };
+
+        const auto LookupState = [&](const NfaState* state) {
+            auto [iter, inserted] = state_map.try_emplace(state, static_cast<DfaState>(states.size()));
+            if (inserted)
+            {
+                states.push_back(state);
+            }
+
+            return iter->second;
+        };
+
+        LookupState(atm.IntialState());
+        for (DfaState source_id = 0; source_id < states.size(); ++source_id)
+        {
+            OnePassClosure closure;
+            if (!ComputeOnePassClosure(states[source_id], closure))
+            {
+                return nullptr;
+            }
+
+            acceptance_lookup.push_back(closure.accepting
+                ? LookupActions(closure.accepting_actions)
+                : OnePassAutomaton::kNotAccepting);
+
+            // fill up a row of jumptable
+            std::vector<OnePassTransition> row(classes.count, OnePassTransition{ kInvalidDfaState, 0 });
+            for (unsigned byte_class = 0; byte_class < classes.count; ++byte_class)
+            {
+                for (const auto& [edge, actions] : closure.entities)
+                {
+                    if (!TestTransitionByte(edge, class_representative[byte_class]))
+                    {
+                        continue;
+                    }
+
+                    // two ways to go on the byte
+                    if (row[byte_class].target != kInvalidDfaState)
+                    {
+                        return nullptr;
+                    }
+
+                    row[byte_class] = OnePassTransition{ LookupState(edge->target), LookupActions(actions) };
+                }
+            }
+
+            jumptable.insert(jumptable.end(), row.begin(), row.end());
+        }
+
+        return std::make_unique<OnePassAutomaton>(classes, slot_count, std::move(acceptance_lookup),
+                                                  std::move(jumptable), std::move(actions_list));
+    }
 }
\ No newline at end of file
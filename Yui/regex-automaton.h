@@ -10,6 +10,11 @@
 #include <unordered_set>
 #include <variant>
 #include <functional>
+#include <array>
+#include <bitset>
+#include <cstdint>
+#include <limits>
+#include <memory>
 
 namespace yui
 {
@@ -23,12 +28,21 @@ namespace yui
     {
         Epsilon,			// empty transition
         Entity,				// for char range
+        Class,				// for a set of bytes
         Anchor,				// builtin zero-width assertion
         BeginCapture,		// begin capture
 		EndCapture,			// 
 		Reference,			// backreference
-		BeginAssertion,		// begin custom zero-width assertion (to-be-implemented)
-		EndAssertion,		// 
+		Assertion,			// lookahead assertion, whose body is tested by an automaton of its own
+    };
+
+    class DfaAutomaton;
+
+    // NOTE an assertion of the same body is shared by clones of the transition
+    struct AssertionData
+    {
+        AssertionType type;
+        std::shared_ptr<const DfaAutomaton> body;
     };
 
 	using TransitionDataType = 
@@ -37,8 +51,9 @@ namespace yui
 			EpsilonPriority,        // valid only when type is Epsilon
 			AnchorType,             // valid only when type is Anchor
 			CharRange,              // valid only when type is Entity
+			CharClass,              // valid only when type is Class
 			unsigned,               // valid only when type is Capture or Reference
-			AssertionType           // valid only when type is Assertion
+			AssertionData           // valid only when type is Assertion
 		>;
 
     struct NfaTransition
@@ -53,6 +68,20 @@ namespace yui
 		TransitionDataType data;
     };
 
+    // Entity and Class transitions are the ones consuming a byte
+    inline bool IsConsumingTransition(const NfaTransition* edge)
+    {
+        return edge->type == TransitionType::Entity || edge->type == TransitionType::Class;
+    }
+
+    // NOTE valid only for consuming transitions
+    inline bool TestTransitionByte(const NfaTransition* edge, int ch)
+    {
+        return edge->type == TransitionType::Entity
+            ? std::get<CharRange>(edge->data).Contain(ch)
+            : std::get<CharClass>(edge->data).Contain(ch);
+    }
+
     struct NfaState
     {
         bool is_final;                              // indicate whether this state is accepting
@@ -75,17 +104,35 @@ namespace yui
 	public:
 		using Ptr = std::unique_ptr<NfaAutomaton>;
 
-		NfaAutomaton(Arena arena, NfaState* begin, bool has_epsilon, bool dfa_compatible, ConstructionDummy = {})
+		NfaAutomaton(Arena arena, NfaState* begin, bool has_epsilon, bool dfa_compatible,
+                     bool simulation_compatible, bool simplified, ConstructionDummy = {})
             : arena_(std::move(arena))
             , initial_state_(begin)
             , has_epsilon_(has_epsilon)
-            , dfa_compatible_(dfa_compatible) { }
+            , dfa_compatible_(dfa_compatible)
+            , simulation_compatible_(simulation_compatible)
+            , simplified_(simplified) { }
 
         bool DfaCompatible() const
         {
             return dfa_compatible_;
         }
 
+        // if NfaRegexMatcher finds the same matches on it as on the Thompson NFA it comes from
+        // NOTE the backtracker cuts its search by stack depth, so its matches depend on the shape of the automaton
+        //      rather than the priority order of paths alone, which is all subset construction depends on
+        bool SimulationCompatible() const
+        {
+            return simulation_compatible_;
+        }
+
+        // if it's built from a tree rewritten by RegexFactoryBase::Simplify, see SimplifiedExpr
+        // NOTE the backtracker may find other matches on it than on the tree as constructed, while a DFA never does
+        bool Simplified() const
+        {
+            return simplified_;
+        }
+
         bool HasEpsilon() const
         {
             return has_epsilon_;
@@ -96,12 +143,20 @@ namespace yui
             return initial_state_;
         }
 
+        // bytes taken by states and transitions, see Arena::AllocatedBytes
+        size_t ArenaBytes() const
+        {
+            return arena_.AllocatedBytes();
+        }
+
     private:
         Arena arena_;
 
         bool dfa_compatible_;
         bool has_epsilon_;
         const NfaState* initial_state_;
+        bool simulation_compatible_;
+        bool simplified_;
     };
 
     class NfaBuilder : Uncopyable, Unmovable
@@ -111,11 +166,19 @@ namespace yui
         {
             has_epsilon_ = false;
             dfa_compatible_ = true;
+            simulation_compatible_ = true;
+            simplified_ = false;
         }
 
 		// a workaround to manually disable DFA
 		void DisableDfa() { dfa_compatible_ = false; }
 
+        // marks an automaton of another shape than the Thompson NFA, see NfaAutomaton::SimulationCompatible
+        void DisableSimulation() { simulation_compatible_ = false; }
+
+        // marks an automaton of a simplified tree, see NfaAutomaton::Simplified
+        void MarkSimplified() { simplified_ = true; }
+
         // allocates a new state
         NfaState* NewState(bool is_final = false);
 
@@ -125,12 +188,12 @@ namespace yui
 
         NfaTransition* NewEpsilonTransition(NfaBranch branch, EpsilonPriority priority);
         NfaTransition* NewEntityTransition(NfaBranch branch, CharRange value);
+        NfaTransition* NewClassTransition(NfaBranch branch, const CharClass& value);
         NfaTransition* NewAnchorTransition(NfaBranch branch, AnchorType anchor);
         NfaTransition* NewBeginCaptureTransition(NfaBranch branch, unsigned id);
-		NfaTransition* NewEndCaptureTransition(NfaBranch branch);
+		NfaTransition* NewEndCaptureTransition(NfaBranch branch, unsigned id);
 		NfaTransition* NewReferenceTransition(NfaBranch branch, unsigned id);
-        NfaTransition* NewBeginAssertionTransition(NfaBranch branch, AssertionType type);
-		NfaTransition* NewEndAssertionTransition(NfaBranch branch);
+        NfaTransition* NewAssertionTransition(NfaBranch branch, AssertionType type, std::shared_ptr<const DfaAutomaton> body);
 
         // construct the same transition between source and target
         NfaTransition* CloneTransition(NfaBranch branch, const NfaTransition *transition);
@@ -150,6 +213,8 @@ namespace yui
     private:
         bool has_epsilon_;
         bool dfa_compatible_;
+        bool simulation_compatible_;
+        bool simplified_;
 
         Arena arena_;
     };
@@ -165,9 +230,41 @@ namespace yui
 
     // TODO: refine constant definition here
     static constexpr auto kInvalidDfaState = std::numeric_limits<DfaState>::max();
-    static constexpr auto kDfaJumptableWidth = 128u;
+    static constexpr auto kDfaAlphabetSize = 256u;
 
-    // Jumptable of a DfaAutomaton should be a n*128 table
+    // Bytes that no transition in an automaton tells apart are merged into a byte class
+    // so that a jumptable has a column for each class instead of each byte
+    // e.g. a pure-ASCII pattern puts all bytes in [0x80, 0xff] into one class
+    using ByteClassMap = std::array<uint8_t, kDfaAlphabetSize>;
+
+    struct ByteClasses
+    {
+        ByteClassMap class_of;  // maps a byte to its class
+        unsigned count;         // number of classes
+    };
+
+    class ByteClassBuilder
+    {
+    public:
+        // ensures that bytes inside and outside the range never share a class
+        void AddRange(CharRange range);
+        void AddClass(const CharClass& cls);
+
+        // adds bytes taken by a consuming transition
+        void AddTransition(const NfaTransition* edge);
+
+        ByteClasses Build() const;
+
+    private:
+        // boundaries_[i] is set if byte i starts a new class
+        std::bitset<kDfaAlphabetSize> boundaries_;
+    };
+
+    // Jumptable of a DfaAutomaton should be a n*m table where m is the number of byte classes
+    //
+    // Anchors are resolved inside of a DFA: each state knows the kind of byte consumed to reach it,
+    // so a matcher starts at the initial state for the kind of byte before the start position,
+    // and whether a state accepts may depend on the kind of the next byte
     class DfaAutomaton : Uncopyable, Unmovable
     {
 	private:
@@ -176,55 +273,312 @@ namespace yui
 
 	public:
 		using Ptr = std::unique_ptr<DfaAutomaton>;
+        using InitialStateLookup = std::array<DfaState, kLookKindCount>;
 
-		DfaAutomaton(const std::vector<int> acc, const DfaStateVec& jumptable, ConstructionDummy = {})
-			: acceptance_lookup_(acc)
-			, jumptable_(jumptable) { }
+		DfaAutomaton(const ByteClasses& classes, const InitialStateLookup& initial,
+                     const std::vector<uint8_t>& acc, const DfaStateVec& jumptable,
+                     bool has_lookaround, ConstructionDummy = {})
+			: classes_(classes)
+            , initial_lookup_(initial)
+			, acceptance_lookup_(acc)
+			, jumptable_(jumptable)
+            , has_lookaround_(has_lookaround) { }
 
         size_t StateCount() const 
 		{
-			return jumptable_.size() / kDfaJumptableWidth;
+			return jumptable_.size() / classes_.count;
 		}
 
-        bool IsAccepting(DfaState state) const 
+        // if acceptance of any state depends on what's around it
+        bool HasLookaround() const
+        {
+            return has_lookaround_;
+        }
+
+        // tests if a match could end after the state
+        // where ahead is the kind of the next byte, or LineBreak at end of input
+        bool IsAccepting(DfaState state, LookKind ahead) const 
         {
             return state != kInvalidDfaState
-                && acceptance_lookup_[state] != -1;
+                && (acceptance_lookup_[state] & (1u << static_cast<unsigned>(ahead))) != 0;
         }
 
-        int InitialState() const 
+        // where behind is the kind of the byte before start position, or LineBreak at start of input
+        DfaState InitialState(LookKind behind = LookKind::LineBreak) const 
         {
-            return 0;
+            return initial_lookup_[static_cast<unsigned>(behind)];
         }
 
         int Transit(DfaState src, int ch) const
         {
-            assert(src <= jumptable_.size() / kDfaJumptableWidth);
-            assert(ch >= 0 && ch < 128);
+            assert(src <= StateCount());
+            assert(ch >= 0 && ch < static_cast<int>(kDfaAlphabetSize));
+
+            return jumptable_[src * classes_.count + classes_.class_of[ch]];
+        }
+
+        const ByteClasses& Classes() const
+        {
+            return classes_;
+        }
+
+        // row-major table indexed by (state, byte class), for matchers that index it themselves
+        const DfaState* Jumptable() const
+        {
+            return jumptable_.data();
+        }
 
-            return jumptable_[src * kDfaJumptableWidth + ch];
+        // bytes taken by the jumptable and the acceptance lookup
+        size_t TableBytes() const
+        {
+            return jumptable_.size() * sizeof(DfaState) + acceptance_lookup_.size();
         }
 
     private:
-		std::vector<int> acceptance_lookup_; // non-minis-one if accepting
+        ByteClasses classes_;
+        InitialStateLookup initial_lookup_;
+		std::vector<uint8_t> acceptance_lookup_; // bit k set if accepting before a byte of LookKind k
 		DfaStateVec jumptable_;
+        bool has_lookaround_;
     };
 
     class DfaBuilder : Uncopyable, Unmovable
     {
     public:
-        DfaState NewState(bool accepting);
-        void NewTransition(DfaState src, DfaState target, int ch);
+        DfaBuilder(const ByteClasses& classes, bool has_lookaround)
+            : classes_(classes), has_lookaround_(has_lookaround) { }
+
+        // accepting_lookahead is a mask of LookKind after which the state accepts
+        DfaState NewState(unsigned accepting_lookahead);
+        void NewTransition(DfaState src, DfaState target, unsigned byte_class);
+        void SetInitialState(LookKind behind, DfaState state);
 
         DfaAutomaton::Ptr Build();
 
     private:
         DfaState next_state_ = 0;
 
-		std::vector<int> acceptance_lookup_;
+        ByteClasses classes_;
+        bool has_lookaround_;
+
+        DfaAutomaton::InitialStateLookup initial_lookup_ = {};
+		std::vector<uint8_t> acceptance_lookup_;
         DfaStateVec jumptable_;
     };
 
+    // Subset Construction
+    //
+
+    // Interns subsets of NFA states met in subset construction, each of which becomes a DFA state
+    // a subset is a sorted array of state indices, all of which are kept in a single pool
+    // and found via an open-addressing table of their precomputed hashes
+    class DfaSubsetTable
+    {
+    public:
+        // returns the id of the subset, and true if it's newly added
+        // NOTE ids are numbered in the order subsets are added
+        std::pair<DfaState, bool> Insert(const std::vector<unsigned>& subset, LookKind behind);
+
+        // returns the id of the subset, or kInvalidDfaState if it's not added
+        DfaState Find(const std::vector<unsigned>& subset, LookKind behind) const;
+
+        size_t Size() const
+        {
+            return entries_.size();
+        }
+
+        LookKind Behind(DfaState id) const
+        {
+            return entries_[id].behind;
+        }
+
+        void CopySubset(DfaState id, std::vector<unsigned>& output) const
+        {
+            const auto& entry = entries_[id];
+            output.assign(pool_.begin() + entry.offset, pool_.begin() + entry.offset + entry.length);
+        }
+
+    private:
+        struct SubsetEntry
+        {
+            size_t hash;
+            size_t offset;      // where the subset starts in pool_
+            size_t length;
+            LookKind behind;
+        };
+
+        static size_t Hash(const std::vector<unsigned>& subset, LookKind behind);
+        void Rehash(size_t capacity);
+
+    private:
+        std::vector<SubsetEntry> entries_;  // indexed by id
+        std::vector<unsigned> pool_;
+        std::vector<DfaState> slots_;       // a power of 2 in size
+    };
+
+    // Computes what a DFA state built from a subset of NFA states does, one subset at a time,
+    // for GenerateDfa building every state up front and LazyDfaAutomaton building them on demand
+    //
+    // anchors are resolved during subset construction
+    // a DFA state is a set of NFA states together with the kind of the byte consumed to reach it(look-behind),
+    // and the byte to consume next serves as look-ahead for anchors passed right before it
+    // NOTES for automata without anchors, the look-behind of every state is LineBreak
+    //       all methods are const and safe to call from multiple threads
+    class SubsetConstructor : Uncopyable, Unmovable
+    {
+    public:
+        SubsetConstructor(const NfaAutomaton& atm);
+
+        const ByteClasses& Classes() const
+        {
+            return classes_;
+        }
+
+        bool HasLookaround() const
+        {
+            return has_lookaround_;
+        }
+
+        // the kind of look bytes of a class give
+        LookKind ClassLook(unsigned byte_class) const
+        {
+            return class_look_[byte_class];
+        }
+
+        // the subset and look-behind of the initial state for the kind of byte before start position
+        std::vector<unsigned> InitialSubset() const
+        {
+            return { initial_index_ };
+        }
+
+        LookKind InitialBehind(LookKind behind) const
+        {
+            return has_lookaround_ ? behind : LookKind::LineBreak;
+        }
+
+        // a mask of LookKind before which the state accepts, i.e. anchors passed lead to an accepting state
+        unsigned AcceptingLookahead(const std::vector<unsigned>& subset, LookKind behind) const;
+
+        // collects the target subset of every byte class into buckets, each sorted and deduplicated
+        // where an empty one means there's no transition
+        // NOTE buckets are expected to be empty, one for each byte class
+        void Step(const std::vector<unsigned>& subset, LookKind behind, std::vector<std::vector<unsigned>>& buckets) const;
+
+        // same as Step, but for a single byte class
+        // NOTE the look-behind of the target is ClassLook(byte_class)
+        void StepClass(const std::vector<unsigned>& subset, LookKind behind, unsigned byte_class, std::vector<unsigned>& output) const;
+
+    private:
+        // a solid state of the NFA, with byte classes taken by each transition computed once
+        struct SolidState
+        {
+            bool accepting;
+            std::vector<std::pair<AnchorType, unsigned>> anchors;
+            std::vector<std::pair<std::vector<unsigned>, unsigned>> entities; // byte classes and target
+        };
+
+        // expands a subset with states reachable via anchors that pass between the two kinds of bytes
+        void ExpandAnchors(const std::vector<unsigned>& subset, LookKind behind, LookKind ahead, std::vector<unsigned>& output) const;
+
+    private:
+        ByteClasses classes_;
+        bool has_lookaround_;
+        std::vector<LookKind> class_look_;
+
+        std::vector<SolidState> solids_;
+        unsigned initial_index_;
+    };
+
+    // One-pass DFA
+    //
+
+    // An NFA is one-pass if from every state reached after consuming a byte,
+    // there's at most one path to take on the next byte and at most one path to accept
+    // Then the path of a match is unique, so a DFA of the same states could track captures
+    // by saving positions into slots on its transitions
+    //
+    // slot 2k and 2k+1 holds the begin and the end of capture k
+
+    // slots to save the current position into, in order
+    using OnePassActions = std::vector<unsigned>;
+
+    struct OnePassTransition
+    {
+        DfaState target;
+        unsigned actions;   // index of actions performed before consuming the byte
+    };
+
+    // This class should only be constructed via GenerateOnePassDfa
+    class OnePassAutomaton : Uncopyable, Unmovable
+    {
+	private:
+		friend std::unique_ptr<OnePassAutomaton> GenerateOnePassDfa(const NfaAutomaton& atm);
+		struct ConstructionDummy { };
+
+	public:
+		using Ptr = std::unique_ptr<OnePassAutomaton>;
+
+        // an entry of acceptance lookup is index of actions performed on accepting
+        static constexpr unsigned kNotAccepting = std::numeric_limits<unsigned>::max();
+
+		OnePassAutomaton(const ByteClasses& classes, size_t slot_count,
+                         std::vector<unsigned> acc, std::vector<OnePassTransition> jumptable,
+                         std::vector<OnePassActions> actions, ConstructionDummy = {})
+			: classes_(classes)
+            , slot_count_(slot_count)
+			, acceptance_lookup_(std::move(acc))
+			, jumptable_(std::move(jumptable))
+            , actions_(std::move(actions)) { }
+
+        size_t StateCount() const
+        {
+            return jumptable_.size() / classes_.count;
+        }
+
+        size_t SlotCount() const
+        {
+            return slot_count_;
+        }
+
+        DfaState InitialState() const
+        {
+            return 0;
+        }
+
+        bool IsAccepting(DfaState state) const
+        {
+            return acceptance_lookup_[state] != kNotAccepting;
+        }
+
+        // NOTE valid only if the state is accepting
+        const OnePassActions& AcceptingActions(DfaState state) const
+        {
+            return actions_[acceptance_lookup_[state]];
+        }
+
+        // target of the returned transition is kInvalidDfaState if there's none
+        const OnePassTransition& Transit(DfaState src, int ch) const
+        {
+            assert(src < StateCount());
+            assert(ch >= 0 && ch < static_cast<int>(kDfaAlphabetSize));
+
+            return jumptable_[src * classes_.count + classes_.class_of[ch]];
+        }
+
+        const OnePassActions& Actions(unsigned index) const
+        {
+            return actions_[index];
+        }
+
+    private:
+        ByteClasses classes_;
+        size_t slot_count_;
+
+        std::vector<unsigned> acceptance_lookup_;
+        std::vector<OnePassTransition> jumptable_;
+        std::vector<OnePassActions> actions_; // actions_[0] is always empty
+    };
+
     // On-Automaton Algorithms
     //
 
@@ -240,9 +594,36 @@ namespace yui
         std::unordered_multimap<const NfaState*, const NfaTransition*> outbounds;
     };
 
+    // priority of a transition, the smaller the more prior
+    int CalcTransitionPriority(const NfaTransition* edge);
+
     void EnumerateNfa(const NfaState* initial, std::function<void(const NfaState*)> callback);
+
+    struct NfaSize
+    {
+        size_t state_count;
+        size_t transition_count;
+    };
+
+    // counts states reachable from the initial state and their transitions
+    NfaSize MeasureNfa(const NfaAutomaton& atm);
     NfaEvaluationResult EvaluateNfa(const NfaAutomaton& atm);
 
     NfaAutomaton::Ptr EliminateEpsilon(const NfaAutomaton &atm);
-    DfaAutomaton::Ptr GenerateDfa(const NfaAutomaton &atm);
+
+    // Reduces an epsilon-free NFA by trimming states that are unreachable or never lead to a match,
+    // and merging states with the same future or the same past
+    // NOTES paths are taken in the same priority order, only fewer of them are duplicates
+    //       it's meant for subset construction, as the result is not SimulationCompatible
+    NfaAutomaton::Ptr ReduceNfa(const NfaAutomaton &atm);
+
+    // a state limit that never stops GenerateDfa
+    static constexpr size_t kNoDfaStateLimit = std::numeric_limits<size_t>::max();
+
+    // Returns nullptr if the DFA would take more than state_limit states
+    // NOTE a DFA takes sizeof(DfaState) bytes for each byte class of each state
+    DfaAutomaton::Ptr GenerateDfa(const NfaAutomaton &atm, size_t state_limit = kNoDfaStateLimit);
+
+    // Returns nullptr if the NFA is not one-pass or has transitions other than entities, captures and epsilons
+    OnePassAutomaton::Ptr GenerateOnePassDfa(const NfaAutomaton &atm);
 }
\ No newline at end of file
@@ -1,5 +1,9 @@
 #pragma once
 #include <cassert>
+#include <array>
+#include <cstdint>
+#include <vector>
+#include <initializer_list>
 
 namespace yui
 {
@@ -17,8 +21,51 @@ namespace yui
     {
         LineStart,
         LineBreak,
+        WordBoundary,
     };
 
+    // What an anchor sees of a byte around its position
+    // NOTE start and end of input are regarded as line breaks
+    enum class LookKind
+    {
+        LineBreak,
+        Word,
+        Other,
+    };
+
+    static constexpr unsigned kLookKindCount = 3;
+
+    inline LookKind ClassifyLook(int ch)
+    {
+        if (ch == '\n')
+        {
+            return LookKind::LineBreak;
+        }
+
+        bool is_word = (ch >= 'a' && ch <= 'z')
+            || (ch >= 'A' && ch <= 'Z')
+            || (ch >= '0' && ch <= '9')
+            || ch == '_';
+
+        return is_word ? LookKind::Word : LookKind::Other;
+    }
+
+    // tests an anchor with kinds of the bytes before and after its position
+    inline bool TestAnchor(AnchorType anchor, LookKind behind, LookKind ahead)
+    {
+        switch (anchor)
+        {
+        case AnchorType::LineStart:
+            return behind == LookKind::LineBreak;
+        case AnchorType::LineBreak:
+            return ahead == LookKind::LineBreak;
+        case AnchorType::WordBoundary:
+            return (behind == LookKind::Word) != (ahead == LookKind::Word);
+        }
+
+        return false;
+    }
+
 	// Assertion always looks ahead
     enum class AssertionType
     {
@@ -32,6 +79,15 @@ namespace yui
         Reluctant,
     };
 
+    // how a character range is matched against input bytes
+    enum class CharEncoding
+    {
+        Byte,       // a range of bytes in [0, 255]
+        Utf8,       // a range of code points, each is matched as its UTF-8 byte sequence
+    };
+
+    static constexpr int kMaxCodepoint = 0x10FFFF;
+
     // TODO: make max exclusive
     // [min, max]
     class CharRange
@@ -55,6 +111,103 @@ namespace yui
         int min_, max_;
     };
 
+    // A set of bytes, stored as a 256-bit bitmap so that testing a byte is a single lookup
+    // NOTES set operations are meant for factory time, a class is never modified once in an automaton
+    class CharClass
+    {
+    public:
+        CharClass() = default;
+        CharClass(std::initializer_list<CharRange> ranges)
+        {
+            for (auto rg : ranges)
+            {
+                AddRange(rg);
+            }
+        }
+
+        bool Contain(int ch) const
+        {
+            assert(ch >= 0 && ch < 256);
+            return (bits_[ch >> 6] >> (ch & 63)) & 1;
+        }
+
+        bool Empty() const
+        {
+            return (bits_[0] | bits_[1] | bits_[2] | bits_[3]) == 0;
+        }
+
+        void AddRange(CharRange rg)
+        {
+            assert(rg.Min() >= 0 && rg.Max() < 256);
+            for (int ch = rg.Min(); ch <= rg.Max(); ++ch)
+            {
+                bits_[ch >> 6] |= uint64_t{ 1 } << (ch & 63);
+            }
+        }
+
+        CharClass Negate() const
+        {
+            CharClass result;
+            for (size_t i = 0; i < bits_.size(); ++i)
+            {
+                result.bits_[i] = ~bits_[i];
+            }
+
+            return result;
+        }
+
+        CharClass Union(const CharClass& other) const
+        {
+            CharClass result;
+            for (size_t i = 0; i < bits_.size(); ++i)
+            {
+                result.bits_[i] = bits_[i] | other.bits_[i];
+            }
+
+            return result;
+        }
+
+        CharClass Intersect(const CharClass& other) const
+        {
+            CharClass result;
+            for (size_t i = 0; i < bits_.size(); ++i)
+            {
+                result.bits_[i] = bits_[i] & other.bits_[i];
+            }
+
+            return result;
+        }
+
+        // maximal ranges of bytes in the class, in ascending order
+        std::vector<CharRange> Ranges() const
+        {
+            std::vector<CharRange> result;
+            for (int ch = 0; ch < 256; ++ch)
+            {
+                if (!Contain(ch))
+                {
+                    continue;
+                }
+
+                auto min = ch;
+                while (ch + 1 < 256 && Contain(ch + 1))
+                {
+                    ch += 1;
+                }
+
+                result.emplace_back(min, ch);
+            }
+
+            return result;
+        }
+
+        bool operator==(const CharClass& other) const { return bits_ == other.bits_; }
+        bool operator!=(const CharClass& other) const { return bits_ != other.bits_; }
+
+    private:
+        std::array<uint64_t, 4> bits_ = {};
+    };
+
     // [min, max]
     class Repetition
     {
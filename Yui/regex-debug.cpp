@@ -1,6 +1,7 @@
 #include "regex-debug.h"
 #include "regex-automaton.h"
 #include <functional>
+#include <cctype>
 
 using namespace std;
 
@@ -27,7 +28,21 @@ namespace yui
 
     std::string ToString(AnchorType anchor)
     {
-        return anchor == AnchorType::LineBreak ? "$" : "^";
+        switch (anchor)
+        {
+        case AnchorType::LineStart:
+            return "^";
+        case AnchorType::LineBreak:
+            return "$";
+        case AnchorType::WordBoundary:
+        default:
+            return "\\b";
+        }
+    }
+
+    std::string ToString(AssertionType assertion)
+    {
+        return assertion == AssertionType::Positive ? "PositiveLookAhead" : "NegativeLookAhead";
     }
 
     void PrintNfa(const NfaAutomaton& atm)
@@ -71,6 +86,16 @@ namespace yui
                     printf("Codepoint(%c, %c)", rg.Min(), rg.Max());
                 }
                 break;
+                case TransitionType::Class:
+                {
+                    printf("Class(");
+                    for (auto rg : std::get<CharClass>(edge->data).Ranges())
+                    {
+                        printf("[%d, %d]", rg.Min(), rg.Max());
+                    }
+                    printf(")");
+                }
+                break;
                 case TransitionType::Anchor:
                     printf("Anchor(%s)", ToString(std::get<AnchorType>(edge->data)).c_str());
                     break;
@@ -80,23 +105,14 @@ namespace yui
                 case TransitionType::Reference:
                     printf("Reference(%d)", std::get<unsigned>(edge->data));
                     break;
-                case TransitionType::BeginAssertion:
+                case TransitionType::Assertion:
                     {
-						printf("Assertion");
-						switch (std::get<AssertionType>(edge->data))
-                        {
-                        case AssertionType::Positive:
-                            printf("(PositiveLookAhead)");
-                            break;
-                        case AssertionType::Negative:
-                            printf("(NegativeLookAhead)");
-                            break;
-                        }
-                        printf("\n");
+                        const auto& assertion = std::get<AssertionData>(edge->data);
+						printf("Assertion(%s, %zu DfaStates)", ToString(assertion.type).c_str(), assertion.body->StateCount());
                     }
                     break;
                 case TransitionType::EndCapture:
-                    printf("(finish)");
+                    printf("(finish %d)", std::get<unsigned>(edge->data));
                     break;
                 }
 
@@ -123,15 +139,38 @@ namespace yui
     {
         for (DfaState s = 0; s < atm.StateCount(); ++s)
         {
-            auto accepting_flag = atm.IsAccepting(s) ? "(final)" : "";
-            printf("DfaState %d%s:\n", s, accepting_flag);
+            // acceptance may depend on the kind of the next byte
+            static const char* const kLookKindNames[kLookKindCount] = { "\\n", "word", "other" };
+
+            std::string accepting_flag;
+            for (size_t kind = 0; kind < kLookKindCount; ++kind)
+            {
+                if (atm.IsAccepting(s, static_cast<LookKind>(kind)))
+                {
+                    accepting_flag += accepting_flag.empty() ? "(final if followed by " : "|";
+                    accepting_flag += kLookKindNames[kind];
+                }
+            }
+            if (!accepting_flag.empty())
+            {
+                accepting_flag = atm.HasLookaround() ? accepting_flag + ")" : "(final)";
+            }
+
+            printf("DfaState %d%s:\n", s, accepting_flag.c_str());
             
-            for (int ch = 0; ch < 128; ++ch)
+            for (int ch = 0; ch < static_cast<int>(kDfaAlphabetSize); ++ch)
             {
-                auto target = atm.Transit(s, ch);
+                auto target = static_cast<DfaState>(atm.Transit(s, ch));
                 if (target != kInvalidDfaState)
                 {
-                    printf("  char of %c --> DfaState %d\n", ch, target);
+                    if (isprint(ch))
+                    {
+                        printf("  char of %c --> DfaState %d\n", ch, target);
+                    }
+                    else
+                    {
+                        printf("  byte of 0x%02x --> DfaState %d\n", ch, target);
+                    }
                 }
             }
         }
@@ -8,6 +8,7 @@ namespace yui
 
     std::string ToString(EpsilonPriority priority);
     std::string ToString(AnchorType anchor);
+    std::string ToString(AssertionType assertion);
 
     void PrintNfa(const NfaAutomaton &atm);
     void PrintDfa(const DfaAutomaton &atm);
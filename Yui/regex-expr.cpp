@@ -1,6 +1,9 @@
 #include "regex-expr.h"
 #include "regex-automaton.h"
+#include "regex-glushkov.h"
 #include "regex-debug.h"
+#include <map>
+#include <tuple>
 
 namespace yui
 {
@@ -15,12 +18,176 @@ namespace yui
         return result;
     }
 
+    // a code point range is matched by a set of byte sequences, each has 1 to 4 byte ranges
+    using Utf8Sequence = std::vector<CharRange>;
+
+    static constexpr int kUtf8LengthBoundaries[] = { 0x7F, 0x7FF, 0xFFFF, kMaxCodepoint };
+
+    static int EncodeUtf8(int cp, int* bytes)
+    {
+        if (cp <= 0x7F)
+        {
+            bytes[0] = cp;
+            return 1;
+        }
+        else if (cp <= 0x7FF)
+        {
+            bytes[0] = 0xC0 | (cp >> 6);
+            bytes[1] = 0x80 | (cp & 0x3F);
+            return 2;
+        }
+        else if (cp <= 0xFFFF)
+        {
+            bytes[0] = 0xE0 | (cp >> 12);
+            bytes[1] = 0x80 | ((cp >> 6) & 0x3F);
+            bytes[2] = 0x80 | (cp & 0x3F);
+            return 3;
+        }
+        else
+        {
+            bytes[0] = 0xF0 | (cp >> 18);
+            bytes[1] = 0x80 | ((cp >> 12) & 0x3F);
+            bytes[2] = 0x80 | ((cp >> 6) & 0x3F);
+            bytes[3] = 0x80 | (cp & 0x3F);
+            return 4;
+        }
+    }
+
+    // splits a code point range into byte sequences
+    // a range is split until every byte of its minimum and maximum differs only in a full
+    // continuation range, so the range becomes a product of byte ranges
+    static std::vector<Utf8Sequence> SplitUtf8Range(CharRange range)
+    {
+        std::vector<Utf8Sequence> result;
+        std::vector<std::pair<int, int>> waitlist{ { range.Min(), range.Max() } };
+
+        while (!waitlist.empty())
+        {
+            auto [min, max] = waitlist.back();
+            waitlist.pop_back();
+
+            // surrogates are not valid in UTF-8
+            if (min < 0xD800 && max > 0xDFFF)
+            {
+                waitlist.emplace_back(0xE000, max);
+                waitlist.emplace_back(min, 0xD7FF);
+                continue;
+            }
+            if (min >= 0xD800 && min <= 0xDFFF)
+            {
+                min = 0xE000;
+            }
+            if (max >= 0xD800 && max <= 0xDFFF)
+            {
+                max = 0xD7FF;
+            }
+            if (min > max)
+            {
+                continue;
+            }
+
+            // split at boundaries of encoded length
+            bool split = false;
+            for (int boundary : kUtf8LengthBoundaries)
+            {
+                if (min <= boundary && max > boundary)
+                {
+                    waitlist.emplace_back(boundary + 1, max);
+                    waitlist.emplace_back(min, boundary);
+                    split = true;
+                    break;
+                }
+            }
+
+            // split where a trailing continuation byte doesn't cover its full range
+            for (int i = 1; i < 4 && !split; ++i)
+            {
+                int mask = (1 << (6 * i)) - 1;
+                if ((min & ~mask) != (max & ~mask))
+                {
+                    if ((min & mask) != 0)
+                    {
+                        waitlist.emplace_back((min | mask) + 1, max);
+                        waitlist.emplace_back(min, min | mask);
+                        split = true;
+                    }
+                    else if ((max & mask) != mask)
+                    {
+                        waitlist.emplace_back(max & ~mask, max);
+                        waitlist.emplace_back(min, (max & ~mask) - 1);
+                        split = true;
+                    }
+                }
+            }
+
+            if (!split)
+            {
+                int min_bytes[4], max_bytes[4];
+                int length = EncodeUtf8(min, min_bytes);
+                EncodeUtf8(max, max_bytes);
+
+                Utf8Sequence seq;
+                for (int i = 0; i < length; ++i)
+                {
+                    seq.push_back(CharRange{ min_bytes[i], max_bytes[i] });
+                }
+
+                result.push_back(std::move(seq));
+            }
+        }
+
+        return result;
+    }
+
     void EntityExpr::ConnectNfa(NfaBuilder& builder, NfaBranch which)
     {
-        builder.NewEntityTransition(which, Range());
+        if (Encoding() == CharEncoding::Byte)
+        {
+            builder.NewEntityTransition(which, Range());
+            return;
+        }
+
+        // path looks like a trie of byte ranges, but built from the end:
+        //
+        // which.begin - [C2-DF] ------------ [80-BF] - which.end
+        //            \                      /
+        //              [E1-EC] - [80-BF] --
+        //
+        // sequences sharing a suffix share the states of it
+        std::map<std::tuple<const NfaState*, int, int>, NfaState*> suffix_states;
+        for (const auto& seq : SplitUtf8Range(Range()))
+        {
+            NfaState* target = which.end;
+            for (size_t i = seq.size() - 1; i > 0; --i)
+            {
+                auto key = std::make_tuple(target, seq[i].Min(), seq[i].Max());
+
+                auto iter = suffix_states.find(key);
+                if (iter != suffix_states.end())
+                {
+                    target = iter->second;
+                }
+                else
+                {
+                    NfaState* source = builder.NewState();
+                    builder.NewEntityTransition({ source, target }, seq[i]);
+                    suffix_states.insert_or_assign(key, source);
+
+                    target = source;
+                }
+            }
+
+            builder.NewEntityTransition({ which.begin, target }, seq.front());
+        }
     }
 
     // TODO: add reversed concatenation expression
+    void CharClassExpr::ConnectNfa(NfaBuilder& builder, NfaBranch which)
+    {
+        // a single transition however many ranges there are
+        builder.NewClassTransition(which, class_);
+    }
+
     void ConcatenationExpr::ConnectNfa(NfaBuilder& builder, NfaBranch which)
     {
         // path looks like:
@@ -135,13 +302,32 @@ namespace yui
         builder.NewAnchorTransition(which, type_);
     }
 
+    // the body of an assertion is built into an automaton of its own
+    // so that the matcher tests it in a single pass, independent of backtracking
+    static std::shared_ptr<const DfaAutomaton> CompileAssertionBody(RegexExpr& expr)
+    {
+        NfaBuilder body_builder;
+        auto body_branch = body_builder.NewBranch(true);
+        expr.ConnectNfa(body_builder, body_branch);
+
+        auto body = body_builder.Build(body_branch.begin);
+        assert(body->DfaCompatible());
+
+        return GenerateDfa(*body);
+    }
+
+    void AssertionExpr::ConnectNfa(NfaBuilder& builder, NfaBranch which)
+    {
+        builder.NewAssertionTransition(which, type_, CompileAssertionBody(*expr_));
+    }
+
     void CaptureExpr::ConnectNfa(NfaBuilder& builder, NfaBranch which)
     {
         auto inner_branch = builder.NewBranch(false);
         expr_->ConnectNfa(builder, inner_branch);
 
         builder.NewBeginCaptureTransition(NfaBranch{ which.begin, inner_branch.begin }, id_);
-        builder.NewEndCaptureTransition(NfaBranch{ inner_branch.end, which.end });
+        builder.NewEndCaptureTransition(NfaBranch{ inner_branch.end, which.end }, id_);
     }
 
     void ReferenceExpr::ConnectNfa(NfaBuilder& builder, NfaBranch which)
@@ -149,13 +335,164 @@ namespace yui
         builder.NewReferenceTransition(which, id_);
     }
 
+    void SimplifiedExpr::ConnectNfa(NfaBuilder& builder, NfaBranch which)
+    {
+        builder.MarkSimplified();
+        expr_->ConnectNfa(builder, which);
+    }
+
+    // Implementations for RegexExpr::ConnectGlushkov
+    //
+
+    GlushkovFragment EntityExpr::ConnectGlushkov(GlushkovBuilder& builder)
+    {
+        if (Encoding() == CharEncoding::Byte)
+        {
+            return builder.NewPosition(TransitionType::Entity, Range());
+        }
+
+        // a position for each byte range of each sequence
+        // NOTE unlike ConnectNfa, sequences sharing a suffix don't share positions
+        auto result = builder.NewNever();
+        for (const auto& seq : SplitUtf8Range(Range()))
+        {
+            auto path = builder.NewPosition(TransitionType::Entity, seq.front());
+            for (size_t i = 1; i < seq.size(); ++i)
+            {
+                path = builder.Concat(path, builder.NewPosition(TransitionType::Entity, seq[i]));
+            }
+
+            result = builder.Alter(result, path);
+        }
+
+        return result;
+    }
+
+    GlushkovFragment CharClassExpr::ConnectGlushkov(GlushkovBuilder& builder)
+    {
+        return builder.NewPosition(TransitionType::Class, class_);
+    }
+
+    GlushkovFragment ConcatenationExpr::ConnectGlushkov(GlushkovBuilder& builder)
+    {
+        auto result = builder.NewEmpty();
+        for (auto child : Children())
+        {
+            result = builder.Concat(result, child->ConnectGlushkov(builder));
+        }
+
+        return result;
+    }
+
+    GlushkovFragment AlternationExpr::ConnectGlushkov(GlushkovBuilder& builder)
+    {
+        auto result = builder.NewNever();
+        for (auto child : Children())
+        {
+            result = builder.Alter(result, child->ConnectGlushkov(builder));
+        }
+
+        return result;
+    }
+
+    GlushkovFragment RepetitionExpr::ConnectGlushkov(GlushkovBuilder& builder)
+    {
+        Repetition rep = Count();
+
+        // positions are cloned by building the child again
+        // [m, inf] repetition requires m copies, or one if m is 0
+        // [m, n] requires n copies
+        size_t copy_count = rep.GoInfinity() ? std::max<size_t>(rep.Min(), 1) : rep.Max();
+
+        std::vector<GlushkovFragment> copies;
+        for (size_t i = 0; i < copy_count; ++i)
+        {
+            copies.push_back(Child()->ConnectGlushkov(builder));
+        }
+
+        if (rep.GoInfinity())
+        {
+            // the last copy loops
+            copies.back() = builder.Closure(copies.back(), Strategy(), rep.Min() > 0);
+        }
+        else
+        {
+            // copies after the first m are optional, each of them nested in the previous one
+            // as a copy is only tried after the previous one
+            for (size_t i = copy_count; i-- > rep.Min(); )
+            {
+                auto tail = i + 1 < copies.size()
+                    ? builder.Concat(copies[i], copies[i + 1])
+                    : copies[i];
+
+                copies[i] = builder.Optional(tail, Strategy());
+                copies.resize(i + 1);
+            }
+        }
+
+        auto result = copies.front();
+        for (size_t i = 1; i < copies.size(); ++i)
+        {
+            result = builder.Concat(result, copies[i]);
+        }
+
+        return result;
+    }
+
+    GlushkovFragment AnchorExpr::ConnectGlushkov(GlushkovBuilder& builder)
+    {
+        return builder.NewPosition(TransitionType::Anchor, type_);
+    }
+
+    GlushkovFragment AssertionExpr::ConnectGlushkov(GlushkovBuilder& builder)
+    {
+        return builder.NewPosition(TransitionType::Assertion, AssertionData{ type_, CompileAssertionBody(*expr_) });
+    }
+
+    GlushkovFragment CaptureExpr::ConnectGlushkov(GlushkovBuilder& builder)
+    {
+        auto begin = builder.NewPosition(TransitionType::BeginCapture, id_);
+        auto inner = builder.Concat(begin, expr_->ConnectGlushkov(builder));
+
+        return builder.Concat(inner, builder.NewPosition(TransitionType::EndCapture, id_));
+    }
+
+    GlushkovFragment ReferenceExpr::ConnectGlushkov(GlushkovBuilder& builder)
+    {
+        return builder.NewPosition(TransitionType::Reference, id_);
+    }
+
+    // NOTE a Glushkov NFA is never simulated anyway
+    GlushkovFragment SimplifiedExpr::ConnectGlushkov(GlushkovBuilder& builder)
+    {
+        return expr_->ConnectGlushkov(builder);
+    }
+
     // DEBUG
     //
 
     void EntityExpr::Print(size_t ident)
     {
         PrintIdent(ident);
-        printf("EntityExpr{ %c-%c }\n", range_.Min(), range_.Max());
+        if (encoding_ == CharEncoding::Utf8)
+        {
+            printf("EntityExpr{ U+%04X-U+%04X }\n", range_.Min(), range_.Max());
+        }
+        else
+        {
+            printf("EntityExpr{ %c-%c }\n", range_.Min(), range_.Max());
+        }
+    }
+
+    void CharClassExpr::Print(size_t ident)
+    {
+        PrintIdent(ident);
+        printf("CharClassExpr{");
+        for (auto rg : class_.Ranges())
+        {
+            printf(" %c-%c", rg.Min(), rg.Max());
+        }
+        printf(" }\n");
     }
 
     void ConcatenationExpr::Print(size_t ident)
@@ -193,6 +530,14 @@ namespace yui
         printf("AnchorExpr{%s}\n", ToString(type_).c_str());
     }
 
+    void AssertionExpr::Print(size_t ident)
+    {
+        PrintIdent(ident);
+        printf("AssertionExpr{%s}\n", ToString(type_).c_str());
+
+        expr_->Print(ident + 2);
+    }
+
     void CaptureExpr::Print(size_t ident)
     {
         PrintIdent(ident);
@@ -206,4 +551,12 @@ namespace yui
         PrintIdent(ident);
         printf("ReferenceExpr{%d}\n", id_);
     }
+
+    void SimplifiedExpr::Print(size_t ident)
+    {
+        PrintIdent(ident);
+        printf("SimplifiedExpr\n");
+
+        expr_->Print(ident + 2);
+    }
 }
\ No newline at end of file
@@ -12,6 +12,9 @@ namespace yui
     struct NfaBranch;
     class NfaBuilder;
 
+    struct GlushkovFragment;
+    class GlushkovBuilder;
+
     // TODO: use Visitor pattern
     class RegexExpr
     {
@@ -31,6 +34,9 @@ namespace yui
 
         // build a path between of such expression between two states given
         virtual void ConnectNfa(NfaBuilder& builder, NfaBranch which) = 0;
+
+        // build positions of such expression, see regex-glushkov.h
+        virtual GlushkovFragment ConnectGlushkov(GlushkovBuilder& builder) = 0;
     };
 
     using RegexExprVec = std::vector<RegexExpr*>;
@@ -51,6 +57,8 @@ namespace yui
 
         RegexExpr* Expr() const { return root_; }
 
+        size_t ArenaBytes() const { return arena_.AllocatedBytes(); }
+
     private:
         Arena arena_;
         RegexExpr* root_;
@@ -72,16 +80,36 @@ namespace yui
     class EntityExpr : public RegexExprBase<true, true>
     {
     public:
-        EntityExpr(CharRange rg)
-            : range_(rg) { }
+        EntityExpr(CharRange rg, CharEncoding encoding = CharEncoding::Byte)
+            : range_(rg), encoding_(encoding) { }
 
         auto Range() const { return range_; }
+        auto Encoding() const { return encoding_; }
 
         void Print(size_t ident) override;
         void ConnectNfa(NfaBuilder& builder, NfaBranch which) override;
+        GlushkovFragment ConnectGlushkov(GlushkovBuilder& builder) override;
 
     private:
         CharRange range_;
+        CharEncoding encoding_;
+    };
+
+    // NOTE a class is a set of bytes, it knows nothing about encodings
+    class CharClassExpr : public RegexExprBase<true, true>
+    {
+    public:
+        CharClassExpr(const CharClass& cls)
+            : class_(cls) { }
+
+        const auto& Class() const { return class_; }
+
+        void Print(size_t ident) override;
+        void ConnectNfa(NfaBuilder& builder, NfaBranch which) override;
+        GlushkovFragment ConnectGlushkov(GlushkovBuilder& builder) override;
+
+    private:
+        CharClass class_;
     };
 
     class ConcatenationExpr : public RegexExprBase<true, true>
@@ -94,6 +122,7 @@ namespace yui
 
         void Print(size_t ident) override;
         void ConnectNfa(NfaBuilder& builder, NfaBranch which) override;
+        GlushkovFragment ConnectGlushkov(GlushkovBuilder& builder) override;
 
     private:
         RegexExprVec seq_;
@@ -109,6 +138,7 @@ namespace yui
 
         void Print(size_t ident) override;
         void ConnectNfa(NfaBuilder& builder, NfaBranch which) override;
+        GlushkovFragment ConnectGlushkov(GlushkovBuilder& builder) override;
 
     private:
         RegexExprVec any_;
@@ -129,6 +159,7 @@ namespace yui
 
         void Print(size_t ident) override;
         void ConnectNfa(NfaBuilder& builder, NfaBranch which) override;
+        GlushkovFragment ConnectGlushkov(GlushkovBuilder& builder) override;
 
     public:
         RegexExpr* child_;
@@ -137,7 +168,7 @@ namespace yui
         ClosureStrategy strategy_;
     };
 
-    class AnchorExpr : public RegexExprBase<false, true>
+    class AnchorExpr : public RegexExprBase<true, true>
     {
     public:
         AnchorExpr(AnchorType def)
@@ -147,11 +178,31 @@ namespace yui
 
         void Print(size_t ident) override;
         void ConnectNfa(NfaBuilder& builder, NfaBranch which) override;
+        GlushkovFragment ConnectGlushkov(GlushkovBuilder& builder) override;
 
     private:
         AnchorType type_;
     };
 
+    // NOTE the body is compiled into a DFA, so it cannot contain captures, references or assertions
+    class AssertionExpr : public RegexExprBase<false, false>
+    {
+    public:
+        AssertionExpr(AssertionType type, RegexExpr* expr)
+            : type_(type), expr_(expr) { }
+
+        auto Type() const { return type_; }
+        auto Child() const { return expr_; }
+
+        void Print(size_t ident) override;
+        void ConnectNfa(NfaBuilder& builder, NfaBranch which) override;
+        GlushkovFragment ConnectGlushkov(GlushkovBuilder& builder) override;
+
+    private:
+        AssertionType type_;
+        RegexExpr* expr_;
+    };
+
     class CaptureExpr : public RegexExprBase<false, false>
     {
     public:
@@ -159,9 +210,11 @@ namespace yui
             : id_(id), expr_(expr) { }
 
         auto Id() const { return id_; }
+        auto Child() const { return expr_; }
 
         void Print(size_t ident) override;
         void ConnectNfa(NfaBuilder& builder, NfaBranch which) override;
+        GlushkovFragment ConnectGlushkov(GlushkovBuilder& builder) override;
 
     private:
         unsigned id_;
@@ -178,8 +231,27 @@ namespace yui
 
         void Print(size_t ident) override;
         void ConnectNfa(NfaBuilder& builder, NfaBranch which) override;
+        GlushkovFragment ConnectGlushkov(GlushkovBuilder& builder) override;
 
     private:
         unsigned id_;
     };
+
+    // the root of a tree rewritten by RegexFactoryBase::Simplify, which is regular
+    // NOTE it marks the NFA built, see NfaAutomaton::Simplified
+    class SimplifiedExpr : public RegexExprBase<true, true>
+    {
+    public:
+        SimplifiedExpr(RegexExpr* expr)
+            : expr_(expr) { }
+
+        auto Child() const { return expr_; }
+
+        void Print(size_t ident) override;
+        void ConnectNfa(NfaBuilder& builder, NfaBranch which) override;
+        GlushkovFragment ConnectGlushkov(GlushkovBuilder& builder) override;
+
+    private:
+        RegexExpr* expr_;
+    };
 }
\ No newline at end of file
@@ -1,4 +1,6 @@
 #include "regex-factory.h"
+#include <algorithm>
+#include <optional>
 
 using namespace std;
 
@@ -6,22 +8,302 @@ namespace yui
 {
     // Implementation of RegexFactoryBase
 
-    // TODO: provides options
-    RegexFactoryBase::RegexFactoryBase() { }
+    RegexFactoryBase::RegexFactoryBase(bool simplify)
+        : simplify_(simplify) { }
+
+    // tests if every node of an expression is DFA compatible, i.e. a DFA may take the place of the backtracker
+    static bool IsRegular(RegexExpr* expr)
+    {
+        if (!expr->IsDfaCompatible())
+        {
+            return false;
+        }
+
+        if (auto concat = dynamic_cast<ConcatenationExpr*>(expr))
+        {
+            return std::all_of(concat->Children().begin(), concat->Children().end(), IsRegular);
+        }
+        else if (auto alter = dynamic_cast<AlternationExpr*>(expr))
+        {
+            return std::all_of(alter->Children().begin(), alter->Children().end(), IsRegular);
+        }
+        else if (auto rep = dynamic_cast<RepetitionExpr*>(expr))
+        {
+            return IsRegular(rep->Child());
+        }
+
+        return true;
+    }
 
     ManagedRegex::Ptr RegexFactoryBase::Generate()
     {
-        return std::make_unique<ManagedRegex>(std::move(arena_), Construct());
+        auto root = Construct();
+        if (simplify_ && IsRegular(root))
+        {
+            // a tree left as it is needs no mark
+            auto simplified = Simplify(root);
+            if (simplified != root)
+            {
+                root = arena_.Construct<SimplifiedExpr>(simplified);
+            }
+        }
+
+        return std::make_unique<ManagedRegex>(std::move(arena_), root);
+    }
+
+    // Simplification
+    //
+
+    // tests if two expressions are of the same structure
+    static bool EqualExpr(RegexExpr* lhs, RegexExpr* rhs)
+    {
+        if (lhs == rhs)
+        {
+            return true;
+        }
+
+        const auto EqualChildren = [](const RegexExprVec& lhs, const RegexExprVec& rhs) {
+            return std::equal(lhs.begin(), lhs.end(), rhs.begin(), rhs.end(), EqualExpr);
+        };
+
+        if (auto x = dynamic_cast<EntityExpr*>(lhs))
+        {
+            auto y = dynamic_cast<EntityExpr*>(rhs);
+            return y != nullptr
+                && x->Range().Min() == y->Range().Min() && x->Range().Max() == y->Range().Max()
+                && x->Encoding() == y->Encoding();
+        }
+        else if (auto x = dynamic_cast<CharClassExpr*>(lhs))
+        {
+            auto y = dynamic_cast<CharClassExpr*>(rhs);
+            return y != nullptr && x->Class() == y->Class();
+        }
+        else if (auto x = dynamic_cast<ConcatenationExpr*>(lhs))
+        {
+            auto y = dynamic_cast<ConcatenationExpr*>(rhs);
+            return y != nullptr && EqualChildren(x->Children(), y->Children());
+        }
+        else if (auto x = dynamic_cast<AlternationExpr*>(lhs))
+        {
+            auto y = dynamic_cast<AlternationExpr*>(rhs);
+            return y != nullptr && EqualChildren(x->Children(), y->Children());
+        }
+        else if (auto x = dynamic_cast<RepetitionExpr*>(lhs))
+        {
+            auto y = dynamic_cast<RepetitionExpr*>(rhs);
+            return y != nullptr
+                && x->Count().Min() == y->Count().Min() && x->Count().Max() == y->Count().Max()
+                && x->Strategy() == y->Strategy()
+                && EqualExpr(x->Child(), y->Child());
+        }
+        else if (auto x = dynamic_cast<AnchorExpr*>(lhs))
+        {
+            auto y = dynamic_cast<AnchorExpr*>(rhs);
+            return y != nullptr && x->Type() == y->Type();
+        }
+        else if (auto x = dynamic_cast<AssertionExpr*>(lhs))
+        {
+            auto y = dynamic_cast<AssertionExpr*>(rhs);
+            return y != nullptr && x->Type() == y->Type() && EqualExpr(x->Child(), y->Child());
+        }
+        else if (auto x = dynamic_cast<CaptureExpr*>(lhs))
+        {
+            auto y = dynamic_cast<CaptureExpr*>(rhs);
+            return y != nullptr && x->Id() == y->Id() && EqualExpr(x->Child(), y->Child());
+        }
+        else if (auto x = dynamic_cast<ReferenceExpr*>(lhs))
+        {
+            auto y = dynamic_cast<ReferenceExpr*>(rhs);
+            return y != nullptr && x->Id() == y->Id();
+        }
+
+        return false;
+    }
+
+    // bytes taken by an expression consuming exactly a byte, i.e. a byte entity or a class
+    static std::optional<CharClass> SingleByteClassOf(RegexExpr* expr)
+    {
+        if (auto entity = dynamic_cast<EntityExpr*>(expr); entity != nullptr && entity->Encoding() == CharEncoding::Byte)
+        {
+            return CharClass{ entity->Range() };
+        }
+        else if (auto cls = dynamic_cast<CharClassExpr*>(expr))
+        {
+            return cls->Class();
+        }
+
+        return std::nullopt;
+    }
+
+    // elements of an expression regarded as a sequence
+    static RegexExprVec SequenceOf(RegexExpr* expr)
+    {
+        if (auto concat = dynamic_cast<ConcatenationExpr*>(expr))
+        {
+            return concat->Children();
+        }
+
+        return { expr };
+    }
+
+    RegexExpr* RegexFactoryBase::MakeSequence(const RegexExprVec& seq)
+    {
+        return seq.size() == 1 ? seq.front() : Concat(seq);
+    }
+
+    RegexExpr* RegexFactoryBase::Simplify(RegexExpr* expr)
+    {
+        if (auto concat = dynamic_cast<ConcatenationExpr*>(expr))
+        {
+            // splice nested concatenations, each of them costs a pair of epsilons
+            RegexExprVec seq;
+            for (auto child : concat->Children())
+            {
+                auto items = SequenceOf(Simplify(child));
+                seq.insert(seq.end(), items.begin(), items.end());
+            }
+
+            return MakeSequence(seq);
+        }
+        else if (auto alter = dynamic_cast<AlternationExpr*>(expr))
+        {
+            RegexExprVec any;
+            for (auto child : alter->Children())
+            {
+                any.push_back(Simplify(child));
+            }
+
+            return SimplifyAlternatives(any);
+        }
+        else if (auto rep = dynamic_cast<RepetitionExpr*>(expr))
+        {
+            auto child = Simplify(rep->Child());
+            return child == rep->Child() ? expr : Repeat(child, rep->Count(), rep->Strategy());
+        }
+        else if (auto capture = dynamic_cast<CaptureExpr*>(expr))
+        {
+            auto child = Simplify(capture->Child());
+            return child == capture->Child() ? expr : Capture(capture->Id(), child);
+        }
+        else if (auto assertion = dynamic_cast<AssertionExpr*>(expr))
+        {
+            auto child = Simplify(assertion->Child());
+            return child == assertion->Child() ? expr : Assertion(assertion->Type(), child);
+        }
+
+        return expr;
+    }
+
+    // NOTE alternatives given are simplified already
+    RegexExpr* RegexFactoryBase::SimplifyAlternatives(const RegexExprVec& any)
+    {
+        // 1. splice nested alternations, and drop alternatives seen before
+        //    which never match if the earlier one fails with the same continuation
+        RegexExprVec flattened;
+        for (auto child : any)
+        {
+            auto nested = dynamic_cast<AlternationExpr*>(child);
+            for (auto item : nested != nullptr ? nested->Children() : RegexExprVec{ child })
+            {
+                auto seen = std::any_of(flattened.begin(), flattened.end(),
+                    [&](RegexExpr* other) { return EqualExpr(item, other); });
+                if (!seen)
+                {
+                    flattened.push_back(item);
+                }
+            }
+        }
+
+        // 2. merge a run of adjacent alternatives consuming a single byte into one class
+        //    as they differ in nothing but the byte taken
+        RegexExprVec merged;
+        for (size_t i = 0; i < flattened.size(); )
+        {
+            auto cls = SingleByteClassOf(flattened[i]);
+
+            auto j = i + 1;
+            while (cls && j < flattened.size())
+            {
+                auto other = SingleByteClassOf(flattened[j]);
+                if (!other)
+                {
+                    break;
+                }
+
+                cls = cls->Union(*other);
+                j += 1;
+            }
+
+            merged.push_back(j - i < 2 ? flattened[i] : Class(*cls));
+            i = j;
+        }
+
+        // 3. factor a run of adjacent alternatives sharing the first or the last element
+        //    the shared part is taken out and the rest of them are simplified as a new alternation
+        const auto Factor = [&](const RegexExprVec& input, bool prefix) {
+            RegexExprVec output;
+            for (size_t i = 0; i < input.size(); )
+            {
+                auto seq = SequenceOf(input[i]);
+                auto shared = seq.empty() ? nullptr : (prefix ? seq.front() : seq.back());
+
+                auto j = i + 1;
+                while (shared != nullptr && j < input.size())
+                {
+                    auto other = SequenceOf(input[j]);
+                    if (other.empty() || !EqualExpr(shared, prefix ? other.front() : other.back()))
+                    {
+                        break;
+                    }
+
+                    j += 1;
+                }
+
+                if (j - i < 2)
+                {
+                    output.push_back(input[i]);
+                    i += 1;
+                    continue;
+                }
+
+                RegexExprVec rests;
+                for (auto k = i; k < j; ++k)
+                {
+                    auto other = SequenceOf(input[k]);
+                    rests.push_back(MakeSequence(prefix ? RegexExprVec(other.begin() + 1, other.end())
+                                                        : RegexExprVec(other.begin(), other.end() - 1)));
+                }
+
+                auto rest = SequenceOf(SimplifyAlternatives(rests));
+                if (prefix)
+                {
+                    rest.insert(rest.begin(), shared);
+                }
+                else
+                {
+                    rest.push_back(shared);
+                }
+
+                output.push_back(MakeSequence(rest));
+                i = j;
+            }
+
+            return output;
+        };
+
+        auto result = Factor(Factor(merged, true), false);
+        return result.size() == 1 ? result.front() : Alter(result);
     }
 
     RegexExpr* RegexFactoryBase::Range(CharRange rg)
     {
+        assert(rg.Min() >= 0 && rg.Max() < 256);
         return arena_.Construct<EntityExpr>(rg);
     }
 
     RegexExpr* RegexFactoryBase::Char(int ch)
     {
-        assert(ch >= 0 && ch < 128); // TODO: ?
+        assert(ch >= 0 && ch < 256);
         return Range(CharRange{ ch, ch });
     }
 
@@ -32,18 +314,28 @@ namespace yui
         RegexExprVec vec;
         for (auto p = s; *p; ++p)
         {
-            vec.push_back(Char(*p));
+            vec.push_back(Char(static_cast<unsigned char>(*p)));
         }
 
         return Concat(vec);
     }
 
+    RegexExpr* RegexFactoryBase::Class(const CharClass& cls)
+    {
+        assert(!cls.Empty());
+
+        auto ranges = cls.Ranges();
+        if (ranges.size() == 1)
+        {
+            return Range(ranges.front());
+        }
+
+        return arena_.Construct<CharClassExpr>(cls);
+    }
+
 	RegexExpr* RegexFactoryBase::Letter()
 	{
-		return Alter({
-			Range({ 'a', 'z' }),
-			Range({ 'A', 'Z' }),
-		});
+		return Class({ { 'a', 'z' }, { 'A', 'Z' } });
 	}
 
 	RegexExpr* RegexFactoryBase::Digit()
@@ -51,6 +343,30 @@ namespace yui
 		return Range({ '0', '9' });
 	}
 
+    RegexExpr* RegexFactoryBase::CodepointRange(CharRange rg)
+    {
+        assert(rg.Min() >= 0 && rg.Max() <= kMaxCodepoint);
+        return arena_.Construct<EntityExpr>(rg, CharEncoding::Utf8);
+    }
+
+    RegexExpr* RegexFactoryBase::Codepoint(int cp)
+    {
+        return CodepointRange(CharRange{ cp, cp });
+    }
+
+    RegexExpr* RegexFactoryBase::CodepointClass(const std::vector<CharRange>& ranges)
+    {
+        assert(!ranges.empty());
+
+        RegexExprVec any;
+        for (auto rg : ranges)
+        {
+            any.push_back(CodepointRange(rg));
+        }
+
+        return any.size() == 1 ? any.front() : Alter(any);
+    }
+
     RegexExpr* RegexFactoryBase::Concat(const RegexExprVec& seq)
     {
         return arena_.Construct<ConcatenationExpr>(seq);
@@ -97,4 +413,10 @@ namespace yui
 	{
 		return arena_.Construct<ReferenceExpr>(id);
 	}
+
+    RegexExpr* RegexFactoryBase::Assertion(AssertionType type, RegexExpr* expr)
+    {
+        assert(expr->IsAssertionCompatible());
+        return arena_.Construct<AssertionExpr>(type, expr);
+    }
 }
\ No newline at end of file
@@ -13,9 +13,14 @@ namespace yui
     class RegexFactoryBase
     {
     public:
-        RegexFactoryBase(); // TODO: provides options
+        // where simplify is false, the tree constructed is taken as is, see Generate
+        explicit RegexFactoryBase(bool simplify = true);
 
         // Call this function to build a new ManagedRegex instance
+        // NOTES the tree constructed is simplified first if it's regular, see Simplify
+        //       NfaRegexMatcher cuts its search by the shape of the tree, so it may find other matches on a simplified one,
+        //       which is why trees with captures, references or assertions are left alone
+        //       a simplified tree is never backtracked by CreateMatcher, which takes a lazy DFA when the DFA is out of budget
         ManagedRegex::Ptr Generate();
 
     protected:
@@ -25,9 +30,19 @@ namespace yui
         RegexExpr* Char(int ch);
         RegexExpr* String(const char* s);
 
+        // a class that is a single range is built as Range
+        RegexExpr* Class(const CharClass& cls);
+
 		RegexExpr* Letter();
 		RegexExpr* Digit();
 
+        // Code Point Construction
+        // these match code points encoded in UTF-8, a byte at a time
+        //
+        RegexExpr* CodepointRange(CharRange rg);
+        RegexExpr* Codepoint(int cp);
+        RegexExpr* CodepointClass(const std::vector<CharRange>& ranges);
+
         // Compound Construction
         //
         RegexExpr* Concat(const RegexExprVec& seq);
@@ -46,12 +61,27 @@ namespace yui
         RegexExpr* Anchor(AnchorType type);
         RegexExpr* Capture(unsigned id, RegexExpr* expr);
 		RegexExpr* Reference(unsigned id);
+        RegexExpr* Assertion(AssertionType type, RegexExpr* expr);
 
         // User-defined Construction Function
         // Override this to control the construction process
         virtual RegexExpr* Construct() = 0;
 
+    private:
+        // rewrites the tree into an equivalent one that builds a smaller NFA
+        //   1. nested concatenations and alternations are flattened
+        //   2. duplicate alternatives are removed
+        //   3. adjacent alternatives consuming a single byte are merged into a class, e.g. a|[b-c] into [a-c]
+        //   4. adjacent alternatives sharing a prefix or a suffix are factored, e.g. ab|ac|d into a(b|c)|d
+        // NOTES only adjacent alternatives are factored so that their priority order is kept
+        //       nodes are rebuilt rather than modified, as a node may be shared
+        RegexExpr* Simplify(RegexExpr* expr);
+        RegexExpr* SimplifyAlternatives(const RegexExprVec& any);
+
+        RegexExpr* MakeSequence(const RegexExprVec& seq);
+
     private:
         Arena arena_;
+        bool simplify_;
     };
 }
\ No newline at end of file
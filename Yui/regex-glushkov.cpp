@@ -0,0 +1,182 @@
+#include "regex-glushkov.h"
+#include <algorithm>
+#include <unordered_set>
+
+using namespace std;
+
+namespace yui
+{
+    // Implementation of GlushkovBuilder
+    //
+
+    void GlushkovBuilder::Deduplicate(PositionList& list)
+    {
+        unordered_set<GlushkovPosition> seen;
+        auto new_end = remove_if(list.begin(), list.end(),
+            [&](GlushkovPosition pos) { return !seen.insert(pos).second; });
+
+        list.erase(new_end, list.end());
+    }
+
+    void GlushkovBuilder::Substitute(PositionList& list, const PositionList& replacement)
+    {
+        auto iter = find(list.begin(), list.end(), kExitPosition);
+        if (iter == list.end())
+        {
+            return;
+        }
+
+        // paths leaving in the middle take the priority of the exit
+        iter = list.erase(iter);
+        list.insert(iter, replacement.begin(), replacement.end());
+
+        Deduplicate(list);
+    }
+
+    GlushkovFragment GlushkovBuilder::NewEmpty()
+    {
+        return GlushkovFragment{ { kExitPosition }, NextPosition(), NextPosition() };
+    }
+
+    GlushkovFragment GlushkovBuilder::NewNever()
+    {
+        return GlushkovFragment{ {}, NextPosition(), NextPosition() };
+    }
+
+    GlushkovFragment GlushkovBuilder::NewPosition(TransitionType type, TransitionDataType data)
+    {
+        auto pos = NextPosition();
+
+        NfaTransition prototype;
+        prototype.source = nullptr;
+        prototype.target = nullptr;
+        prototype.type = type;
+        prototype.data = std::move(data);
+
+        prototypes_.push_back(std::move(prototype));
+        follows_.push_back({ kExitPosition });
+
+        return GlushkovFragment{ { pos }, pos, pos + 1 };
+    }
+
+    GlushkovFragment GlushkovBuilder::Concat(const GlushkovFragment& lhs, const GlushkovFragment& rhs)
+    {
+        assert(lhs.end == rhs.begin);
+
+        // leaving lhs is entering rhs
+        for (auto pos = lhs.begin; pos < lhs.end; ++pos)
+        {
+            Substitute(follows_[pos], rhs.first);
+        }
+
+        auto first = lhs.first;
+        Substitute(first, rhs.first);
+
+        return GlushkovFragment{ std::move(first), lhs.begin, rhs.end };
+    }
+
+    GlushkovFragment GlushkovBuilder::Alter(const GlushkovFragment& lhs, const GlushkovFragment& rhs)
+    {
+        assert(lhs.end == rhs.begin);
+
+        auto first = lhs.first;
+        first.insert(first.end(), rhs.first.begin(), rhs.first.end());
+        Deduplicate(first);
+
+        return GlushkovFragment{ std::move(first), lhs.begin, rhs.end };
+    }
+
+    GlushkovFragment GlushkovBuilder::Optional(const GlushkovFragment& fragment, ClosureStrategy strategy)
+    {
+        // Greedy ones try the fragment before leaving, while Reluctant ones behave oppositely
+        PositionList first;
+        if (strategy == ClosureStrategy::Greedy)
+        {
+            first = fragment.first;
+            first.push_back(kExitPosition);
+        }
+        else
+        {
+            first.push_back(kExitPosition);
+            first.insert(first.end(), fragment.first.begin(), fragment.first.end());
+        }
+
+        Deduplicate(first);
+        return GlushkovFragment{ std::move(first), fragment.begin, fragment.end };
+    }
+
+    GlushkovFragment GlushkovBuilder::Closure(const GlushkovFragment& fragment, ClosureStrategy strategy, bool at_least_once)
+    {
+        // what comes after an iteration is the same as what comes before it
+        // NOTE an iteration matching empty string is never taken again, so it can only leave as a whole
+        GlushkovFragment body = fragment;
+        body.first.erase(remove(body.first.begin(), body.first.end(), kExitPosition), body.first.end());
+
+        auto loop = Optional(body, strategy);
+        for (auto pos = fragment.begin; pos < fragment.end; ++pos)
+        {
+            Substitute(follows_[pos], loop.first);
+        }
+
+        // but the first one may be empty
+        if (!at_least_once)
+        {
+            return Optional(fragment, strategy);
+        }
+
+        auto first = fragment.first;
+        Substitute(first, loop.first);
+
+        return GlushkovFragment{ std::move(first), fragment.begin, fragment.end };
+    }
+
+    NfaAutomaton::Ptr GlushkovBuilder::Build(const GlushkovFragment& root)
+    {
+        assert(root.begin == 0 && root.end == NextPosition());
+
+        const auto Accepting = [](const PositionList& list) {
+            return find(list.begin(), list.end(), kExitPosition) != list.end();
+        };
+
+        // paths come in the same order, but states are not those of EliminateEpsilon
+        NfaBuilder builder;
+        builder.DisableSimulation();
+
+        NfaState* initial_state = builder.NewState(Accepting(root.first));
+        vector<NfaState*> states;
+        for (GlushkovPosition pos = 0; pos < NextPosition(); ++pos)
+        {
+            states.push_back(builder.NewState(Accepting(follows_[pos])));
+        }
+
+        // transitions are added in priority order
+        const auto ConnectPositions = [&](NfaState* source, const PositionList& list) {
+            for (auto pos : list)
+            {
+                if (pos != kExitPosition)
+                {
+                    builder.CloneTransition(NfaBranch{ source, states[pos] }, &prototypes_[pos]);
+                }
+            }
+        };
+
+        ConnectPositions(initial_state, root.first);
+        for (GlushkovPosition pos = 0; pos < NextPosition(); ++pos)
+        {
+            ConnectPositions(states[pos], follows_[pos]);
+        }
+
+        return builder.Build(initial_state);
+    }
+
+    // Implementation of GenerateGlushkovNfa
+    //
+
+    NfaAutomaton::Ptr GenerateGlushkovNfa(RegexExpr& expr)
+    {
+        GlushkovBuilder builder;
+        auto root = expr.ConnectGlushkov(builder);
+
+        return builder.Build(root);
+    }
+}
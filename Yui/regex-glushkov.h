@@ -0,0 +1,80 @@
+// Provides Glushkov(position automaton) construction that builds an epsilon-free NFA directly from RegexExpr
+
+#pragma once
+#include "regex-automaton.h"
+#include "regex-expr.h"
+#include <vector>
+#include <limits>
+
+namespace yui
+{
+    // Every leaf of the expression tree that takes a transition, i.e. an entity, an anchor, a capture boundary
+    // a reference or an assertion, becomes a position, and every position becomes a state of the NFA
+    // reached by the leaf's transition only
+    //
+    // The first list of an expression holds positions that may come first, and the follow list of a position
+    // holds positions that may come after it, both in priority order
+    // kExitPosition in a list stands for leaving the expression, where whatever comes after it takes place
+    // so it's substituted on concatenation, and means acceptance at the root
+
+    using GlushkovPosition = size_t;
+    using PositionList = std::vector<GlushkovPosition>;
+
+    static constexpr GlushkovPosition kExitPosition = std::numeric_limits<GlushkovPosition>::max();
+
+    // positions of an expression are created by a single call of ConnectGlushkov
+    // so they are numbered consecutively in [begin, end)
+    struct GlushkovFragment
+    {
+        PositionList first;
+        GlushkovPosition begin;
+        GlushkovPosition end;
+    };
+
+    class GlushkovBuilder : Uncopyable, Unmovable
+    {
+    public:
+        // a fragment matching empty string only
+        GlushkovFragment NewEmpty();
+
+        // a fragment matching nothing
+        GlushkovFragment NewNever();
+
+        // a fragment of a single position reached by the transition given
+        GlushkovFragment NewPosition(TransitionType type, TransitionDataType data);
+
+        // NOTE positions of rhs must be created right after those of lhs
+        GlushkovFragment Concat(const GlushkovFragment& lhs, const GlushkovFragment& rhs);
+        GlushkovFragment Alter(const GlushkovFragment& lhs, const GlushkovFragment& rhs);
+
+        GlushkovFragment Optional(const GlushkovFragment& fragment, ClosureStrategy strategy);
+
+        // repeats the fragment for any times, or at least once if at_least_once is set
+        GlushkovFragment Closure(const GlushkovFragment& fragment, ClosureStrategy strategy, bool at_least_once);
+
+        // builds the NFA of an expression whose fragment is root
+        NfaAutomaton::Ptr Build(const GlushkovFragment& root);
+
+    private:
+        GlushkovPosition NextPosition() const
+        {
+            return prototypes_.size();
+        }
+
+        // replaces kExitPosition in list with replacement, keeping the first occurrence of each position
+        static void Substitute(PositionList& list, const PositionList& replacement);
+
+        // removes all but the first occurrence of each position
+        static void Deduplicate(PositionList& list);
+
+    private:
+        std::vector<NfaTransition> prototypes_;     // transition reaching each position
+        std::vector<PositionList> follows_;
+    };
+
+    // Builds an epsilon-free NFA with one state per position plus the initial state
+    // NOTES the automaton takes paths in the same priority order as EliminateEpsilon on a Thompson NFA
+    //       it's meant for subset construction, the backtracker finds other matches on it
+    //       so it's not SimulationCompatible, see CreateMatcher
+    NfaAutomaton::Ptr GenerateGlushkovNfa(RegexExpr& expr);
+}
@@ -0,0 +1,290 @@
+#include "regex-jit.h"
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define YUI_JIT_X64 1
+#else
+#define YUI_JIT_X64 0
+#endif
+
+using namespace std;
+
+namespace yui
+{
+    // Executable Memory
+    //
+
+    static void* AllocateCode(const vector<uint8_t>& code)
+    {
+#if defined(_WIN32)
+        void* mem = VirtualAlloc(nullptr, code.size(), MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+        if (mem == nullptr)
+        {
+            return nullptr;
+        }
+
+        memcpy(mem, code.data(), code.size());
+
+        // never keep a page writable and executable at the same time
+        DWORD old_protect;
+        if (!VirtualProtect(mem, code.size(), PAGE_EXECUTE_READ, &old_protect))
+        {
+            VirtualFree(mem, 0, MEM_RELEASE);
+            return nullptr;
+        }
+
+        FlushInstructionCache(GetCurrentProcess(), mem, code.size());
+        return mem;
+#else
+        void* mem = mmap(nullptr, code.size(), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (mem == MAP_FAILED)
+        {
+            return nullptr;
+        }
+
+        memcpy(mem, code.data(), code.size());
+
+        // never keep a page writable and executable at the same time
+        if (mprotect(mem, code.size(), PROT_READ | PROT_EXEC) != 0)
+        {
+            munmap(mem, code.size());
+            return nullptr;
+        }
+
+        return mem;
+#endif
+    }
+
+    static void ReleaseCode(void* mem, size_t size)
+    {
+#if defined(_WIN32)
+        VirtualFree(mem, 0, MEM_RELEASE);
+#else
+        munmap(mem, size);
+#endif
+    }
+
+    JitProgram::~JitProgram()
+    {
+        ReleaseCode(code_, size_);
+    }
+
+    // X64 Code Emission
+    //
+
+    // Register assignment of the generated function
+    // NOTE only registers that are volatile in both System V and Microsoft x64 ABI are used
+    //
+    //   rcx: cursor into input
+    //   rdx: end of input
+    //   rax: end of the last match, nullptr if none
+    //   r8d: the current character
+    //   r9d: scratch for range test
+    class X64Emitter
+    {
+    public:
+        // placeholder for labels of DFA states
+        static constexpr size_t kExitLabel = numeric_limits<size_t>::max();
+
+        const vector<uint8_t>& Code() const { return code_; }
+
+        size_t Position() const { return code_.size(); }
+
+        void EmitPrologue()
+        {
+#if !defined(_WIN32)
+            // System V passes arguments in rdi, rsi
+            Emit({ 0x48, 0x89, 0xF9 });             // mov rcx, rdi
+            Emit({ 0x48, 0x89, 0xF2 });             // mov rdx, rsi
+#endif
+            Emit({ 0x31, 0xC0 });                   // xor eax, eax
+        }
+
+        void EmitRecordMatch()
+        {
+            Emit({ 0x48, 0x89, 0xC8 });             // mov rax, rcx
+        }
+
+        void EmitFetchChar()
+        {
+            Emit({ 0x48, 0x39, 0xD1 });             // cmp rcx, rdx
+            EmitJump({ 0x0F, 0x83 }, kExitLabel);   // jae exit
+            Emit({ 0x44, 0x0F, 0xB6, 0x01 });       // movzx r8d, byte ptr [rcx]
+            Emit({ 0x48, 0xFF, 0xC1 });             // inc rcx
+        }
+
+        // jumps to the label if the current character is in [min, max]
+        void EmitRangeTest(int min, int max, size_t label)
+        {
+            if (min == max)
+            {
+                Emit({ 0x41, 0x81, 0xF8 });         // cmp r8d, min
+                EmitImm32(min);
+                EmitJump({ 0x0F, 0x84 }, label);    // je label
+            }
+            else
+            {
+                Emit({ 0x45, 0x8D, 0x88 });         // lea r9d, [r8 - min]
+                EmitImm32(-min);
+                Emit({ 0x41, 0x81, 0xF9 });         // cmp r9d, max - min
+                EmitImm32(max - min);
+                EmitJump({ 0x0F, 0x86 }, label);    // jbe label
+            }
+        }
+
+        void EmitJumpTo(size_t label)
+        {
+            EmitJump({ 0xE9 }, label);              // jmp label
+        }
+
+        void EmitExitJump()
+        {
+            EmitJumpTo(kExitLabel);
+        }
+
+        void EmitExit()
+        {
+            exit_position_ = Position();
+            Emit({ 0xC3 });                         // ret
+        }
+
+        // patches all rel32 operands once every label is placed
+        void ResolveLabels(const vector<size_t>& label_positions)
+        {
+            for (auto [operand_pos, label] : fixups_)
+            {
+                auto target = label == kExitLabel ? exit_position_ : label_positions[label];
+                auto rel = static_cast<int32_t>(static_cast<int64_t>(target) - static_cast<int64_t>(operand_pos + 4));
+
+                memcpy(code_.data() + operand_pos, &rel, 4);
+            }
+        }
+
+    private:
+        void Emit(initializer_list<uint8_t> bytes)
+        {
+            code_.insert(code_.end(), bytes);
+        }
+
+        void EmitImm32(int32_t value)
+        {
+            uint8_t bytes[4];
+            memcpy(bytes, &value, 4);
+            code_.insert(code_.end(), bytes, bytes + 4);
+        }
+
+        void EmitJump(initializer_list<uint8_t> opcode, size_t label)
+        {
+            Emit(opcode);
+            fixups_.emplace_back(Position(), label);
+            EmitImm32(0);
+        }
+
+    private:
+        vector<uint8_t> code_;
+        vector<pair<size_t, size_t>> fixups_; // (operand position, label)
+        size_t exit_position_ = 0;
+    };
+
+    // Implementation of CompileDfa
+    //
+
+    JitProgram::Ptr CompileDfa(const DfaAutomaton& dfa)
+    {
+#if YUI_JIT_X64
+        // acceptance of a lookaround automaton depends on the byte after a match,
+        // which the generated code doesn't track
+        if (dfa.HasLookaround())
+        {
+            return nullptr;
+        }
+
+        // every state is laid out as:
+        //
+        //   [mov rax, rcx]     ; if the state is accepting
+        //   fetch char or exit ; where the entry label of the state is
+        //   test each range of characters sharing the same target
+        //   jmp exit
+        //
+        // NOTE the prologue jumps to the entry label of the initial state, skipping its record
+        //      as DfaRegexMatcher does, so that an empty match is never reported
+        X64Emitter emitter;
+        vector<size_t> label_positions(dfa.StateCount() + 1);
+        auto entry_label = dfa.StateCount();
+
+        emitter.EmitPrologue();
+        emitter.EmitJumpTo(entry_label);
+        for (DfaState state = 0; state < dfa.StateCount(); ++state)
+        {
+            label_positions[state] = emitter.Position();
+
+            if (dfa.IsAccepting(state, LookKind::Other))
+            {
+                emitter.EmitRecordMatch();
+            }
+
+            if (state == dfa.InitialState())
+            {
+                label_positions[entry_label] = emitter.Position();
+            }
+
+            emitter.EmitFetchChar();
+
+            // group consecutive characters that transit to the same state
+            for (int ch = 0; ch < static_cast<int>(kDfaAlphabetSize); )
+            {
+                auto target = static_cast<DfaState>(dfa.Transit(state, ch));
+
+                auto run_end = ch + 1;
+                while (run_end < static_cast<int>(kDfaAlphabetSize) && static_cast<DfaState>(dfa.Transit(state, run_end)) == target)
+                {
+                    run_end += 1;
+                }
+
+                if (target != kInvalidDfaState)
+                {
+                    emitter.EmitRangeTest(ch, run_end - 1, target);
+                }
+
+                ch = run_end;
+            }
+
+            emitter.EmitExitJump();
+
+            // give up early rather than emitting the rest of a huge automaton
+            if (emitter.Position() > kJitCodeSizeLimit)
+            {
+                return nullptr;
+            }
+        }
+
+        emitter.EmitExit();
+        emitter.ResolveLabels(label_positions);
+
+        const auto& code = emitter.Code();
+        if (code.size() > kJitCodeSizeLimit)
+        {
+            return nullptr;
+        }
+
+        void* mem = AllocateCode(code);
+        if (mem == nullptr)
+        {
+            return nullptr;
+        }
+
+        return make_unique<JitProgram>(mem, code.size());
+#else
+        return nullptr;
+#endif
+    }
+}
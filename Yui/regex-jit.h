@@ -0,0 +1,51 @@
+// Provides a native x86-64 backend that compiles a DfaAutomaton into direct-coded machine code
+
+#pragma once
+#include "regex-automaton.h"
+#include <cstddef>
+#include <memory>
+
+namespace yui
+{
+    // Automata whose generated code would exceed this limit are not compiled
+    // NOTES a direct-coded automaton of such size thrashes the instruction cache
+    //       and is hardly faster than the jumptable, so CompileDfa gives up instead
+    static constexpr size_t kJitCodeSizeLimit = 1u << 20; // 1MB
+
+    // A JitProgram owns a block of executable memory holding a compiled DfaAutomaton
+    // NOTE: This class should only be constructed by CompileDfa
+    class JitProgram : Uncopyable, Unmovable
+    {
+    private:
+        friend std::unique_ptr<JitProgram> CompileDfa(const DfaAutomaton& dfa);
+        struct ConstructionDummy { };
+
+    public:
+        using Ptr = std::unique_ptr<JitProgram>;
+
+        // const char* entry(const char* begin, const char* end)
+        // returns the end of the longest match anchored at begin, or nullptr if there's none
+        using EntryPoint = const char*(*)(const char*, const char*);
+
+        JitProgram(void* code, size_t size, ConstructionDummy = {})
+            : code_(code), size_(size), entry_(reinterpret_cast<EntryPoint>(code)) { }
+
+        ~JitProgram();
+
+        size_t CodeSize() const { return size_; }
+
+        const char* Run(const char* begin, const char* end) const
+        {
+            return entry_(begin, end);
+        }
+
+    private:
+        void* code_;
+        size_t size_;
+        EntryPoint entry_;
+    };
+
+    // Returns nullptr if the platform is not x86-64, the automaton has lookaround anchors,
+    // the generated code exceeds kJitCodeSizeLimit or the operating system refuses to provide executable memory
+    JitProgram::Ptr CompileDfa(const DfaAutomaton& dfa);
+}
@@ -0,0 +1,114 @@
+#include "regex-lazy-dfa.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace yui
+{
+    // Implementation of LazyDfaAutomaton
+    //
+
+    LazyDfaAutomaton::LazyDfaAutomaton(const NfaAutomaton& atm, size_t state_limit, ConstructionDummy)
+        : constructor_(atm)
+        , classes_(constructor_.Classes())
+        , row_stride_((constructor_.Classes().count + kLineSlotCount) / kLineSlotCount)
+        , state_limit_(state_limit)
+    {
+        // NOTE entries are left uninitialized, as only those of chunks allocated are ever read
+        auto chunk_count = (state_limit_ + kChunkStateCount - 1) / kChunkStateCount;
+        chunks_.reset(new atomic<Chunk*>[chunk_count]);
+
+        // initial states are built up front, so that a walk always starts in the cache
+        lock_guard<mutex> guard{ bookkeeping_.lock };
+        for (unsigned behind = 0; behind < kLookKindCount; ++behind)
+        {
+            auto key_behind = constructor_.InitialBehind(static_cast<LookKind>(behind));
+            initial_lookup_[behind] = InternState(constructor_.InitialSubset(), key_behind);
+        }
+    }
+
+    LazyDfaAutomaton::~LazyDfaAutomaton() = default;
+
+    DfaState LazyDfaAutomaton::BuildTransition(DfaState src, unsigned byte_class) const
+    {
+        // the subset of a state never changes, so the target is computed without the lock
+        thread_local vector<unsigned> target_subset;
+        const auto& info = Info(src);
+        constructor_.StepClass(info.subset, info.behind, byte_class, target_subset);
+
+        // empty target subset is invalid
+        auto target = kInvalidDfaState;
+        if (!target_subset.empty())
+        {
+            // the consumed byte becomes look-behind of the target
+            lock_guard<mutex> guard{ bookkeeping_.lock };
+            target = InternState(target_subset, constructor_.ClassLook(byte_class));
+        }
+
+        // threads racing for the same transition store the same target
+        if (target != kCacheFullState)
+        {
+            Row(src)[byte_class].store(target, memory_order_release);
+        }
+
+        return target;
+    }
+
+    DfaState LazyDfaAutomaton::InternState(const vector<unsigned>& subset, LookKind behind) const
+    {
+        auto& book = bookkeeping_;
+
+        auto id = book.subsets.Find(subset, behind);
+        if (id != kInvalidDfaState)
+        {
+            return id;
+        }
+
+        if (book.subsets.Size() >= state_limit_)
+        {
+            return kCacheFullState;
+        }
+
+        id = book.subsets.Insert(subset, behind).first;
+
+        // a chunk is published before any state of it
+        if ((id & (kChunkStateCount - 1)) == 0)
+        {
+            auto chunk = make_unique<Chunk>();
+            chunk->rows = make_unique<Line[]>(kChunkStateCount * row_stride_);
+            chunk->infos = make_unique<StateInfo[]>(kChunkStateCount);
+
+            chunks_[id >> kChunkStateBits].store(chunk.get(), memory_order_release);
+            book.chunks.push_back(std::move(chunk));
+        }
+
+        auto chunk = chunks_[id >> kChunkStateBits].load(memory_order_relaxed);
+        auto& info = chunk->infos[id & (kChunkStateCount - 1)];
+        info.subset = subset;
+        info.behind = behind;
+
+        // the row is filled before the state is published by a transition into it
+        auto row = Row(id);
+        for (unsigned byte_class = 0; byte_class < classes_.count; ++byte_class)
+        {
+            row[byte_class].store(kUnknownState, memory_order_relaxed);
+        }
+
+        row[classes_.count].store(constructor_.AcceptingLookahead(subset, behind), memory_order_relaxed);
+
+        book.state_count.store(id + 1, memory_order_relaxed);
+        return id;
+    }
+
+    // Implementation of GenerateLazyDfa
+    //
+
+    LazyDfaAutomaton::Ptr GenerateLazyDfa(const NfaAutomaton& atm, size_t state_limit)
+    {
+        assert(atm.DfaCompatible());
+
+        // room for initial states, and ids below the special ones
+        state_limit = clamp<size_t>(state_limit, kLookKindCount, LazyDfaAutomaton::kCacheFullState);
+        return make_unique<LazyDfaAutomaton>(atm, state_limit);
+    }
+}
@@ -0,0 +1,174 @@
+// Provides a DFA built on demand while matching, which is shared by every thread matching with it
+
+#pragma once
+#include "regex-automaton.h"
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+
+namespace yui
+{
+    // states a lazy DFA caches by default, a state takes a cache line or two for most patterns
+    static constexpr size_t kDefaultLazyDfaStateLimit = 1u << 16;
+
+    // A DFA whose states and transitions are built by subset construction the first time a walk needs them
+    //
+    // A state is a row of atomic targets, one for each byte class, followed by its acceptance.
+    // Walks follow transitions already built with an acquire load and nothing else,
+    // so threads sharing the automaton never write to memory they read once it's warmed up.
+    // A missing transition is computed by the thread that needs it without any lock,
+    // and only interning its target and publishing it with a release store are serialized
+    //
+    // NOTES rows are aligned to cache lines and state bookkeeping is kept on lines of its own,
+    //       so that publishing a transition only invalidates the row it's written to
+    //       states are never dropped, when the cache is full Transit returns kCacheFullState
+    //       and walks go on with subsets from SubsetConstructor without caching them
+    class LazyDfaAutomaton : Uncopyable, Unmovable
+    {
+    private:
+        friend std::unique_ptr<LazyDfaAutomaton> GenerateLazyDfa(const NfaAutomaton& atm, size_t state_limit);
+        struct ConstructionDummy { };
+
+    public:
+        using Ptr = std::unique_ptr<LazyDfaAutomaton>;
+
+        // a target in a row that is not built yet
+        static constexpr DfaState kUnknownState = kInvalidDfaState - 1;
+
+        // a target that would be a new state beyond the limit
+        static constexpr DfaState kCacheFullState = kInvalidDfaState - 2;
+
+        LazyDfaAutomaton(const NfaAutomaton& atm, size_t state_limit, ConstructionDummy = {});
+        ~LazyDfaAutomaton();
+
+        // number of states built so far
+        size_t StateCount() const
+        {
+            return bookkeeping_.state_count.load(std::memory_order_relaxed);
+        }
+
+        size_t StateLimit() const
+        {
+            return state_limit_;
+        }
+
+        bool HasLookaround() const
+        {
+            return constructor_.HasLookaround();
+        }
+
+        // where behind is the kind of the byte before start position, or LineBreak at start of input
+        DfaState InitialState(LookKind behind = LookKind::LineBreak) const
+        {
+            return initial_lookup_[static_cast<unsigned>(behind)];
+        }
+
+        // builds the transition if it's not built yet
+        // returns kInvalidDfaState if there's none, or kCacheFullState if the target cannot be cached
+        DfaState Transit(DfaState src, int ch) const
+        {
+            assert(src < StateCount());
+            assert(ch >= 0 && ch < static_cast<int>(kDfaAlphabetSize));
+
+            auto byte_class = classes_.class_of[ch];
+            auto target = Row(src)[byte_class].load(std::memory_order_acquire);
+            if (target == kUnknownState)
+            {
+                target = BuildTransition(src, byte_class);
+            }
+
+            return target;
+        }
+
+        // tests if a match could end after the state
+        // where ahead is the kind of the next byte, or LineBreak at end of input
+        bool IsAccepting(DfaState state, LookKind ahead) const
+        {
+            auto lookahead = Row(state)[classes_.count].load(std::memory_order_relaxed);
+            return (lookahead & (1u << static_cast<unsigned>(ahead))) != 0;
+        }
+
+        // the subset a state is built from, for walks beyond the cache
+        // NOTE it never changes once the state is built
+        const std::vector<unsigned>& Subset(DfaState state) const
+        {
+            return Info(state).subset;
+        }
+
+        LookKind Behind(DfaState state) const
+        {
+            return Info(state).behind;
+        }
+
+        const SubsetConstructor& Constructor() const
+        {
+            return constructor_;
+        }
+
+    private:
+        static constexpr size_t kChunkStateBits = 8;
+        static constexpr size_t kChunkStateCount = size_t{ 1 } << kChunkStateBits;
+        static constexpr size_t kLineSlotCount = 64 / sizeof(std::atomic<DfaState>);
+
+        struct alignas(64) Line
+        {
+            std::atomic<DfaState> slots[kLineSlotCount];
+        };
+
+        struct StateInfo
+        {
+            std::vector<unsigned> subset;
+            LookKind behind;
+        };
+
+        // states are allocated a chunk at a time so that built ones never move
+        struct Chunk
+        {
+            std::unique_ptr<Line[]> rows;
+            std::unique_ptr<StateInfo[]> infos;
+        };
+
+        std::atomic<DfaState>* Row(DfaState state) const
+        {
+            auto chunk = chunks_[state >> kChunkStateBits].load(std::memory_order_acquire);
+            return chunk->rows[(state & (kChunkStateCount - 1)) * row_stride_].slots;
+        }
+
+        const StateInfo& Info(DfaState state) const
+        {
+            auto chunk = chunks_[state >> kChunkStateBits].load(std::memory_order_acquire);
+            return chunk->infos[state & (kChunkStateCount - 1)];
+        }
+
+        DfaState BuildTransition(DfaState src, unsigned byte_class) const;
+
+        // returns the state of the subset, or kCacheFullState if it's new and there's no room for it
+        // NOTE the lock must be held
+        DfaState InternState(const std::vector<unsigned>& subset, LookKind behind) const;
+
+    private:
+        // read by every walk
+        SubsetConstructor constructor_;
+        ByteClasses classes_;
+        size_t row_stride_;                                 // lines of a row, which has classes_.count + 1 slots
+        size_t state_limit_;
+        std::unique_ptr<std::atomic<Chunk*>[]> chunks_;     // enough for state_limit_ states
+        std::array<DfaState, kLookKindCount> initial_lookup_;
+
+        // only touched when a transition is built
+        struct alignas(64) Bookkeeping
+        {
+            std::mutex lock;
+            std::atomic<size_t> state_count{ 0 };
+            DfaSubsetTable subsets;                         // ids are the states
+            std::vector<std::unique_ptr<Chunk>> chunks;
+        };
+
+        mutable Bookkeeping bookkeeping_;
+    };
+
+    // Returns a lazy DFA with nothing but its initial states built
+    // NOTE state_limit is capped so that it never reaches kCacheFullState
+    LazyDfaAutomaton::Ptr GenerateLazyDfa(const NfaAutomaton& atm, size_t state_limit = kDefaultLazyDfaStateLimit);
+}
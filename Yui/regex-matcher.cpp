@@ -1,101 +1,1559 @@
 #include "regex-matcher.h"
 #include "regex-automaton.h"
-#include <deque>
+#include "regex-jit.h"
+#include "regex-factory.h"
+#include "regex-thread-pool.h"
 #include <stack>
 #include <algorithm>
 #include <iterator>
+#include <cctype>
+#include <cstring>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
 
 using namespace std;
 
 namespace yui
 {
+    // Implementation of FindLineBreak
+    //
+
+#if defined(__AVX2__) || defined(__SSE2__) || defined(_M_X64)
+    static unsigned CountTrailingZeros(uint32_t mask)
+    {
+#if defined(_MSC_VER)
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return static_cast<unsigned>(index);
+#else
+        return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+    }
+#endif
+
+    const char* FindLineBreak(const char* p, const char* end)
+    {
+        // a mask of the line breaks in a vector tells the first of them
+#if defined(__AVX2__)
+        const auto newline = _mm256_set1_epi8('\n');
+        for (; end - p >= 32; p += 32)
+        {
+            auto block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+            auto mask = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(block, newline)));
+            if (mask != 0)
+            {
+                return p + CountTrailingZeros(mask);
+            }
+        }
+#elif defined(__SSE2__) || defined(_M_X64)
+        const auto newline = _mm_set1_epi8('\n');
+        for (; end - p >= 16; p += 16)
+        {
+            auto block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+            auto mask = static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(block, newline)));
+            if (mask != 0)
+            {
+                return p + CountTrailingZeros(mask);
+            }
+        }
+#endif
+
+        // the tail shorter than a vector
+        auto found = static_cast<const char*>(memchr(p, '\n', static_cast<size_t>(end - p)));
+        return found != nullptr ? found : end;
+    }
+
     // Implementation of RegexMatcher
     //
     bool RegexMatcher::Match(std::string_view s) const
     {
-        auto result = SerachInternal(s, false);
-
-        return result && result->content.length() == s.length();
+        YUI_STATS_CALL(StatsSink(), Match, s.length());
+        size_t begin, end;
+        return LocateInternal(s, 0, false, begin, end) && end == s.length();
     }
 
     RegexMatchOpt RegexMatcher::Search(std::string_view s) const
     {
-        return SerachInternal(s, true);
+        YUI_STATS_CALL(StatsSink(), Search, s.length());
+        return SerachInternal(s, 0, true);
     }
 
     RegexMatchVec RegexMatcher::SearchAll(std::string_view s) const
     {
+        YUI_STATS_CALL(StatsSink(), SearchAll, s.length());
         RegexMatchVec result;
-        std::string_view remaining_view = s;
+        size_t offset = 0;
+
+        while (auto match = SearchNext(s, offset))
+        {
+            result.push_back(std::move(*match));
+        }
+
+        return result;
+    }
+
+    RegexMatchRange RegexMatcher::SearchLazy(std::string_view s) const
+    {
+        return RegexMatchRange{ this, s };
+    }
+
+    RegexMatchOpt RegexMatcher::SearchNext(std::string_view s, size_t& offset) const
+    {
+        // NOTE the whole view is kept so that anchors see bytes before offset
+        while (offset < s.length())
+        {
+            auto match = SerachInternal(s, offset, true);
+            if (!match)
+            {
+                // no more matches
+                offset = s.length();
+                break;
+            }
+
+            // skip searched part to search next
+            auto match_offset = static_cast<size_t>(std::distance(s.data(), match->content.data()));
+            if (match->content.empty())
+            {
+                // empty matches are dropped as ScanRange does, step over to make progress
+                offset = match_offset + 1;
+                continue;
+            }
+
+            offset = match_offset + match->content.length();
+            return match;
+        }
+
+        return nullopt;
+    }
 
-        while (!remaining_view.empty())
+    bool RegexMatcher::LocateNext(std::string_view s, size_t& offset, size_t& begin, size_t& end, size_t* slots) const
+    {
+        while (offset < s.length())
         {
-            auto match = SerachInternal(remaining_view, true);
-            if (match)
+            if (!LocateCapturesInternal(s, offset, true, begin, end, slots))
             {
-                // truncate remaining view to search next
-                auto searched_offset = std::distance(remaining_view.data(), match->content.data()) + match->content.length();
-                remaining_view.remove_prefix(searched_offset);
+                offset = s.length();
+                break;
+            }
 
-                // save the last successful match
-                result.push_back(std::move(*match));
+            if (begin == end)
+            {
+                offset = begin + 1;
+                continue;
             }
-            else
+
+            offset = end;
+            return true;
+        }
+
+        return false;
+    }
+
+    void RegexMatcher::SearchAll(std::string_view s, RegexMatchBuffer& output) const
+    {
+        YUI_STATS_CALL(StatsSink(), SearchAll, s.length());
+        output.Clear();
+        output.subject_ = s;
+        output.capture_count_ = CaptureCount();
+
+        auto& slots = output.slots_;
+        const auto slot_count = output.capture_count_ * 2;
+
+        // NOTE slots of a candidate are written in place, and dropped if it's not taken
+        size_t offset = 0;
+        size_t begin, end;
+        while (true)
+        {
+            auto base = slots.size();
+            slots.resize(base + slot_count);
+
+            if (!LocateNext(s, offset, begin, end, slots.data() + base))
             {
-                // no more matches
+                slots.resize(base);
                 break;
             }
+
+            output.begins_.push_back(begin);
+            output.ends_.push_back(end);
+        }
+    }
+
+    void RegexMatcher::ReplaceInternal(std::string_view s, const ReplaceTemplate& replacement, size_t max_count, OutputSink& output) const
+    {
+        // slots are reused by calls on the same thread
+        thread_local vector<size_t> slots;
+        slots.resize(CaptureCount() * 2);
+
+        size_t offset = 0;
+        size_t last_end = 0;
+        size_t begin, end;
+        for (size_t count = 0; count < max_count && LocateNext(s, offset, begin, end, slots.data()); ++count)
+        {
+            // text between matches goes in a single piece
+            output.Append(s.substr(last_end, begin - last_end));
+            replacement.Expand(s, begin, end, slots.data(), CaptureCount(), output);
+
+            last_end = end;
+        }
+
+        output.Append(s.substr(last_end));
+    }
+
+    void RegexMatcher::Replace(std::string_view s, const ReplaceTemplate& replacement, OutputSink& output) const
+    {
+        YUI_STATS_CALL(StatsSink(), Replace, s.length());
+        ReplaceInternal(s, replacement, 1, output);
+    }
+
+    std::string RegexMatcher::Replace(std::string_view s, const ReplaceTemplate& replacement) const
+    {
+        string result;
+        StringSink sink{ result };
+        Replace(s, replacement, sink);
+
+        return result;
+    }
+
+    void RegexMatcher::ReplaceAll(std::string_view s, const ReplaceTemplate& replacement, OutputSink& output) const
+    {
+        YUI_STATS_CALL(StatsSink(), ReplaceAll, s.length());
+        ReplaceInternal(s, replacement, numeric_limits<size_t>::max(), output);
+    }
+
+    std::string RegexMatcher::ReplaceAll(std::string_view s, const ReplaceTemplate& replacement) const
+    {
+        string result;
+        StringSink sink{ result };
+        ReplaceAll(s, replacement, sink);
+
+        return result;
+    }
+
+    void RegexMatcher::Split(std::string_view s, OutputSink& output) const
+    {
+        YUI_STATS_CALL(StatsSink(), Split, s.length());
+        // NOTE fields don't need captures, but LocateNext wants room for them
+        thread_local vector<size_t> slots;
+        slots.resize(CaptureCount() * 2);
+
+        size_t offset = 0;
+        size_t last_end = 0;
+        size_t begin, end;
+        while (LocateNext(s, offset, begin, end, slots.data()))
+        {
+            output.Append(s.substr(last_end, begin - last_end));
+            last_end = end;
+        }
+
+        output.Append(s.substr(last_end));
+    }
+
+    bool RegexMatcher::IsMatch(std::string_view s) const
+    {
+        YUI_STATS_CALL(StatsSink(), IsMatch, s.length());
+        return TestInternal(s);
+    }
+
+    size_t RegexMatcher::CountMatches(std::string_view s) const
+    {
+        YUI_STATS_CALL(StatsSink(), CountMatches, s.length());
+        size_t count = 0;
+        size_t offset = 0;
+
+        // the same walk as SearchAll
+        size_t begin, end;
+        while (offset < s.length() && LocateInternal(s, offset, true, begin, end))
+        {
+            if (begin == end)
+            {
+                offset = begin + 1;
+                continue;
+            }
+
+            offset = end;
+            count += 1;
+        }
+
+        return count;
+    }
+
+    bool RegexMatcher::LocateInternal(std::string_view view, size_t offset, bool allow_substr, size_t& begin, size_t& end) const
+    {
+        auto match = SerachInternal(view, offset, allow_substr);
+        if (!match)
+        {
+            return false;
+        }
+
+        begin = std::distance(view.data(), match->content.data());
+        end = begin + match->content.length();
+        return true;
+    }
+
+    bool RegexMatcher::TestInternal(std::string_view view) const
+    {
+        size_t begin, end;
+        return LocateInternal(view, 0, true, begin, end);
+    }
+
+    bool RegexMatcher::LocateCapturesInternal(std::string_view view, size_t offset, bool allow_substr,
+                                              size_t& begin, size_t& end, size_t* slots) const
+    {
+        if (CaptureCount() == 0)
+        {
+            return LocateInternal(view, offset, allow_substr, begin, end);
+        }
+
+        auto match = SerachInternal(view, offset, allow_substr);
+        if (!match)
+        {
+            return false;
+        }
+
+        begin = std::distance(view.data(), match->content.data());
+        end = begin + match->content.length();
+
+        for (size_t id = 0; id < CaptureCount(); ++id)
+        {
+            // a capture not set has no data at all, while an empty one points into view
+            auto capture = id < match->capture.size() ? match->capture[id] : string_view{};
+            if (capture.data() == nullptr)
+            {
+                slots[id * 2] = slots[id * 2 + 1] = RegexMatchBuffer::npos;
+            }
+            else
+            {
+                slots[id * 2] = std::distance(view.data(), capture.data());
+                slots[id * 2 + 1] = slots[id * 2] + capture.length();
+            }
+        }
+
+        return true;
+    }
+
+    SelectionBitmap RegexMatcher::MatchColumn(const StringColumn& column) const
+    {
+        YUI_STATS_CALL(StatsSink(), MatchColumn, column.length != 0 ? static_cast<size_t>(column.offsets[column.length] - column.offsets[0]) : 0);
+        SelectionBitmap selection((column.length + 7) / 8, 0);
+        MatchColumnInternal(column, selection);
+
+        return selection;
+    }
+
+    void RegexMatcher::MatchColumnInternal(const StringColumn& column, SelectionBitmap& selection) const
+    {
+        for (size_t i = 0; i < column.length; ++i)
+        {
+            auto begin = column.offsets[i];
+            auto end = column.offsets[i + 1];
+            if (Match(string_view{ column.data + begin, static_cast<size_t>(end - begin) }))
+            {
+                selection[i / 8] |= 1u << (i % 8);
+            }
+        }
+    }
+
+    size_t RegexMatcher::ScanRange(std::string_view s, size_t pos, size_t end,
+                                   std::vector<std::pair<size_t, size_t>>& spans, RegexMatchVec* output) const
+    {
+        while (pos < end)
+        {
+            size_t match_begin, match_end;
+            auto found = false;
+            if (output != nullptr)
+            {
+                auto match = SerachInternal(s, pos, false);
+                if (match && !match->content.empty())
+                {
+                    match_begin = pos;
+                    match_end = pos + match->content.length();
+                    output->push_back(std::move(*match));
+                    found = true;
+                }
+            }
+            else
+            {
+                found = LocateInternal(s, pos, false, match_begin, match_end) && match_begin != match_end;
+            }
+
+            if (found)
+            {
+                spans.push_back({ match_begin, match_end });
+                pos = match_end;
+            }
+            else
+            {
+                pos += 1;
+            }
+        }
+
+        return pos;
+    }
+
+    // the number of workers of pool that options allow
+    static size_t WorkerCountOf(const WorkStealingPool& pool, const ParallelOptions& options)
+    {
+        return options.thread_count != 0 ? min(options.thread_count, pool.WorkerCount()) : pool.WorkerCount();
+    }
+
+    // Parallel scan speculates that every chunk starts a fresh search at its first position
+    // The only state carried across a chunk boundary is where the sequential scan resumes,
+    // so chunk k's result is a transfer function from that resume position to matches
+    // and an exit position, and stitching composes these functions from left to right
+    //
+    // The speculative scan of a chunk tries every position except those covered by its matches.
+    // Whenever the actual resume position is one of them, the scans converge from there on,
+    // otherwise it lies inside a speculative match and is fixed up sequentially until they converge
+    //
+    // NOTE chunks are tasks of WorkStealingPool::Shared(), which may have fewer workers than chunks
+    size_t RegexMatcher::ScanParallel(std::string_view s, const ParallelOptions& options, RegexMatchVec* output) const
+    {
+        auto& pool = WorkStealingPool::Shared();
+        auto chunk_size = std::max<size_t>(options.min_chunk_size, 1);
+        auto thread_count = options.thread_count != 0 ? options.thread_count : pool.WorkerCount();
+        auto chunk_count = std::min<size_t>(thread_count, (s.length() + chunk_size - 1) / chunk_size);
+
+        if (chunk_count <= 1)
+        {
+            if (output == nullptr)
+            {
+                return CountMatches(s);
+            }
+
+            *output = SearchAll(s);
+            return output->size();
+        }
+
+        struct ChunkResult
+        {
+            size_t begin, end, exit;
+            std::vector<std::pair<size_t, size_t>> spans;
+            RegexMatchVec matches;              // in the same order as spans, if output is given
+        };
+
+        std::vector<ChunkResult> chunks(chunk_count);
+        for (size_t k = 0; k < chunk_count; ++k)
+        {
+            chunks[k].begin = s.length() * k / chunk_count;
+            chunks[k].end = s.length() * (k + 1) / chunk_count;
+        }
+
+        // speculative scan, where the first chunk is exact
+        const auto ScanChunk = [&](ChunkResult& chunk)
+        {
+            chunk.exit = ScanRange(s, chunk.begin, chunk.end, chunk.spans, output != nullptr ? &chunk.matches : nullptr);
+        };
+
+        pool.Run(chunk_count, WorkerCountOf(pool, options), [&](size_t, size_t k) { ScanChunk(chunks[k]); });
+
+        // stitch chunks in order
+        // NOTE spans made by sequential steps are of no use once taken, so they go to a scratch vector
+        std::vector<std::pair<size_t, size_t>> stepped;
+        size_t count = chunks[0].spans.size();
+        if (output != nullptr)
+        {
+            *output = std::move(chunks[0].matches);
+        }
+
+        size_t pos = chunks[0].exit;
+        for (size_t k = 1; k < chunk_count; ++k)
+        {
+            auto& chunk = chunks[k];
+            const auto& spans = chunk.spans;
+
+            // the chunk is entirely covered by a previous match
+            if (pos >= chunk.end)
+            {
+                continue;
+            }
+
+            while (pos < chunk.end)
+            {
+                // find the last speculative match starting before pos
+                auto it = std::partition_point(spans.begin(), spans.end(),
+                    [&](const std::pair<size_t, size_t>& span) { return span.first < pos; });
+
+                auto inside_match = it != spans.begin() && std::prev(it)->second > pos;
+                if (inside_match)
+                {
+                    // not converged yet, make a sequential step
+                    stepped.clear();
+                    pos = ScanRange(s, pos, pos + 1, stepped, output);
+                    count += stepped.size();
+                }
+                else
+                {
+                    // converged, the rest of speculative result is exact
+                    auto first = static_cast<size_t>(std::distance(spans.begin(), it));
+                    count += spans.size() - first;
+                    if (output != nullptr)
+                    {
+                        std::move(chunk.matches.begin() + first, chunk.matches.end(), std::back_inserter(*output));
+                    }
+
+                    pos = chunk.exit;
+                    break;
+                }
+            }
+        }
+
+        return count;
+    }
+
+    RegexMatchVec RegexMatcher::SearchAllParallel(std::string_view s, const ParallelOptions& options) const
+    {
+        YUI_STATS_CALL(StatsSink(), SearchAllParallel, s.length());
+        if (!SupportParallelScan())
+        {
+            return SearchAll(s);
+        }
+
+        RegexMatchVec result;
+        ScanParallel(s, options, &result);
+        return result;
+    }
+
+    // NOTE its latency is accounted to SearchAllParallel
+    size_t RegexMatcher::CountAllParallel(std::string_view s, const ParallelOptions& options) const
+    {
+        YUI_STATS_CALL(StatsSink(), SearchAllParallel, s.length());
+        if (!SupportParallelScan())
+        {
+            return CountMatches(s);
+        }
+
+        return ScanParallel(s, options, nullptr);
+    }
+
+    // sum of lengths of inputs of a batch
+    static size_t TotalLength(const vector<string_view>& inputs)
+    {
+        size_t result = 0;
+        for (auto input : inputs)
+        {
+            result += input.length();
+        }
+
+        return result;
+    }
+
+    void RegexMatcher::RunBatch(const vector<string_view>& inputs, const ParallelOptions& options,
+                                const function<void(size_t, size_t)>& handler) const
+    {
+        auto& pool = WorkStealingPool::Shared();
+        auto worker_count = WorkerCountOf(pool, options);
+
+        // an input costs its length, and a little more for the call itself so that empty ones are not free
+        // a worker is given a few tasks so that stealing evens out what sizes don't tell
+        constexpr size_t kInputCost = 64;
+        constexpr size_t kTasksPerWorker = 8;
+
+        auto total_cost = TotalLength(inputs) + inputs.size() * kInputCost;
+        auto task_cost = max<size_t>(options.min_chunk_size, total_cost / (worker_count * kTasksPerWorker));
+
+        // a range is closed as soon as it costs enough, so a huge input ends a range of its own
+        vector<size_t> bounds{ 0 };
+        size_t cost = 0;
+        for (size_t i = 0; i < inputs.size(); ++i)
+        {
+            cost += inputs[i].length() + kInputCost;
+            if (cost >= task_cost)
+            {
+                bounds.push_back(i + 1);
+                cost = 0;
+            }
+        }
+
+        if (bounds.back() != inputs.size())
+        {
+            bounds.push_back(inputs.size());
+        }
+
+        pool.Run(bounds.size() - 1, worker_count, [&](size_t, size_t task) {
+            handler(bounds[task], bounds[task + 1]);
+        });
+    }
+
+    size_t RegexMatcher::MatchLines(std::string_view s, std::vector<LineMatch>& output, size_t max_count) const
+    {
+        YUI_STATS_CALL(StatsSink(), MatchLines, s.length());
+        output.clear();
+        return ScanLines(s, max_count, [&](const LineMatch& line) { output.push_back(line); });
+    }
+
+    size_t RegexMatcher::CountMatchingLines(std::string_view s) const
+    {
+        YUI_STATS_CALL(StatsSink(), CountMatchingLines, s.length());
+        size_t count = 0;
+        ScanLines(s, string_view::npos, [&](const LineMatch&) { count += 1; });
+        return count;
+    }
+
+    size_t RegexMatcher::ScanLines(std::string_view s, size_t max_count, const function<void(const LineMatch&)>& handler) const
+    {
+        size_t number = 0;
+        size_t matched_count = 0;
+
+        const auto end = s.data() + s.length();
+        for (auto p = s.data(); p < end && matched_count < max_count; ++number)
+        {
+            auto line_end = FindLineBreak(p, end);
+            auto begin = static_cast<size_t>(p - s.data());
+            auto length = static_cast<size_t>(line_end - p);
+
+            // the line is all the matcher sees, so no walk goes past its end
+            // NOTE TestLineInternal stops at the first accepting position rather than locating the match
+            if (TestLineInternal(s.substr(begin, length)))
+            {
+                handler({ number, begin, begin + length });
+                matched_count += 1;
+            }
+
+            p = line_end < end ? line_end + 1 : end;
         }
 
-        return result;
-    }
+        return number;
+    }
+
+    SelectionBitmap RegexMatcher::MatchBatch(const vector<string_view>& inputs, const ParallelOptions& options) const
+    {
+        YUI_STATS_CALL(StatsSink(), MatchBatch, TotalLength(inputs));
+
+        // NOTE ranges may share a byte of the bitmap, so every input gets a byte of its own
+        //      which are packed once all tasks are done
+        vector<uint8_t> matched(inputs.size(), 0);
+        RunBatch(inputs, options, [&](size_t begin, size_t end) {
+            for (auto i = begin; i < end; ++i)
+            {
+                // the same as Match, which is not called so that latency is only recorded for the batch
+                size_t match_begin, match_end;
+                if (LocateInternal(inputs[i], 0, false, match_begin, match_end) && match_end == inputs[i].length())
+                {
+                    matched[i] = 1;
+                }
+            }
+        });
+
+        SelectionBitmap selection((inputs.size() + 7) / 8, 0);
+        for (size_t i = 0; i < inputs.size(); ++i)
+        {
+            selection[i / 8] |= matched[i] << (i % 8);
+        }
+
+        return selection;
+    }
+
+    vector<RegexMatchOpt> RegexMatcher::SearchBatch(const vector<string_view>& inputs, const ParallelOptions& options) const
+    {
+        YUI_STATS_CALL(StatsSink(), SearchBatch, TotalLength(inputs));
+
+        vector<RegexMatchOpt> result(inputs.size());
+        RunBatch(inputs, options, [&](size_t begin, size_t end) {
+            for (auto i = begin; i < end; ++i)
+            {
+                result[i] = SerachInternal(inputs[i], 0, true);
+            }
+        });
+
+        return result;
+    }
+
+    MatcherStatsSnapshot RegexMatcher::Stats() const
+    {
+#if defined(YUI_ENABLE_STATS)
+        return stats_->Snapshot();
+#else
+        return MatcherStatsSnapshot{};
+#endif
+    }
+
+    void RegexMatcher::ResetStats() const
+    {
+#if defined(YUI_ENABLE_STATS)
+        stats_->Reset();
+#endif
+    }
+
+    // Implementation of ReplaceTemplate
+    //
+    ReplaceTemplate::ReplaceTemplate(std::string_view text)
+    {
+        const auto AppendLiteral = [&](string_view literal) {
+            // merge adjacent literals into one piece
+            if (!pieces_.empty() && !pieces_.back().is_reference)
+            {
+                pieces_.back().length += literal.length();
+            }
+            else
+            {
+                pieces_.push_back(Piece{ false, text_.length(), literal.length() });
+            }
+
+            text_.append(literal);
+        };
+
+        size_t pos = 0;
+        while (pos < text.length())
+        {
+            auto dollar = text.find('$', pos);
+            if (dollar == string_view::npos)
+            {
+                AppendLiteral(text.substr(pos));
+                break;
+            }
+
+            AppendLiteral(text.substr(pos, dollar - pos));
+            pos = dollar + 1;
+
+            if (pos < text.length() && text[pos] == '$')
+            {
+                AppendLiteral("$");
+                pos += 1;
+            }
+            else if (pos < text.length() && isdigit(static_cast<unsigned char>(text[pos])))
+            {
+                size_t id = 0;
+                while (pos < text.length() && isdigit(static_cast<unsigned char>(text[pos])))
+                {
+                    id = id * 10 + (text[pos] - '0');
+                    pos += 1;
+                }
+
+                pieces_.push_back(Piece{ true, id, 0 });
+            }
+            else
+            {
+                AppendLiteral("$");
+            }
+        }
+    }
+
+    void ReplaceTemplate::Expand(std::string_view subject, size_t begin, size_t end,
+                                 const size_t* slots, size_t capture_count, OutputSink& output) const
+    {
+        for (const auto& piece : pieces_)
+        {
+            if (!piece.is_reference)
+            {
+                output.Append(string_view{ text_ }.substr(piece.offset, piece.length));
+            }
+            else if (piece.offset == 0)
+            {
+                output.Append(subject.substr(begin, end - begin));
+            }
+            else if (piece.offset <= capture_count)
+            {
+                // $n refers to capture n - 1, as captures are numbered from 0
+                auto capture_begin = slots[(piece.offset - 1) * 2], capture_end = slots[(piece.offset - 1) * 2 + 1];
+                if (capture_begin != string_view::npos && capture_end != string_view::npos)
+                {
+                    output.Append(subject.substr(capture_begin, capture_end - capture_begin));
+                }
+            }
+        }
+    }
+
+    // DfaRegexMatcher
+    //
+
+    RegexMatch CreateRegexMatch(string_view content)
+    {
+        return RegexMatch{ content, {} };
+    }
+
+    // builds a match from offsets, slots are laid out as in RegexMatchBuffer
+    RegexMatch CreateRegexMatch(string_view view, size_t begin, size_t end, const size_t* slots, size_t capture_count)
+    {
+        vector<string_view> captures(capture_count);
+        for (size_t id = 0; id < capture_count; ++id)
+        {
+            auto capture_begin = slots[id * 2], capture_end = slots[id * 2 + 1];
+            if (capture_begin != string_view::npos && capture_end != string_view::npos)
+            {
+                captures[id] = view.substr(capture_begin, capture_end - capture_begin);
+            }
+        }
+
+        return RegexMatch{ view.substr(begin, end - begin), std::move(captures) };
+    }
+
+    // kinds of bytes around a position, ends of view are regarded as line breaks
+    static LookKind LookBehind(string_view view, size_t index)
+    {
+        return index == 0 ? LookKind::LineBreak : ClassifyLook(static_cast<unsigned char>(view[index - 1]));
+    }
+
+    static LookKind LookAhead(string_view view, size_t index)
+    {
+        return index >= view.length() ? LookKind::LineBreak : ClassifyLook(static_cast<unsigned char>(view[index]));
+    }
+
+    // tests if the body of an assertion matches a prefix of view[index:], including an empty one
+    static bool MatchAssertionBody(const DfaAutomaton& body, string_view view, size_t index)
+    {
+        auto state = body.InitialState(LookBehind(view, index));
+        if (body.IsAccepting(state, LookAhead(view, index)))
+        {
+            return true;
+        }
+
+        for (size_t i = index; i < view.length(); ++i)
+        {
+            state = body.Transit(state, static_cast<unsigned char>(view[i]));
+            if (state == kInvalidDfaState)
+            {
+                break;
+            }
+
+            if (body.IsAccepting(state, LookAhead(view, i + 1)))
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    // positions where a DFA accepts an empty match, which depends on nothing but the kinds of bytes around them
+    // NOTE the matchers walk at least a byte from a start, so it's only looked up for lines, see TestLineInternal
+    class EmptyMatchLookup
+    {
+    public:
+        template <typename Automaton>
+        explicit EmptyMatchLookup(const Automaton& atm)
+        {
+            for (unsigned behind = 0; behind < kLookKindCount; ++behind)
+            {
+                auto state = atm.InitialState(static_cast<LookKind>(behind));
+                for (unsigned ahead = 0; ahead < kLookKindCount; ++ahead)
+                {
+                    accepting_[behind][ahead] = atm.IsAccepting(state, static_cast<LookKind>(ahead));
+                    any_ |= accepting_[behind][ahead];
+                }
+            }
+        }
+
+        // tests if an empty match is accepted at any position of view, both ends included
+        bool Test(string_view view) const
+        {
+            if (!any_)
+            {
+                return false;
+            }
+
+            for (size_t index = 0; index <= view.length(); ++index)
+            {
+                auto behind = static_cast<unsigned>(LookBehind(view, index));
+                auto ahead = static_cast<unsigned>(LookAhead(view, index));
+                if (accepting_[behind][ahead])
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+    private:
+        bool any_ = false;
+        bool accepting_[kLookKindCount][kLookKindCount] = {};
+    };
+
+    class DfaRegexMatcher : public RegexMatcher
+    {
+    public:
+        DfaRegexMatcher(DfaAutomaton::Ptr atm)
+            : dfa_(std::move(atm)), empty_(*dfa_) { }
+
+    protected:
+        RegexMatchOpt SerachInternal(string_view view, size_t offset, bool allow_substr) const override
+        {
+            size_t begin, end;
+            if (LocateInternal(view, offset, allow_substr, begin, end))
+            {
+                return CreateRegexMatch(view.substr(begin, end - begin));
+            }
+
+            return std::nullopt;
+        }
+
+        bool LocateInternal(string_view view, size_t offset, bool allow_substr, size_t& begin, size_t& end) const override
+        {
+            YUI_STATS_TALLY(tally, StatsSink());
+            for (size_t start = offset; start < view.length(); ++start)
+            {
+                YUI_STATS_COUNT(tally, StartsTried, 1);
+
+                auto found = false;
+                auto last_matched = start;
+                auto state = dfa_->InitialState(LookBehind(view, start));
+
+                for (size_t index = start; index < view.length(); ++index)
+                {
+                    YUI_STATS_COUNT(tally, DfaTransitions, 1);
+                    state = dfa_->Transit(state, static_cast<unsigned char>(view[index]));
+                    if (state != kInvalidDfaState)
+                    {
+                        // record the current position if it's accepting
+                        // NOTE without lookaround, acceptance doesn't depend on the next byte
+                        auto ahead = dfa_->HasLookaround() ? LookAhead(view, index + 1) : LookKind::LineBreak;
+                        if (dfa_->IsAccepting(state, ahead))
+                        {
+                            found = true;
+                            last_matched = index;
+                        }
+                    }
+                    else // no more character wanted
+                    {
+                        break;
+                    }
+                }
+
+                if (found)
+                {
+                    begin = start;
+                    end = last_matched + 1;
+                    return true;
+                }
+                else if (!allow_substr)
+                {
+                    break;
+                }
+            }
+
+            return false;
+        }
+
+        // any accepting state is enough, there's no need to look for the longest match
+        bool TestInternal(string_view view) const override
+        {
+            YUI_STATS_TALLY(tally, StatsSink());
+            for (size_t start = 0; start < view.length(); ++start)
+            {
+                YUI_STATS_COUNT(tally, StartsTried, 1);
+
+                auto state = dfa_->InitialState(LookBehind(view, start));
+                for (size_t index = start; index < view.length(); ++index)
+                {
+                    YUI_STATS_COUNT(tally, DfaTransitions, 1);
+                    state = dfa_->Transit(state, static_cast<unsigned char>(view[index]));
+                    if (state == kInvalidDfaState)
+                    {
+                        break;
+                    }
+
+                    auto ahead = dfa_->HasLookaround() ? LookAhead(view, index + 1) : LookKind::LineBreak;
+                    if (dfa_->IsAccepting(state, ahead))
+                    {
+                        return true;
+                    }
+                }
+            }
+
+            return false;
+        }
+
+        bool TestLineInternal(string_view line) const override
+        {
+            return empty_.Test(line) || TestInternal(line);
+        }
+
+        bool SupportParallelScan() const override { return true; }
+
+        // walks kColumnLanes strings in lockstep so that their jumptable loads overlap
+        // instead of serializing on the latency of each load
+        void MatchColumnInternal(const StringColumn& column, SelectionBitmap& selection) const override
+        {
+            for (size_t base = 0; base < column.length; base += kColumnLanes)
+            {
+                auto lane_count = std::min(kColumnLanes, column.length - base);
+
+                const char* lane_data[kColumnLanes];
+                int32_t lane_length[kColumnLanes];
+                DfaState lane_state[kColumnLanes];
+
+                int32_t max_length = 0;
+                for (size_t lane = 0; lane < kColumnLanes; ++lane)
+                {
+                    // unused lanes are given an empty string so they never step
+                    auto i = std::min(base + lane, column.length - 1);
+                    lane_data[lane] = column.data + column.offsets[i];
+                    lane_length[lane] = lane < lane_count ? column.offsets[i + 1] - column.offsets[i] : 0;
+                    lane_state[lane] = dfa_->InitialState();
+
+                    max_length = std::max(max_length, lane_length[lane]);
+                }
+
+                WalkLanes(lane_data, lane_length, lane_state, max_length);
+
+                for (size_t lane = 0; lane < lane_count; ++lane)
+                {
+                    // a lane that died early has its state invalid
+                    if (lane_length[lane] > 0 && dfa_->IsAccepting(lane_state[lane], LookKind::LineBreak))
+                    {
+                        auto i = base + lane;
+                        selection[i / 8] |= 1u << (i % 8);
+                    }
+                }
+            }
+        }
+
+    private:
+#if defined(__AVX2__)
+        void WalkLanes(const char** data, const int32_t* length, DfaState* state, int32_t max_length) const
+        {
+            static_assert(kColumnLanes == 8, "a lane per 32-bit element of ymm register");
+
+            const auto& classes = dfa_->Classes();
+            const auto table = reinterpret_cast<const int*>(dfa_->Jumptable());
+            const auto invalid = _mm256_set1_epi32(static_cast<int>(kInvalidDfaState));
+            const auto width = _mm256_set1_epi32(static_cast<int>(classes.count));
+            const auto lengths = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(length));
+
+            auto states = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(state));
+            for (int32_t step = 0; step < max_length; ++step)
+            {
+                // a lane keeps walking while it has input left and its state is alive
+                auto has_input = _mm256_cmpgt_epi32(lengths, _mm256_set1_epi32(step));
+                auto alive = _mm256_andnot_si256(_mm256_cmpeq_epi32(states, invalid), has_input);
+                if (_mm256_testz_si256(alive, alive))
+                {
+                    break;
+                }
+
+                alignas(32) int32_t byte_classes[kColumnLanes];
+                for (size_t lane = 0; lane < kColumnLanes; ++lane)
+                {
+                    auto ch = step < length[lane] ? static_cast<unsigned char>(data[lane][step]) : 0;
+                    byte_classes[lane] = classes.class_of[ch];
+                }
+
+                auto index = _mm256_add_epi32(_mm256_mullo_epi32(states, width),
+                                              _mm256_load_si256(reinterpret_cast<const __m256i*>(byte_classes)));
+                states = _mm256_mask_i32gather_epi32(states, table, index, alive, 4);
+            }
+
+            _mm256_storeu_si256(reinterpret_cast<__m256i*>(state), states);
+        }
+#else
+        void WalkLanes(const char** data, const int32_t* length, DfaState* state, int32_t max_length) const
+        {
+            for (int32_t step = 0; step < max_length; ++step)
+            {
+                // the loads below are independent, so they are in flight at the same time
+                bool any_alive = false;
+                for (size_t lane = 0; lane < kColumnLanes; ++lane)
+                {
+                    if (step < length[lane] && state[lane] != kInvalidDfaState)
+                    {
+                        state[lane] = dfa_->Transit(state[lane], static_cast<unsigned char>(data[lane][step]));
+                        any_alive = true;
+                    }
+                }
+
+                if (!any_alive)
+                {
+                    break;
+                }
+            }
+        }
+#endif
+
+    private:
+        static constexpr size_t kColumnLanes = 8;
+
+        DfaAutomaton::Ptr dfa_;
+        EmptyMatchLookup empty_;
+    };
+
+    // LazyDfaRegexMatcher
+    //
+    class LazyDfaRegexMatcher : public RegexMatcher
+    {
+    public:
+        LazyDfaRegexMatcher(LazyDfaAutomaton::Ptr atm)
+            : lazy_(std::move(atm)), empty_(*lazy_) { }
+
+    protected:
+        RegexMatchOpt SerachInternal(string_view view, size_t offset, bool allow_substr) const override
+        {
+            size_t begin, end;
+            if (LocateInternal(view, offset, allow_substr, begin, end))
+            {
+                return CreateRegexMatch(view.substr(begin, end - begin));
+            }
+
+            return std::nullopt;
+        }
+
+        bool LocateInternal(string_view view, size_t offset, bool allow_substr, size_t& begin, size_t& end) const override
+        {
+            YUI_STATS_TALLY(tally, StatsSink());
+            for (size_t start = offset; start < view.length(); ++start)
+            {
+                YUI_STATS_COUNT(tally, StartsTried, 1);
+
+                auto matched_end = Walk(view, start, false YUI_STATS_ARG(tally));
+                if (matched_end != string_view::npos)
+                {
+                    begin = start;
+                    end = matched_end;
+                    return true;
+                }
+                else if (!allow_substr)
+                {
+                    break;
+                }
+            }
+
+            return false;
+        }
+
+        bool TestInternal(string_view view) const override
+        {
+            YUI_STATS_TALLY(tally, StatsSink());
+            for (size_t start = 0; start < view.length(); ++start)
+            {
+                YUI_STATS_COUNT(tally, StartsTried, 1);
+
+                if (Walk(view, start, true YUI_STATS_ARG(tally)) != string_view::npos)
+                {
+                    return true;
+                }
+            }
+
+            return false;
+        }
+
+        bool TestLineInternal(string_view line) const override
+        {
+            return empty_.Test(line) || TestInternal(line);
+        }
+
+        bool SupportParallelScan() const override { return true; }
+
+    private:
+        // walks from start for the longest match, or stops at the first accepting position if first_accepting is set
+        // returns where the match ends, or npos if there's none
+        size_t Walk(string_view view, size_t start, bool first_accepting YUI_STATS_PARAM(StatsTally& tally)) const
+        {
+            auto matched_end = string_view::npos;
+            auto state = lazy_->InitialState(LookBehind(view, start));
+
+            for (size_t index = start; index < view.length(); ++index)
+            {
+                YUI_STATS_COUNT(tally, DfaTransitions, 1);
+                auto target = lazy_->Transit(state, static_cast<unsigned char>(view[index]));
+                if (target == kInvalidDfaState)
+                {
+                    break;
+                }
+                else if (target == LazyDfaAutomaton::kCacheFullState)
+                {
+                    return WalkUncached(view, state, index, first_accepting, matched_end);
+                }
+
+                state = target;
+
+                // NOTE without lookaround, acceptance doesn't depend on the next byte
+                auto ahead = lazy_->HasLookaround() ? LookAhead(view, index + 1) : LookKind::LineBreak;
+                if (lazy_->IsAccepting(state, ahead))
+                {
+                    matched_end = index + 1;
+                    if (first_accepting)
+                    {
+                        break;
+                    }
+                }
+            }
+
+            return matched_end;
+        }
+
+        // goes on with a walk from the state before view[index] where the cache is full,
+        // taking a step of subset construction for every byte, which is as slow as NFA simulation
+        size_t WalkUncached(string_view view, DfaState state, size_t index, bool first_accepting, size_t matched_end) const
+        {
+            const auto& constructor = lazy_->Constructor();
+
+            thread_local vector<unsigned> subset, target_subset;
+            subset = lazy_->Subset(state);
+            auto behind = lazy_->Behind(state);
+
+            for (; index < view.length(); ++index)
+            {
+                auto byte_class = constructor.Classes().class_of[static_cast<unsigned char>(view[index])];
+                constructor.StepClass(subset, behind, byte_class, target_subset);
+                if (target_subset.empty())
+                {
+                    break;
+                }
+
+                swap(subset, target_subset);
+                behind = constructor.ClassLook(byte_class);
+
+                auto ahead = lazy_->HasLookaround() ? LookAhead(view, index + 1) : LookKind::LineBreak;
+                if ((constructor.AcceptingLookahead(subset, behind) & (1u << static_cast<unsigned>(ahead))) != 0)
+                {
+                    matched_end = index + 1;
+                    if (first_accepting)
+                    {
+                        break;
+                    }
+                }
+            }
+
+            return matched_end;
+        }
+
+    private:
+        LazyDfaAutomaton::Ptr lazy_;
+        EmptyMatchLookup empty_;
+    };
+
+    // JitRegexMatcher
+    //
+    class JitRegexMatcher : public RegexMatcher
+    {
+    public:
+        // NOTE the program is compiled from the automaton which empty is built from
+        JitRegexMatcher(JitProgram::Ptr program, const EmptyMatchLookup& empty)
+            : program_(std::move(program)), empty_(empty) { }
+
+    protected:
+        RegexMatchOpt SerachInternal(string_view view, size_t offset, bool allow_substr) const override
+        {
+            size_t begin, end;
+            if (LocateInternal(view, offset, allow_substr, begin, end))
+            {
+                return CreateRegexMatch(view.substr(begin, end - begin));
+            }
+
+            return std::nullopt;
+        }
+
+        bool LocateInternal(string_view view, size_t offset, bool allow_substr, size_t& begin, size_t& end) const override
+        {
+            // NOTE transitions taken by the compiled code are not counted
+            YUI_STATS_TALLY(tally, StatsSink());
+
+            const char* view_end = view.data() + view.length();
+            for (const char* start = view.data() + offset; start < view_end; ++start)
+            {
+                YUI_STATS_COUNT(tally, StartsTried, 1);
+
+                // the compiled code walks the automaton for the longest match
+                const char* matched_end = program_->Run(start, view_end);
+                if (matched_end != nullptr)
+                {
+                    begin = distance(view.data(), start);
+                    end = distance(view.data(), matched_end);
+                    return true;
+                }
+                else if (!allow_substr)
+                {
+                    break;
+                }
+            }
+
+            return false;
+        }
+
+        bool TestLineInternal(string_view line) const override
+        {
+            return empty_.Test(line) || TestInternal(line);
+        }
+
+        bool SupportParallelScan() const override { return true; }
+
+    private:
+        JitProgram::Ptr program_;
+        EmptyMatchLookup empty_;
+    };
+
+    // walks an automaton whose transitions carry capture actions, but with the actions ignored
+    // as they never affect where a match ends, i.e. a OnePassAutomaton or a TaggedDfaAutomaton
+    // if first_accepting is set, it stops at the first accepting state instead of the longest match
+    template <typename Automaton>
+    static bool LocateWithoutCaptures(const Automaton& atm, string_view view, size_t offset, bool allow_substr,
+                                      bool first_accepting, size_t& begin, size_t& end YUI_STATS_PARAM(MatcherStats& stats))
+    {
+        YUI_STATS_TALLY(tally, stats);
+        for (size_t start = offset; start < view.length(); ++start)
+        {
+            YUI_STATS_COUNT(tally, StartsTried, 1);
+
+            auto found = false;
+            auto last_matched = start;
+            auto state = atm.InitialState();
+
+            for (size_t index = start; index < view.length(); ++index)
+            {
+                YUI_STATS_COUNT(tally, DfaTransitions, 1);
+                state = atm.Transit(state, static_cast<unsigned char>(view[index])).target;
+                if (state == kInvalidDfaState)
+                {
+                    break;
+                }
+
+                if (atm.IsAccepting(state))
+                {
+                    found = true;
+                    last_matched = index;
+
+                    if (first_accepting)
+                    {
+                        break;
+                    }
+                }
+            }
+
+            if (found)
+            {
+                begin = start;
+                end = last_matched + 1;
+                return true;
+            }
+            else if (!allow_substr)
+            {
+                break;
+            }
+        }
+
+        return false;
+    }
+
+    // OnePassRegexMatcher
+    //
+    class OnePassRegexMatcher : public RegexMatcher
+    {
+    public:
+        OnePassRegexMatcher(OnePassAutomaton::Ptr atm)
+            : atm_(std::move(atm)) { }
+
+    protected:
+        RegexMatchOpt SerachInternal(string_view view, size_t offset, bool allow_substr) const override
+        {
+            vector<size_t> slots(atm_->SlotCount());
+
+            size_t begin, end;
+            if (LocateCapturesInternal(view, offset, allow_substr, begin, end, slots.data()))
+            {
+                return CreateRegexMatch(view, begin, end, slots.data(), CaptureCount());
+            }
+
+            return nullopt;
+        }
+
+        size_t CaptureCount() const override
+        {
+            return atm_->SlotCount() / 2;
+        }
+
+        bool LocateCapturesInternal(string_view view, size_t offset, bool allow_substr,
+                                    size_t& begin, size_t& end, size_t* matched_slots) const override
+        {
+            // slots hold offsets into view, and are reused by searches on the same thread
+            thread_local vector<size_t> slots;
+            slots.resize(atm_->SlotCount());
+
+            YUI_STATS_TALLY(tally, StatsSink());
+            for (size_t start = offset; start < view.length(); ++start)
+            {
+                YUI_STATS_COUNT(tally, StartsTried, 1);
+
+                auto found = false;
+                auto last_matched = start;
+                auto state = atm_->InitialState();
+                fill(slots.begin(), slots.end(), string_view::npos);
+
+                // a single walk, as there's only one path to follow
+                for (size_t index = start; index < view.length(); ++index)
+                {
+                    YUI_STATS_COUNT(tally, DfaTransitions, 1);
+                    const auto& transition = atm_->Transit(state, static_cast<unsigned char>(view[index]));
+                    if (transition.target == kInvalidDfaState)
+                    {
+                        break;
+                    }
+
+                    for (auto slot : atm_->Actions(transition.actions))
+                    {
+                        slots[slot] = index;
+                    }
+
+                    state = transition.target;
+
+                    // take a snapshot of captures if accepting
+                    if (atm_->IsAccepting(state))
+                    {
+                        found = true;
+                        last_matched = index;
+
+                        copy(slots.begin(), slots.end(), matched_slots);
+                        for (auto slot : atm_->AcceptingActions(state))
+                        {
+                            matched_slots[slot] = index + 1;
+                        }
+                    }
+                }
+
+                if (found)
+                {
+                    begin = start;
+                    end = last_matched + 1;
+                    return true;
+                }
+                else if (!allow_substr)
+                {
+                    break;
+                }
+            }
+
+            return false;
+        }
+
+        bool LocateInternal(string_view view, size_t offset, bool allow_substr, size_t& begin, size_t& end) const override
+        {
+            return LocateWithoutCaptures(*atm_, view, offset, allow_substr, false, begin, end YUI_STATS_ARG(StatsSink()));
+        }
+
+        bool TestInternal(string_view view) const override
+        {
+            size_t begin, end;
+            return LocateWithoutCaptures(*atm_, view, 0, true, true, begin, end YUI_STATS_ARG(StatsSink()));
+        }
+
+        // NOTE there's no anchor, so an empty match is accepted everywhere or nowhere
+        bool TestLineInternal(string_view line) const override
+        {
+            return atm_->IsAccepting(atm_->InitialState()) || TestInternal(line);
+        }
+
+        bool SupportParallelScan() const override { return true; }
+
+    private:
+        OnePassAutomaton::Ptr atm_;
+    };
+
+    // TaggedDfaRegexMatcher
+    //
+    class TaggedDfaRegexMatcher : public RegexMatcher
+    {
+    public:
+        TaggedDfaRegexMatcher(TaggedDfaAutomaton::Ptr atm)
+            : atm_(std::move(atm)) { }
+
+    protected:
+        RegexMatchOpt SerachInternal(string_view view, size_t offset, bool allow_substr) const override
+        {
+            vector<size_t> slots(atm_->SlotCount());
+
+            size_t begin, end;
+            if (LocateCapturesInternal(view, offset, allow_substr, begin, end, slots.data()))
+            {
+                return CreateRegexMatch(view, begin, end, slots.data(), CaptureCount());
+            }
+
+            return nullopt;
+        }
+
+        size_t CaptureCount() const override
+        {
+            return atm_->SlotCount() / 2;
+        }
+
+        bool LocateCapturesInternal(string_view view, size_t offset, bool allow_substr,
+                                    size_t& begin, size_t& end, size_t* matched_slots) const override
+        {
+            const auto slot_count = atm_->SlotCount();
+
+            // registers hold offsets into view, a row for each thread
+            // NOTE they are reused by searches on the same thread
+            thread_local vector<size_t> registers;
+            thread_local vector<size_t> buffer;
+            registers.resize(atm_->RowCount() * slot_count);
+            buffer.resize(atm_->RowCount() * slot_count);
+
+            const auto RunCommands = [&](unsigned index, size_t pos) {
+                const auto& commands = atm_->Commands(index);
 
-    // DfaRegexMatcher
-    //
+                // read every source row first, as a row may be the source of another command
+                for (const auto& command : commands)
+                {
+                    if (command.source_row != kNoSourceRow && command.source_row != command.target_row)
+                    {
+                        auto source = registers.begin() + command.source_row * slot_count;
+                        copy(source, source + slot_count, buffer.begin() + command.target_row * slot_count);
+                    }
+                }
 
-    RegexMatch CreateRegexMatch(string_view content)
-    {
-        return RegexMatch{ content, {} };
-    }
+                for (const auto& command : commands)
+                {
+                    auto target = registers.begin() + command.target_row * slot_count;
+                    if (command.source_row == kNoSourceRow)
+                    {
+                        fill(target, target + slot_count, string_view::npos);
+                    }
+                    else if (command.source_row != command.target_row)
+                    {
+                        auto source = buffer.begin() + command.target_row * slot_count;
+                        copy(source, source + slot_count, target);
+                    }
 
-    class DfaRegexMatcher : public RegexMatcher
-    {
-    public:
-        DfaRegexMatcher(DfaAutomaton::Ptr atm)
-            : dfa_(std::move(atm)) { }
+                    for (auto slot : command.slots)
+                    {
+                        target[slot] = pos;
+                    }
+                }
+            };
 
-    protected:
-        RegexMatchOpt SerachInternal(string_view view, bool allow_substr) const override
-        {
-            for (auto start_it = view.begin(); start_it != view.end(); ++start_it)
+            YUI_STATS_TALLY(tally, StatsSink());
+            for (size_t start = offset; start < view.length(); ++start)
             {
+                YUI_STATS_COUNT(tally, StartsTried, 1);
+
                 auto found = false;
-                auto last_matched_it = start_it;
-                auto state = dfa_->InitialState();
+                auto last_matched = start;
+                auto state = atm_->InitialState();
+                RunCommands(atm_->InitialCommands(), start);
 
-                for (auto it = start_it; it != view.end(); ++it)
+                for (size_t index = start; index < view.length(); ++index)
                 {
-                    state = dfa_->Transit(state, *it);
-                    if (state != kInvalidDfaState)
+                    YUI_STATS_COUNT(tally, DfaTransitions, 1);
+                    const auto& transition = atm_->Transit(state, static_cast<unsigned char>(view[index]));
+                    if (transition.target == kInvalidDfaState)
                     {
-                        // record the current position if it's accepting
-                        if (dfa_->IsAccepting(state))
-                        {
-                            found = true;
-                            last_matched_it = it;
-                        }
+                        break;
                     }
-                    else // no more character wanted
+
+                    RunCommands(transition.commands, index + 1);
+                    state = transition.target;
+
+                    // take a snapshot of captures of the accepting thread
+                    if (atm_->IsAccepting(state))
                     {
-                        break;
+                        found = true;
+                        last_matched = index;
+
+                        auto row = registers.begin() + atm_->AcceptingRow(state) * slot_count;
+                        copy(row, row + slot_count, matched_slots);
                     }
                 }
 
                 if (found)
                 {
-                    auto start_offset = distance(view.begin(), start_it);
-                    auto matched_len = distance(start_it, last_matched_it) + 1;
-                    return CreateRegexMatch(view.substr(start_offset, matched_len));
+                    begin = start;
+                    end = last_matched + 1;
+                    return true;
                 }
                 else if (!allow_substr)
                 {
@@ -103,11 +1561,30 @@ namespace yui
                 }
             }
 
-            return std::nullopt;
+            return false;
+        }
+
+        bool LocateInternal(string_view view, size_t offset, bool allow_substr, size_t& begin, size_t& end) const override
+        {
+            return LocateWithoutCaptures(*atm_, view, offset, allow_substr, false, begin, end YUI_STATS_ARG(StatsSink()));
+        }
+
+        bool TestInternal(string_view view) const override
+        {
+            size_t begin, end;
+            return LocateWithoutCaptures(*atm_, view, 0, true, true, begin, end YUI_STATS_ARG(StatsSink()));
+        }
+
+        // NOTE there's no anchor, so an empty match is accepted everywhere or nowhere
+        bool TestLineInternal(string_view line) const override
+        {
+            return atm_->AcceptsEmpty() || TestInternal(line);
         }
 
+        bool SupportParallelScan() const override { return true; }
+
     private:
-        DfaAutomaton::Ptr dfa_;
+        TaggedDfaAutomaton::Ptr atm_;
     };
 
     // NfaRegexMatcher
@@ -116,22 +1593,120 @@ namespace yui
     {
     public:
         NfaRegexMatcher(NfaAutomaton::Ptr atm)
-            : nfa_(std::move(atm)) { }
+            : nfa_(std::move(atm))
+        {
+            // contents of captures are only needed by references if not requested
+            has_reference_ = false;
+            capture_count_ = 0;
+            EnumerateNfa(nfa_->IntialState(), [&](const NfaState* state) {
+                for (const NfaTransition* edge : state->exits)
+                {
+                    has_reference_ |= edge->type == TransitionType::Reference;
+                    if (edge->type == TransitionType::BeginCapture)
+                    {
+                        capture_count_ = max<size_t>(capture_count_, get<unsigned>(edge->data) + 1);
+                    }
+                }
+            });
+        }
 
     private:
 
+		// results of assertions, which depend on nothing but the position
+		// so they are tested once and shared by every start position of a search
+		class AssertionMemo
+		{
+		public:
+			// forgets results of the last search, but keeps the buffers for the next one
+			// NOTE the memo may be shared by matchers on the same thread, so bodies are forgotten as well
+			void Reset(size_t offset)
+			{
+				offset_ = offset;
+				for (auto& item : results_)
+				{
+					item.first = nullptr;
+					item.second.clear();
+				}
+			}
+
+			bool Test(const AssertionData& assertion, string_view view, size_t index)
+			{
+				// NOTE a pattern has few assertions, a linear lookup is fine
+				auto iter = find_if(results_.begin(), results_.end(),
+					[&](const auto& item) { return item.first == assertion.body.get(); });
+				if (iter == results_.end())
+				{
+					// take a buffer forgotten by Reset if any
+					iter = find_if(results_.begin(), results_.end(),
+						[](const auto& item) { return item.first == nullptr; });
+					if (iter == results_.end())
+					{
+						iter = results_.emplace(results_.end());
+					}
+
+					iter->first = assertion.body.get();
+				}
+
+				// positions are stored from offset, and the vector grows on demand
+				auto& results = iter->second;
+				if (results.size() <= index - offset_)
+				{
+					results.resize(index - offset_ + 1, kUnknown);
+				}
+
+				auto& result = results[index - offset_];
+				if (result == kUnknown)
+				{
+					result = MatchAssertionBody(*assertion.body, view, index) ? kMatched : kUnmatched;
+				}
+
+				return (result == kMatched) == (assertion.type == AssertionType::Positive);
+			}
+
+		private:
+			static constexpr int8_t kUnknown = 0;
+			static constexpr int8_t kMatched = 1;
+			static constexpr int8_t kUnmatched = 2;
+
+			size_t offset_ = 0;
+			vector<pair<const DfaAutomaton*, vector<int8_t>>> results_; // shared by assertions of the same body
+		};
+
 		struct SimulationContext
 		{
-			deque<pair<unsigned, NfaTransition*>> routes; // (target index, passed edge)
+			vector<tuple<unsigned, NfaTransition*, unsigned>> routes; // (target index, passed edge, trail of the source)
+			vector<tuple<const NfaState*, unsigned, unsigned>> trail; // (state, index, parent) along the current path
 			vector<string_view> captures;
+			stack<tuple<size_t, size_t, unsigned>, vector<tuple<size_t, size_t, unsigned>>> capture_buffer; // (start_pos, thres_depth, id)
+			AssertionMemo memo; // reset by each search, see AssertionMemo::Reset
 		};
 
+		static constexpr unsigned kNoTrail = numeric_limits<unsigned>::max();
+
+		// tests if a step without consuming into target returns to a state passed at the same index
+		// NOTE such a loop consumes nothing, e.g. (?:^)*, and would be taken forever
+		static bool ClosesLoop(const SimulationContext& ctx, unsigned from, const NfaState* target, size_t index)
+		{
+			for (auto i = from; i != kNoTrail && get<1>(ctx.trail[i]) == index; i = get<2>(ctx.trail[i]))
+			{
+				if (get<0>(ctx.trail[i]) == target)
+				{
+					return true;
+				}
+			}
+
+			return false;
+		}
+
 		// things with larger index are prior
-		void ExpandRoutes(SimulationContext& ctx, const NfaState* state, size_t index, const string_view view) const
+		// from is the item of state in ctx.trail
+		void ExpandRoutes(SimulationContext& ctx, const NfaState* state, unsigned from, size_t index, const string_view view) const
 		{
 			assert(index <= view.length());
 
-			auto&[routes, captures] = ctx;
+			auto& routes = ctx.routes;
+			auto& captures = ctx.captures;
+			auto closes_loop = [&](const NfaTransition* edge) { return ClosesLoop(ctx, from, edge->target, index); };
 			for (auto it = state->exits.rbegin(); it != state->exits.rend(); ++it)
 			{
 				const auto edge = *it;
@@ -140,36 +1715,43 @@ namespace yui
 				{
 					// Entity transition attemps to consume a character in its range
 				case TransitionType::Entity:
-					if (index < view.length() && get<CharRange>(edge->data).Contain(view[index]))
+					if (index < view.length() && get<CharRange>(edge->data).Contain(static_cast<unsigned char>(view[index])))
+					{
+						routes.emplace_back(index+1, edge, from);
+					}
+					break;
+
+					// Class transition attemps to consume a character in its set
+				case TransitionType::Class:
+					if (index < view.length() && get<CharClass>(edge->data).Contain(static_cast<unsigned char>(view[index])))
 					{
-						routes.emplace_back(index+1, edge);
+						routes.emplace_back(index+1, edge, from);
 					}
 					break;
 
 					// Anchor transition checks the context without consuming any character
 				case TransitionType::Anchor:
-					if (get<AnchorType>(edge->data) == AnchorType::LineStart)
+					if (TestAnchor(get<AnchorType>(edge->data), LookBehind(view, index), LookAhead(view, index)) && !closes_loop(edge))
 					{
-						if (index == 0 || view[index - 1] == '\n')
-						{
-							routes.emplace_back(index, edge);
-						}
+						routes.emplace_back(index, edge, from);
 					}
-					else // then AnchorType::LineBreak
+					break;
+
+					// Assertion transition tests its body without consuming any character
+				case TransitionType::Assertion:
+					if (!closes_loop(edge) && ctx.memo.Test(get<AssertionData>(edge->data), view, index))
 					{
-						if (index == view.length() || view[index] == '\n')
-						{
-							routes.emplace_back(index, edge);
-						}
+						routes.emplace_back(index, edge, from);
 					}
 					break;
 
-					// the following transitions always pass
+					// the following transitions always pass, unless they close a loop
 				case TransitionType::BeginCapture:
 				case TransitionType::EndCapture:
-				case TransitionType::BeginAssertion:
-				case TransitionType::EndAssertion:
-					routes.emplace_back(index, edge);
+					if (!closes_loop(edge))
+					{
+						routes.emplace_back(index, edge, from);
+					}
 					break;
 
 					// Reference transitions may consume multiple characters
@@ -177,13 +1759,13 @@ namespace yui
 				case TransitionType::Reference:
 				{
 					auto id = get<unsigned>(edge->data);
-					if (captures.size() > id || !captures[id].empty())
+					if (captures.size() > id && !captures[id].empty())
 					{
 						auto expected_str = captures[id];
 						auto test_str = view.substr(index, expected_str.length());
 						if (expected_str == test_str)
 						{
-							routes.emplace_back(index + expected_str.length(), edge);
+							routes.emplace_back(index + expected_str.length(), edge, from);
 						}
 					}
 				}
@@ -195,46 +1777,59 @@ namespace yui
 			}
 		}
 
-	protected:
-
-        RegexMatchOpt SerachInternal(string_view view, bool allow_substr) const override
-        {
-			// TODO: add minimum-length optimization
-			// TODO: add Assertion support
+		// backtracks for the first match starting at index, and returns where it ends or npos if there's none
+		// contents of captures are written into ctx only if track_captures is set
+		size_t Backtrack(SimulationContext& ctx, string_view view, size_t index, bool track_captures) const
+		{
 			// TODO: discards captured contents when backtracking <- support multiple capture?
-			for (size_t index = 0; index < view.length(); ++index)
-			{
-				bool found = false;
-				auto last_matched_depth = 0u;
-				auto last_matched_index = index;
+			bool found = false;
+			auto last_matched_depth = 0u;
+			auto last_matched_index = index;
 
-				SimulationContext ctx;
-				auto&[routes, captures] = ctx;
+			auto& routes = ctx.routes;
+			auto& trail = ctx.trail;
+			auto& captures = ctx.captures;
+			auto& capture_buffer = ctx.capture_buffer;
 
-				stack<tuple<size_t, size_t, unsigned>> capture_buffer; // (start_pos, thres_depth, id)
+			YUI_STATS_TALLY(tally, StatsSink());
+			YUI_STATS_COUNT(tally, StartsTried, 1);
 
-				// initialize routes
-				ExpandRoutes(ctx, nfa_->IntialState(), index, view);
+			routes.clear();
+			trail.clear();
+			captures.clear();
+			while (!capture_buffer.empty())
+			{
+				capture_buffer.pop();
+			}
 
-				// iterate and backtrack for the first match
-				while (!routes.empty())
-				{
-					auto[target_index, last_edge] = routes.back();
-					routes.pop_back();
+			// initialize routes
+			trail.emplace_back(nfa_->IntialState(), static_cast<unsigned>(index), kNoTrail);
+			ExpandRoutes(ctx, nfa_->IntialState(), 0, index, view);
+			YUI_STATS_COUNT(tally, RoutesPushed, routes.size());
 
-					const auto current_depth = routes.size();
+			// iterate and backtrack for the first match
+			while (!routes.empty())
+			{
+				auto[target_index, last_edge, source] = routes.back();
+				routes.pop_back();
+				YUI_STATS_COUNT(tally, RoutesPopped, 1);
 
-					// never backtrack to discard a match
-					if (found && current_depth < last_matched_depth)
-					{
-						break;
-					}
+				const auto current_depth = routes.size();
+
+				// never backtrack to discard a match
+				if (found && current_depth < last_matched_depth)
+				{
+					break;
+				}
 
+				if (track_captures)
+				{
 					// remove capture buffer if no longer valid on backtracking
 					while (!capture_buffer.empty() 
 						&& current_depth < get<1>(capture_buffer.top()))
 					{
 						capture_buffer.pop();
+						YUI_STATS_COUNT(tally, CapturePops, 1);
 					}
 
 					// process special transitions
@@ -261,29 +1856,51 @@ namespace yui
 						captures[id] = view.substr(start_pos, target_index - start_pos);
 					}
 						break;
-
-					case TransitionType::BeginAssertion:
-					case TransitionType::EndAssertion:
-						throw 0;
+					default:
+						// other transitions leave captures alone
 						break;
 					}
+				}
 
-					// record possible match
-					if (last_edge->target->is_final)
-					{
-						found = true;
-						last_matched_depth = current_depth;
-						last_matched_index = target_index;
-					}
+				// record possible match
+				if (last_edge->target->is_final)
+				{
+					found = true;
+					last_matched_depth = current_depth;
+					last_matched_index = target_index;
+				}
 
-					// lookup possible new routes
-					ExpandRoutes(ctx, last_edge->target, target_index, view);
+				// lookup possible new routes
+				// NOTE a route leading nowhere makes the next one popped a backtrack
+				// NOTE items after the source belong to paths already given up
+				const auto route_count = routes.size();
+				trail.resize(source + 1);
+				trail.emplace_back(last_edge->target, target_index, source);
+				ExpandRoutes(ctx, last_edge->target, static_cast<unsigned>(trail.size() - 1), target_index, view);
+				YUI_STATS_COUNT(tally, RoutesPushed, routes.size() - route_count);
+				if (routes.size() == route_count && !routes.empty())
+				{
+					YUI_STATS_COUNT(tally, Backtracks, 1);
 				}
+			}
+
+			return found ? last_matched_index : string_view::npos;
+		}
+
+	protected:
 
-				if (found)
+        RegexMatchOpt SerachInternal(string_view view, size_t offset, bool allow_substr) const override
+        {
+			// TODO: add minimum-length optimization
+			SimulationContext ctx;
+			ctx.memo.Reset(offset);
+			for (size_t index = offset; index < view.length(); ++index)
+			{
+				auto matched_end = Backtrack(ctx, view, index, true);
+				if (matched_end != string_view::npos)
 				{
-					auto content = view.substr(index, last_matched_index - index);
-					return RegexMatch{ content, captures };
+					auto content = view.substr(index, matched_end - index);
+					return RegexMatch{ content, std::move(ctx.captures) };
 				}
 				else if (!allow_substr)
 				{
@@ -294,8 +1911,106 @@ namespace yui
 			return nullopt;
 		}
 
+		bool LocateInternal(string_view view, size_t offset, bool allow_substr, size_t& begin, size_t& end) const override
+		{
+			// buffers are reused by searches on the same thread, including the memo of assertions
+			thread_local SimulationContext ctx;
+
+			ctx.memo.Reset(offset);
+			for (size_t index = offset; index < view.length(); ++index)
+			{
+				auto matched_end = Backtrack(ctx, view, index, has_reference_);
+				if (matched_end != string_view::npos)
+				{
+					begin = index;
+					end = matched_end;
+					return true;
+				}
+				else if (!allow_substr)
+				{
+					break;
+				}
+			}
+
+			return false;
+		}
+
+		size_t CaptureCount() const override
+		{
+			return capture_count_;
+		}
+
+		bool LocateCapturesInternal(string_view view, size_t offset, bool allow_substr,
+									size_t& begin, size_t& end, size_t* slots) const override
+		{
+			thread_local SimulationContext ctx;
+
+			ctx.memo.Reset(offset);
+			for (size_t index = offset; index < view.length(); ++index)
+			{
+				auto matched_end = Backtrack(ctx, view, index, true);
+				if (matched_end != string_view::npos)
+				{
+					begin = index;
+					end = matched_end;
+
+					// captures not reached are left empty with no data
+					for (size_t id = 0; id < capture_count_; ++id)
+					{
+						auto capture = id < ctx.captures.size() ? ctx.captures[id] : string_view{};
+						if (capture.data() == nullptr)
+						{
+							slots[id * 2] = slots[id * 2 + 1] = string_view::npos;
+						}
+						else
+						{
+							slots[id * 2] = distance(view.data(), capture.data());
+							slots[id * 2 + 1] = slots[id * 2] + capture.length();
+						}
+					}
+
+					return true;
+				}
+				else if (!allow_substr)
+				{
+					break;
+				}
+			}
+
+			return false;
+		}
+
+		bool TestLineInternal(string_view line) const override
+		{
+			// Backtrack records a match only after an edge is passed
+			// so an accepting initial state means an empty match anywhere, which it never finds
+			if (nfa_->IntialState()->is_final)
+			{
+				return true;
+			}
+
+			thread_local SimulationContext ctx;
+
+			// NOTE unlike LocateInternal, it also starts at the end, where only an empty match fits
+			ctx.memo.Reset(0);
+			for (size_t index = 0; index <= line.length(); ++index)
+			{
+				if (Backtrack(ctx, line, index, has_reference_) != string_view::npos)
+				{
+					return true;
+				}
+			}
+
+			return false;
+		}
+
+		// anchors inspect the view directly so it's safe to start anywhere
+		bool SupportParallelScan() const override { return true; }
+
     private:
         NfaAutomaton::Ptr nfa_;
+        bool has_reference_;
+        size_t capture_count_;
     };
 
     // Matcher Factory
@@ -306,11 +2021,150 @@ namespace yui
         return make_unique<DfaRegexMatcher>(std::move(dfa));
     }
 
+    RegexMatcher::Ptr CreateJitMatcher(DfaAutomaton::Ptr dfa)
+    {
+        auto program = CompileDfa(*dfa);
+        if (program == nullptr)
+        {
+            // JIT is unavailable, fall back to the jumptable
+            return CreateDfaMatcher(std::move(dfa));
+        }
+
+        return make_unique<JitRegexMatcher>(std::move(program), EmptyMatchLookup{ *dfa });
+    }
+
+    RegexMatcher::Ptr CreateOnePassMatcher(OnePassAutomaton::Ptr atm)
+    {
+        return make_unique<OnePassRegexMatcher>(std::move(atm));
+    }
+
+    RegexMatcher::Ptr CreateTaggedDfaMatcher(TaggedDfaAutomaton::Ptr atm)
+    {
+        return make_unique<TaggedDfaRegexMatcher>(std::move(atm));
+    }
+
     RegexMatcher::Ptr CreateNfaMatcher(NfaAutomaton::Ptr nfa)
     {
         // automaton for simulation should have no epsilon edge for the sake of performance
         assert(!nfa->HasEpsilon());
+        assert(nfa->SimulationCompatible());
 
         return make_unique<NfaRegexMatcher>(std::move(nfa));
     }
+
+    // measures wall time of a phase into a field of CompileReport, if there's one
+    class PhaseTimer : Uncopyable, Unmovable
+    {
+    public:
+        PhaseTimer(CompileReport* report, chrono::nanoseconds CompileReport::* field)
+            : report_(report), field_(field)
+        {
+            if (report_ != nullptr)
+            {
+                start_ = chrono::steady_clock::now();
+            }
+        }
+
+        ~PhaseTimer()
+        {
+            if (report_ != nullptr)
+            {
+                report_->*field_ += chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start_);
+            }
+        }
+
+    private:
+        CompileReport* report_;
+        chrono::nanoseconds CompileReport::* field_;
+        chrono::steady_clock::time_point start_;
+    };
+
+    RegexMatcher::Ptr CreateLazyDfaMatcher(LazyDfaAutomaton::Ptr atm)
+    {
+        return make_unique<LazyDfaRegexMatcher>(std::move(atm));
+    }
+
+    RegexMatcher::Ptr CreateMatcher(const NfaAutomaton& nfa, size_t dfa_state_limit, CompileReport* report)
+    {
+        if (report != nullptr)
+        {
+            report->nfa_size = MeasureNfa(nfa);
+            report->arena_bytes += nfa.ArenaBytes();
+        }
+
+        if (nfa.DfaCompatible())
+        {
+            DfaAutomaton::Ptr dfa;
+            {
+                PhaseTimer timer{ report, &CompileReport::determinize_time };
+                dfa = GenerateDfa(nfa, dfa_state_limit);
+            }
+
+            if (dfa != nullptr)
+            {
+                if (report != nullptr)
+                {
+                    report->dfa_state_count = dfa->StateCount();
+                    report->table_bytes = dfa->TableBytes();
+                }
+
+                return CreateDfaMatcher(std::move(dfa));
+            }
+
+            if (report != nullptr)
+            {
+                report->dfa_out_of_budget = true;
+            }
+        }
+
+        // the backtracker would find other matches than on the Thompson NFA, see SimulationCompatible
+        // or on a simplified tree, other matches than the DFA within budget, see Simplified
+        if (!nfa.SimulationCompatible() || nfa.Simplified())
+        {
+            return nfa.DfaCompatible() ? CreateLazyDfaMatcher(GenerateLazyDfa(nfa)) : nullptr;
+        }
+
+        // the DFA is out of budget, or cannot be built at all
+        // NOTE the backtracker takes the epsilon-free automaton as is, not reduced, see ReduceNfa
+        NfaAutomaton::Ptr simulated;
+        {
+            PhaseTimer timer{ report, &CompileReport::eliminate_time };
+            simulated = EliminateEpsilon(nfa);
+        }
+
+        if (report != nullptr)
+        {
+            report->simulated_size = MeasureNfa(*simulated);
+            report->arena_bytes += simulated->ArenaBytes();
+        }
+
+        return CreateNfaMatcher(std::move(simulated));
+    }
+
+    RegexMatcher::Ptr CompileRegex(RegexFactoryBase& factory, size_t dfa_state_limit, CompileReport* report)
+    {
+        ManagedRegex::Ptr regex;
+        {
+            PhaseTimer timer{ report, &CompileReport::construct_time };
+            regex = factory.Generate();
+        }
+
+        NfaAutomaton::Ptr nfa;
+        {
+            PhaseTimer timer{ report, &CompileReport::connect_time };
+
+            NfaBuilder builder;
+            auto branch = builder.NewBranch(true);
+            regex->Expr()->ConnectNfa(builder, branch);
+            nfa = builder.Build(branch.begin);
+        }
+
+        if (report != nullptr)
+        {
+            report->arena_bytes += regex->ArenaBytes();
+        }
+
+        // NOTE the matcher holds neither the expression nor this NFA
+        return CreateMatcher(*nfa, dfa_state_limit, report);
+    }
 }
\ No newline at end of file
@@ -1,9 +1,18 @@
 #pragma once
 #include "regex-automaton.h"
+#include "regex-tdfa.h"
+#include "regex-lazy-dfa.h"
+#include "regex-stats.h"
+#include <string>
 #include <string_view>
 #include <vector>
+#include <cstdint>
 #include <memory>
 #include <optional>
+#include <iterator>
+#include <chrono>
+#include <functional>
+#include <utility>
 
 namespace yui
 {
@@ -16,6 +25,176 @@ namespace yui
     using RegexMatchOpt = std::optional<RegexMatch>;
     using RegexMatchVec = std::vector<RegexMatch>;
 
+    // Matches kept as offsets into the searched string, an array for each field
+    // where slot 2k and 2k+1 of a match are the begin and the end of its capture k
+    // NOTES a buffer is meant to be reused, as filling it again keeps the capacity
+    //       contents are turned into string_view only when asked
+    class RegexMatchBuffer
+    {
+    public:
+        // offset of a capture that didn't participate in the match
+        static constexpr size_t npos = std::string_view::npos;
+
+        size_t Size() const
+        {
+            return begins_.size();
+        }
+
+        bool Empty() const
+        {
+            return begins_.empty();
+        }
+
+        // number of captures every match holds
+        size_t CaptureCount() const
+        {
+            return capture_count_;
+        }
+
+        std::string_view Subject() const
+        {
+            return subject_;
+        }
+
+        size_t Begin(size_t i) const
+        {
+            return begins_[i];
+        }
+
+        size_t End(size_t i) const
+        {
+            return ends_[i];
+        }
+
+        size_t CaptureBegin(size_t i, size_t id) const
+        {
+            return slots_[(i * capture_count_ + id) * 2];
+        }
+
+        size_t CaptureEnd(size_t i, size_t id) const
+        {
+            return slots_[(i * capture_count_ + id) * 2 + 1];
+        }
+
+        std::string_view Content(size_t i) const
+        {
+            return subject_.substr(begins_[i], ends_[i] - begins_[i]);
+        }
+
+        // an empty view with no data if the capture is not set, as in RegexMatch
+        std::string_view Capture(size_t i, size_t id) const
+        {
+            auto begin = CaptureBegin(i, id), end = CaptureEnd(i, id);
+            if (begin == npos || end == npos)
+            {
+                return {};
+            }
+
+            return subject_.substr(begin, end - begin);
+        }
+
+        void Clear()
+        {
+            begins_.clear();
+            ends_.clear();
+            slots_.clear();
+        }
+
+    private:
+        friend class RegexMatcher;
+
+        std::string_view subject_;
+        size_t capture_count_ = 0;
+
+        std::vector<size_t> begins_;
+        std::vector<size_t> ends_;
+        std::vector<size_t> slots_;     // capture_count_ * 2 for each match
+    };
+
+    // Receives output of Replace and Split piece by piece
+    class OutputSink
+    {
+    public:
+        virtual ~OutputSink() = default;
+
+        virtual void Append(std::string_view piece) = 0;
+    };
+
+    // Appends every piece to a string
+    class StringSink : public OutputSink
+    {
+    public:
+        StringSink(std::string& output)
+            : output_(output) { }
+
+        void Append(std::string_view piece) override
+        {
+            output_.append(piece);
+        }
+
+    private:
+        std::string& output_;
+    };
+
+    // A replacement string parsed once, where $0 refers to the whole match, $n to the n-th capture(id n - 1)
+    // and $$ to '$'
+    // NOTES a '$' followed by anything else stands for itself
+    //       a capture that is not set or doesn't exist expands to nothing
+    class ReplaceTemplate
+    {
+    public:
+        ReplaceTemplate(std::string_view text);
+
+        // appends the expansion for a match spanning [begin, end) of subject
+        // where slots are laid out as in RegexMatchBuffer
+        void Expand(std::string_view subject, size_t begin, size_t end,
+                    const size_t* slots, size_t capture_count, OutputSink& output) const;
+
+    private:
+        // a piece is either a literal of text_ or a reference to a capture
+        struct Piece
+        {
+            bool is_reference;
+            size_t offset;      // offset into text_, or the n of $n
+            size_t length;
+        };
+
+        std::string text_;
+        std::vector<Piece> pieces_;
+    };
+
+    // An Arrow-style column of strings
+    // the i-th string spans data[offsets[i], offsets[i+1])
+    struct StringColumn
+    {
+        const int32_t* offsets;     // length + 1 entries
+        const char* data;
+        size_t length;
+    };
+
+    // Bit i (least significant bit first) is set if the i-th string is selected
+    using SelectionBitmap = std::vector<uint8_t>;
+
+    // A line of MatchLines that has a match
+    struct LineMatch
+    {
+        size_t number;      // of the line, counting from 0
+        size_t begin;       // offsets of the line, without its line break
+        size_t end;
+    };
+
+    // Returns the first '\n' in [p, end), or end if there's none
+    // NOTE bytes are compared a vector at a time where SSE2 or AVX2 is available
+    const char* FindLineBreak(const char* p, const char* end);
+
+    struct ParallelOptions
+    {
+        size_t thread_count = 0;            // 0 to use hardware concurrency
+        size_t min_chunk_size = 1u << 16;   // a chunk is never smaller than this
+    };
+
+    class RegexMatchRange;
+
     class RegexMatcher : Uncopyable, Unmovable
     {
     public:
@@ -30,12 +209,281 @@ namespace yui
         RegexMatchOpt Search(std::string_view s) const;
         RegexMatchVec SearchAll(std::string_view s) const;
 
+        // Same matches as SearchAll(s), but stored into output, replacing its previous contents
+        // NOTE nothing is allocated once the buffer has grown large enough
+        void SearchAll(std::string_view s, RegexMatchBuffer& output) const;
+
+        // Same matches as SearchAll(s), but each is searched only when the iteration reaches it
+        // NOTE the matcher and the string must outlive the range
+        RegexMatchRange SearchLazy(std::string_view s) const;
+
+        // Appends s to output with the first match replaced by the expansion of replacement
+        void Replace(std::string_view s, const ReplaceTemplate& replacement, OutputSink& output) const;
+        std::string Replace(std::string_view s, const ReplaceTemplate& replacement) const;
+
+        // Same as Replace, but every match of SearchAll is replaced in a single scan
+        // NOTE text between matches is appended as a whole
+        void ReplaceAll(std::string_view s, const ReplaceTemplate& replacement, OutputSink& output) const;
+        std::string ReplaceAll(std::string_view s, const ReplaceTemplate& replacement) const;
+
+        // Appends fields of s separated by matches of SearchAll to output, one field for each Append
+        // NOTE there's always one field more than matches, so fields may be empty
+        void Split(std::string_view s, OutputSink& output) const;
+
+        // Tests if Search would find a match, stopping as soon as one is known to exist
+        bool IsMatch(std::string_view s) const;
+
+        // Same as SearchAll(s).size(), but matches are not built
+        size_t CountMatches(std::string_view s) const;
+
+        // Tests Match against every string in the column
+        SelectionBitmap MatchColumn(const StringColumn& column) const;
+
+        // Same results as SearchAll, but the input is split into chunks scanned by multiple threads
+        // NOTE matchers that don't support parallel scan simply run SearchAll
+        RegexMatchVec SearchAllParallel(std::string_view s, const ParallelOptions& options = {}) const;
+        size_t CountAllParallel(std::string_view s, const ParallelOptions& options = {}) const;
+
+        // Tests Match against every input, spread over workers of WorkStealingPool::Shared()
+        // Bit i of the result is set if the i-th input matches, as in MatchColumn
+        // NOTES inputs are grouped into tasks of about the same size, so that neither many small inputs
+        //       nor a few huge ones leave workers idle, see ParallelOptions for the limits
+        //       results are in the order of inputs whatever the scheduling
+        SelectionBitmap MatchBatch(const std::vector<std::string_view>& inputs, const ParallelOptions& options = {}) const;
+
+        // Same as Search for every input, scheduled as MatchBatch
+        std::vector<RegexMatchOpt> SearchBatch(const std::vector<std::string_view>& inputs, const ParallelOptions& options = {}) const;
+
+        // Tests every line of s, which are split at '\n', and stores those with a match into output in order
+        // returns the number of lines scanned, where a line break ends a line rather than starts one
+        // NOTES each line is tested as a string of its own, so anchors see its ends as line breaks
+        //       and no automaton ever runs across a line break
+        //       unlike Search, an empty match selects a line as grep does, so ^$ selects empty lines
+        //       a line is done as soon as it's known to have a match, which is not located
+        //       scanning stops once max_count lines are stored
+        size_t MatchLines(std::string_view s, std::vector<LineMatch>& output, size_t max_count = std::string_view::npos) const;
+
+        // Same as the size of output of MatchLines, but lines are not stored
+        size_t CountMatchingLines(std::string_view s) const;
+
+        // Statistics collected since construction or the last ResetStats, see regex-stats.h
+        // NOTE they're all zero unless YUI_ENABLE_STATS is defined
+        MatcherStatsSnapshot Stats() const;
+        void ResetStats() const;
+
     protected:
+#if defined(YUI_ENABLE_STATS)
+        MatcherStats& StatsSink() const
+        {
+            return *stats_;
+        }
+#endif
+
         // NOTE SerachInternal is an fundamental operation
         // which is implemented differently by each derived matcher
-        virtual RegexMatchOpt SerachInternal(std::string_view view, bool allow_substr) const = 0;
+        // it looks for a match starting at or after offset, bytes before which are only seen by anchors
+        virtual RegexMatchOpt SerachInternal(std::string_view view, size_t offset, bool allow_substr) const = 0;
+
+        // finds the same match as SerachInternal, but only where it spans [begin, end)
+        // NOTE overrides are expected to skip capture bookkeeping and never allocate
+        virtual bool LocateInternal(std::string_view view, size_t offset, bool allow_substr, size_t& begin, size_t& end) const;
+
+        // tests if there's any match in view, by default via LocateInternal
+        virtual bool TestInternal(std::string_view view) const;
+
+        // tests if there's any match in a line for MatchLines, including an empty one at any position
+        // of the line, its end and an empty line too, which the other calls never report
+        // NOTE by default it's TestInternal, so a matcher that may accept an empty string overrides it
+        virtual bool TestLineInternal(std::string_view line) const { return TestInternal(line); }
+
+        // number of captures a match of this matcher holds
+        virtual size_t CaptureCount() const { return 0; }
+
+        // finds the same match as SerachInternal, and writes offsets of its captures into slots
+        // NOTES slots has room for CaptureCount() * 2 offsets, which are npos for captures not set
+        //       by default it goes via LocateInternal if there's no capture, or SerachInternal otherwise
+        virtual bool LocateCapturesInternal(std::string_view view, size_t offset, bool allow_substr,
+                                            size_t& begin, size_t& end, size_t* slots) const;
+
+        // selection is zero-filled and large enough for the column
+        // by default, strings are tested one by one via Match
+        virtual void MatchColumnInternal(const StringColumn& column, SelectionBitmap& selection) const;
+
+        // a matcher supports parallel scan if a match starting at a position
+        // depends on nothing but the view and that position
+        virtual bool SupportParallelScan() const { return false; }
+
+    private:
+        friend class RegexMatchIterator;
+
+        // finds the next match of SearchAll from offset, which is moved past the match
+        RegexMatchOpt SearchNext(std::string_view s, size_t& offset) const;
+
+        // same as SearchNext, but the match is located via LocateCapturesInternal
+        bool LocateNext(std::string_view s, size_t& offset, size_t& begin, size_t& end, size_t* slots) const;
+
+        // the walk of Replace and ReplaceAll, which stops after max_count matches
+        void ReplaceInternal(std::string_view s, const ReplaceTemplate& replacement, size_t max_count, OutputSink& output) const;
+
+        // scans for matches starting in [pos, end) as SearchAll does, appending offsets of each to spans
+        // and the match itself to output if given, so that no match is built for those who only count
+        // returns the position where the scan stops, which is end or the end of a match across it
+        size_t ScanRange(std::string_view s, size_t pos, size_t end,
+                         std::vector<std::pair<size_t, size_t>>& spans, RegexMatchVec* output) const;
+
+        // the walk of SearchAllParallel and CountAllParallel, where matches are stored into output if given
+        // returns the number of matches
+        size_t ScanParallel(std::string_view s, const ParallelOptions& options, RegexMatchVec* output) const;
+
+        // runs handler for lines of s with a match as MatchLines finds them, up to max_count of them
+        // returns the number of lines scanned
+        size_t ScanLines(std::string_view s, size_t max_count, const std::function<void(const LineMatch&)>& handler) const;
+
+        // runs handler(begin, end) for ranges of inputs that together cover all of them on a pool
+        // NOTE a range is closed as soon as it costs enough, so adjacent inputs may be handled by different workers
+        void RunBatch(const std::vector<std::string_view>& inputs, const ParallelOptions& options,
+                      const std::function<void(size_t begin, size_t end)>& handler) const;
+
+#if defined(YUI_ENABLE_STATS)
+        std::unique_ptr<MatcherStats> stats_ = std::make_unique<MatcherStats>();
+#endif
+    };
+
+    // An input iterator over matches of SearchLazy, the end iterator holds no match
+    class RegexMatchIterator
+    {
+    public:
+        using iterator_category = std::input_iterator_tag;
+        using value_type = RegexMatch;
+        using difference_type = std::ptrdiff_t;
+        using pointer = const RegexMatch*;
+        using reference = const RegexMatch&;
+
+        RegexMatchIterator() = default;
+        RegexMatchIterator(const RegexMatcher* matcher, std::string_view s)
+            : matcher_(matcher), subject_(s)
+        {
+            ++*this;
+        }
+
+        reference operator*() const { return *current_; }
+        pointer operator->() const { return &*current_; }
+
+        RegexMatchIterator& operator++()
+        {
+            current_ = matcher_->SearchNext(subject_, offset_);
+            return *this;
+        }
+
+        // NOTE the old position cannot be resumed, as with any input iterator
+        RegexMatchIterator operator++(int)
+        {
+            auto old = *this;
+            ++*this;
+            return old;
+        }
+
+        // iterators are only compared against the end of their own range
+        bool operator==(const RegexMatchIterator& other) const
+        {
+            return current_.has_value() == other.current_.has_value()
+                && (!current_.has_value() || offset_ == other.offset_);
+        }
+
+        bool operator!=(const RegexMatchIterator& other) const
+        {
+            return !(*this == other);
+        }
+
+    private:
+        const RegexMatcher* matcher_ = nullptr;
+        std::string_view subject_;
+        size_t offset_ = 0;             // where the next search starts
+        RegexMatchOpt current_;
+    };
+
+    class RegexMatchRange
+    {
+    public:
+        RegexMatchRange(const RegexMatcher* matcher, std::string_view s)
+            : matcher_(matcher), subject_(s) { }
+
+        // NOTE every call starts the scan over
+        RegexMatchIterator begin() const
+        {
+            return RegexMatchIterator{ matcher_, subject_ };
+        }
+
+        RegexMatchIterator end() const
+        {
+            return RegexMatchIterator{};
+        }
+
+    private:
+        const RegexMatcher* matcher_;
+        std::string_view subject_;
     };
 
     RegexMatcher::Ptr CreateDfaMatcher(DfaAutomaton::Ptr dfa);
+
+    // Compiles the DFA into native code, see regex-jit.h
+    // NOTE it falls back to a DfaMatcher if the automaton cannot be compiled
+    RegexMatcher::Ptr CreateJitMatcher(DfaAutomaton::Ptr dfa);
+
+    // Extracts captures in a single pass, see GenerateOnePassDfa
+    // NOTE like a DfaMatcher, it takes the longest match at the leftmost position
+    RegexMatcher::Ptr CreateOnePassMatcher(OnePassAutomaton::Ptr atm);
+
+    // Extracts captures of patterns that are not one-pass, see regex-tdfa.h
+    RegexMatcher::Ptr CreateTaggedDfaMatcher(TaggedDfaAutomaton::Ptr atm);
+
+    // Finds matches by backtracking, which supports every kind of transition
+    // NOTE it takes an epsilon-free automaton that is SimulationCompatible, e.g. EliminateEpsilon of a Thompson NFA
     RegexMatcher::Ptr CreateNfaMatcher(NfaAutomaton::Ptr nfa);
+
+    // Matches as a DfaMatcher does, but with states built on demand, see regex-lazy-dfa.h
+    // NOTE threads sharing the matcher share the states built as well
+    RegexMatcher::Ptr CreateLazyDfaMatcher(LazyDfaAutomaton::Ptr atm);
+
+    // budget of determinization in CreateMatcher, a DFA of which takes 10MB at most
+    static constexpr size_t kDefaultDfaStateLimit = 10000;
+
+    // What compiling a pattern took, phase by phase
+    // NOTES phases that are not run are left zero, e.g. epsilon elimination when a DFA is built
+    //       measuring takes a clock read per phase and a walk over each NFA, so it's fine to leave on
+    struct CompileReport
+    {
+        // wall time of each phase
+        std::chrono::nanoseconds construct_time{};     // RegexFactoryBase::Generate, i.e. Construct and Simplify
+        std::chrono::nanoseconds connect_time{};       // ConnectNfa
+        std::chrono::nanoseconds eliminate_time{};     // EliminateEpsilon
+        std::chrono::nanoseconds determinize_time{};   // GenerateDfa, which evaluates the NFA on its own
+
+        NfaSize nfa_size = {};              // the NFA given
+        NfaSize simulated_size = {};        // the NFA simulated after elimination
+        size_t dfa_state_count = 0;         // 0 if there's no DFA, or it's out of budget
+        size_t table_bytes = 0;             // the DFA jumptable and acceptance lookup
+        size_t arena_bytes = 0;             // expression tree and NFAs, see Arena::AllocatedBytes
+
+        bool dfa_out_of_budget = false;     // determinization stopped at dfa_state_limit
+
+        std::chrono::nanoseconds TotalTime() const
+        {
+            return construct_time + connect_time + eliminate_time + determinize_time;
+        }
+    };
+
+    // Picks an engine for the NFA, which is a DfaMatcher if the NFA is DFA compatible
+    // and its DFA fits in dfa_state_limit, or a NfaMatcher otherwise
+    // NOTES an NFA that is not SimulationCompatible or is Simplified is never simulated, a lazy DFA is taken instead
+    //       and nullptr is returned if it's not DFA compatible either
+    //       phases it runs are written into report if given
+    RegexMatcher::Ptr CreateMatcher(const NfaAutomaton& nfa, size_t dfa_state_limit = kDefaultDfaStateLimit,
+                                    CompileReport* report = nullptr);
+
+    class RegexFactoryBase;
+
+    // Generates the expression from factory, builds its NFA and picks an engine as CreateMatcher does
+    RegexMatcher::Ptr CompileRegex(RegexFactoryBase& factory, size_t dfa_state_limit = kDefaultDfaStateLimit,
+                                   CompileReport* report = nullptr);
 }
\ No newline at end of file
@@ -0,0 +1,569 @@
+#include "regex-parser.h"
+#include "regex-factory.h"
+
+using namespace std;
+
+namespace yui
+{
+    // A recursive descent parser, each level of which builds its expression with the factory
+    // NOTE once it fails, every level returns nullptr up to Construct
+    class RegexParser : public RegexFactoryBase
+    {
+    public:
+        RegexParser(string_view pattern, bool captures)
+            : pattern_(pattern), captures_(captures) { }
+
+        bool Failed() const
+        {
+            return !error_.empty();
+        }
+
+        const string& Error() const
+        {
+            return error_;
+        }
+
+        bool HasReference() const
+        {
+            return has_reference_;
+        }
+
+    protected:
+        RegexExpr* Construct() override
+        {
+            auto result = ParseAlternation();
+            if (result != nullptr && !AtEnd())
+            {
+                // an alternation stops at nothing else
+                result = Fail("unmatched ')'");
+            }
+
+            // the factory needs a tree anyway, which is thrown away
+            return result != nullptr ? result : Concat({});
+        }
+
+    private:
+        bool AtEnd() const
+        {
+            return pos_ >= pattern_.size();
+        }
+
+        int Peek(size_t ahead = 0) const
+        {
+            return pos_ + ahead < pattern_.size() ? static_cast<unsigned char>(pattern_[pos_ + ahead]) : -1;
+        }
+
+        bool TryConsume(char ch)
+        {
+            if (Peek() == static_cast<unsigned char>(ch))
+            {
+                pos_ += 1;
+                return true;
+            }
+
+            return false;
+        }
+
+        RegexExpr* Fail(const char* message)
+        {
+            if (!Failed())
+            {
+                error_ = string{ message } + " at offset " + to_string(pos_);
+            }
+
+            return nullptr;
+        }
+
+        // a|b|...
+        RegexExpr* ParseAlternation()
+        {
+            RegexExprVec any;
+            do
+            {
+                auto seq = ParseSequence();
+                if (seq == nullptr)
+                {
+                    return nullptr;
+                }
+
+                any.push_back(seq);
+            } while (TryConsume('|'));
+
+            return any.size() == 1 ? any.front() : Alter(any);
+        }
+
+        // quantified atoms up to '|', ')' or the end
+        RegexExpr* ParseSequence()
+        {
+            RegexExprVec seq;
+            while (!AtEnd() && Peek() != '|' && Peek() != ')')
+            {
+                auto item = ParseQuantified();
+                if (item == nullptr)
+                {
+                    return nullptr;
+                }
+
+                seq.push_back(item);
+            }
+
+            return seq.size() == 1 ? seq.front() : Concat(seq);
+        }
+
+        RegexExpr* ParseQuantified()
+        {
+            if (LooksLikeQuantifier())
+            {
+                return Fail("nothing to repeat");
+            }
+
+            auto atom = ParseAtom();
+            if (atom == nullptr || !LooksLikeQuantifier())
+            {
+                return atom;
+            }
+
+            size_t min = 0, max = 0;
+            auto infinite = false;
+            switch (Peek())
+            {
+            case '*':
+                pos_ += 1;
+                infinite = true;
+                break;
+            case '+':
+                pos_ += 1;
+                min = 1;
+                infinite = true;
+                break;
+            case '?':
+                pos_ += 1;
+                max = 1;
+                break;
+            default:
+                if (!ParseCounter(min, max, infinite))
+                {
+                    return nullptr;
+                }
+                break;
+            }
+
+            auto strategy = TryConsume('?') ? ClosureStrategy::Reluctant : ClosureStrategy::Greedy;
+            if (LooksLikeQuantifier())
+            {
+                return Fail("nothing to repeat");
+            }
+
+            if (infinite)
+            {
+                return Repeat(atom, Repetition{ min }, strategy);
+            }
+            else if (max == 0)
+            {
+                // x{0} matches nothing but the empty string
+                return Concat({});
+            }
+
+            return Repeat(atom, Repetition{ min, max }, strategy);
+        }
+
+        // NOTE a '{' that doesn't start a valid counter is a literal
+        bool LooksLikeQuantifier() const
+        {
+            switch (Peek())
+            {
+            case '*':
+            case '+':
+            case '?':
+                return true;
+            case '{':
+                return IsDigit(Peek(1));
+            default:
+                return false;
+            }
+        }
+
+        // {n}, {n,} or {n,m}
+        bool ParseCounter(size_t& min, size_t& max, bool& infinite)
+        {
+            pos_ += 1;
+            if (!ParseNumber(min))
+            {
+                return false;
+            }
+
+            max = min;
+            if (TryConsume(','))
+            {
+                if (IsDigit(Peek()))
+                {
+                    if (!ParseNumber(max))
+                    {
+                        return false;
+                    }
+                }
+                else
+                {
+                    infinite = true;
+                }
+            }
+
+            if (!TryConsume('}'))
+            {
+                Fail("missing '}'");
+                return false;
+            }
+
+            if (!infinite && min > max)
+            {
+                Fail("counter out of order");
+                return false;
+            }
+
+            return true;
+        }
+
+        // NOTE larger counts would be taken as infinity by Repetition
+        bool ParseNumber(size_t& value)
+        {
+            value = 0;
+            while (IsDigit(Peek()))
+            {
+                value = value * 10 + (Peek() - '0');
+                pos_ += 1;
+
+                if (value > Repetition::kInfinityThreshold)
+                {
+                    Fail("counter too large");
+                    return false;
+                }
+            }
+
+            return true;
+        }
+
+        RegexExpr* ParseAtom()
+        {
+            auto ch = Peek();
+            pos_ += 1;
+
+            switch (ch)
+            {
+            case '(':
+                return ParseGroup();
+            case '[':
+                return ParseBracket();
+            case '.':
+                return Class(CharClass{ { 0, '\n' - 1 }, { '\n' + 1, 255 } });
+            case '^':
+                return Anchor(AnchorType::LineStart);
+            case '$':
+                return Anchor(AnchorType::LineBreak);
+            case '\\':
+                return ParseEscape();
+            default:
+                return Char(ch);
+            }
+        }
+
+        // after the '('
+        RegexExpr* ParseGroup()
+        {
+            RegexExpr* result = nullptr;
+            if (TryConsume('?'))
+            {
+                if (TryConsume(':'))
+                {
+                    result = ParseAlternation();
+                }
+                else if (Peek() == '=' || Peek() == '!')
+                {
+                    auto type = Peek() == '=' ? AssertionType::Positive : AssertionType::Negative;
+                    pos_ += 1;
+
+                    // the body is compiled into a DFA, see AssertionExpr
+                    auto irregular_count = irregular_count_;
+                    auto body = ParseAlternation();
+                    if (body != nullptr && irregular_count_ != irregular_count)
+                    {
+                        return Fail("lookahead with captures, references or assertions");
+                    }
+
+                    result = body != nullptr ? Assertion(type, body) : nullptr;
+                    irregular_count_ += 1;
+                }
+                else
+                {
+                    return Fail("unknown group");
+                }
+            }
+            else
+            {
+                if (capture_count_ >= kMaxCaptureCount)
+                {
+                    return Fail("too many captures");
+                }
+
+                // numbered before its body, so that nested captures come after it
+                auto id = capture_count_++;
+                auto body = ParseAlternation();
+                if (body != nullptr && captures_)
+                {
+                    result = Capture(id, body);
+                    irregular_count_ += 1;
+                }
+                else
+                {
+                    result = body;
+                }
+            }
+
+            if (result != nullptr && !TryConsume(')'))
+            {
+                return Fail("missing ')'");
+            }
+
+            return result;
+        }
+
+        // after the '\'
+        RegexExpr* ParseEscape()
+        {
+            auto ch = Peek();
+            if (ch == 'b')
+            {
+                pos_ += 1;
+                return Anchor(AnchorType::WordBoundary);
+            }
+            else if (ch >= '1' && ch <= '9')
+            {
+                pos_ += 1;
+
+                auto id = static_cast<unsigned>(ch - '1');
+                if (id >= capture_count_)
+                {
+                    return Fail("reference to an undefined capture");
+                }
+
+                has_reference_ = true;
+                irregular_count_ += 1;
+                return Reference(id);
+            }
+
+            CharClass cls;
+            return ParseClassEscape(cls) ? Class(cls) : nullptr;
+        }
+
+        // after the '['
+        RegexExpr* ParseBracket()
+        {
+            auto negated = TryConsume('^');
+
+            CharClass cls;
+            auto first = true;
+            while (first || Peek() != ']')
+            {
+                if (AtEnd())
+                {
+                    return Fail("missing ']'");
+                }
+
+                // a ']' right after the '[' is a literal
+                first = false;
+
+                int low;
+                if (!ParseBracketItem(cls, low))
+                {
+                    return nullptr;
+                }
+
+                // a '-' before the ']' is a literal
+                if (low < 0 || Peek() != '-' || Peek(1) == ']' || Peek(1) < 0)
+                {
+                    continue;
+                }
+
+                pos_ += 1;
+
+                int high;
+                if (!ParseBracketItem(cls, high))
+                {
+                    return nullptr;
+                }
+                else if (high < 0)
+                {
+                    return Fail("class in a range");
+                }
+                else if (low > high)
+                {
+                    return Fail("range out of order");
+                }
+
+                cls.AddRange(CharRange{ low, high });
+            }
+
+            pos_ += 1;
+
+            if (negated)
+            {
+                cls = cls.Negate();
+            }
+
+            if (cls.Empty())
+            {
+                return Fail("class matching nothing");
+            }
+
+            return Class(cls);
+        }
+
+        // adds a byte or an escaped class to cls
+        // where byte is the byte added, or -1 if it's a class
+        bool ParseBracketItem(CharClass& cls, int& byte)
+        {
+            if (!TryConsume('\\'))
+            {
+                byte = Peek();
+                pos_ += 1;
+
+                cls.AddRange(CharRange{ byte, byte });
+                return true;
+            }
+
+            CharClass item;
+            if (!ParseClassEscape(item))
+            {
+                return false;
+            }
+
+            auto ranges = item.Ranges();
+            byte = ranges.size() == 1 && ranges.front().Min() == ranges.front().Max() ? ranges.front().Min() : -1;
+
+            cls = cls.Union(item);
+            return true;
+        }
+
+        // escapes after the '\' that stand for a set of bytes, which are the same inside brackets
+        bool ParseClassEscape(CharClass& cls)
+        {
+            static const CharClass kDigit{ { '0', '9' } };
+            static const CharClass kWord{ { '0', '9' }, { 'A', 'Z' }, { '_', '_' }, { 'a', 'z' } };
+            static const CharClass kSpace{ { '\t', '\r' }, { ' ', ' ' } };
+
+            if (AtEnd())
+            {
+                Fail("trailing '\\'");
+                return false;
+            }
+
+            auto ch = Peek();
+            pos_ += 1;
+
+            switch (ch)
+            {
+            case 'd': cls = kDigit; return true;
+            case 'D': cls = kDigit.Negate(); return true;
+            case 'w': cls = kWord; return true;
+            case 'W': cls = kWord.Negate(); return true;
+            case 's': cls = kSpace; return true;
+            case 'S': cls = kSpace.Negate(); return true;
+            case 'n': ch = '\n'; break;
+            case 'r': ch = '\r'; break;
+            case 't': ch = '\t'; break;
+            case 'f': ch = '\f'; break;
+            case 'v': ch = '\v'; break;
+            case '0': ch = 0; break;
+            case 'x':
+            {
+                auto high = HexValue(Peek()), low = HexValue(Peek(1));
+                if (high < 0 || low < 0)
+                {
+                    Fail("malformed '\\x'");
+                    return false;
+                }
+
+                pos_ += 2;
+                ch = high * 16 + low;
+                break;
+            }
+            default:
+                // letters and digits are kept for escapes to come
+                if (IsDigit(ch) || (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z'))
+                {
+                    pos_ -= 1;
+                    Fail("unknown escape");
+                    return false;
+                }
+                break;
+            }
+
+            cls = CharClass{ { ch, ch } };
+            return true;
+        }
+
+        static bool IsDigit(int ch)
+        {
+            return ch >= '0' && ch <= '9';
+        }
+
+        static int HexValue(int ch)
+        {
+            if (IsDigit(ch))
+            {
+                return ch - '0';
+            }
+            else if (ch >= 'a' && ch <= 'f')
+            {
+                return ch - 'a' + 10;
+            }
+            else if (ch >= 'A' && ch <= 'F')
+            {
+                return ch - 'A' + 10;
+            }
+
+            return -1;
+        }
+
+    private:
+        // as RegexFactoryBase::Capture takes
+        static constexpr unsigned kMaxCaptureCount = 1000;
+
+        string_view pattern_;
+        bool captures_;
+        size_t pos_ = 0;
+
+        unsigned capture_count_ = 0;
+        unsigned irregular_count_ = 0;      // captures, references and assertions built so far
+        bool has_reference_ = false;
+        string error_;
+    };
+
+    // Implementation of ParseRegex
+    //
+
+    ManagedRegex::Ptr ParseRegex(string_view pattern, string* error, bool captures)
+    {
+        // references are only known once parsed, so groups capture in the first pass anyway
+        RegexParser parser{ pattern, true };
+
+        auto regex = parser.Generate();
+        if (parser.Failed())
+        {
+            if (error != nullptr)
+            {
+                *error = parser.Error();
+            }
+
+            return nullptr;
+        }
+
+        if (!captures && !parser.HasReference())
+        {
+            // it parsed once, so it never fails this time
+            RegexParser plain{ pattern, false };
+            regex = plain.Generate();
+        }
+
+        return regex;
+    }
+}
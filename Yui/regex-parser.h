@@ -0,0 +1,30 @@
+// Provides a parser of the common text syntax of regular expressions, built on RegexFactoryBase
+//
+// Syntax accepted:
+//   literals         a  \.  \\  \n  \r  \t  \f  \v  \0  \xHH
+//   classes          .  [abc]  [^a-z]  \d  \D  \w  \W  \s  \S, the escapes also work inside brackets
+//   anchors          ^  $  \b
+//   groups           (...) is a capture, (?:...) is not
+//   lookahead        (?=...)  (?!...)
+//   references       \1 to \9
+//   quantifiers      *  +  ?  {n}  {n,}  {n,m}, followed by ? to be reluctant
+//   alternation      a|b, either side of which may be empty
+//
+// NOTES it works on bytes, a multi-byte UTF-8 character is taken as a sequence of literals
+//       '.' matches any byte but '\n'
+//       captures are numbered from 0 in order of their '(', and \n refers to capture n - 1
+//       as $n does in ReplaceTemplate
+
+#pragma once
+#include "regex-expr.h"
+#include <string>
+#include <string_view>
+
+namespace yui
+{
+    // Builds the expression of pattern
+    // returns nullptr if it's malformed, with the reason written into error if given
+    // NOTE without captures, groups don't capture unless the pattern has references that need them,
+    //      which leaves more patterns DFA compatible for those who only test or locate matches
+    ManagedRegex::Ptr ParseRegex(std::string_view pattern, std::string* error = nullptr, bool captures = true);
+}
@@ -0,0 +1,165 @@
+#include "regex-stats.h"
+#include <algorithm>
+#include <limits>
+
+using namespace std;
+
+namespace yui
+{
+    // Implementation of LatencyHistogram
+    //
+
+    size_t LatencyHistogram::BucketOf(uint64_t value)
+    {
+        if (value < kSubBucketCount)
+        {
+            return static_cast<size_t>(value);
+        }
+
+        // position of the highest bit set
+        size_t exponent = 0;
+        while ((value >> exponent) > 1)
+        {
+            ++exponent;
+        }
+
+        if (exponent > kMaxExponent)
+        {
+            return kBucketCount - 1;
+        }
+
+        // bits right below the highest one tell the bucket within its power of 2
+        auto sub_bucket = static_cast<size_t>(value >> (exponent - kSubBucketBits)) - kSubBucketCount;
+        return (exponent - kSubBucketBits + 1) * kSubBucketCount + sub_bucket;
+    }
+
+    uint64_t LatencyHistogram::BucketLowerBound(size_t bucket)
+    {
+        auto group = bucket / kSubBucketCount;
+        auto sub_bucket = bucket % kSubBucketCount;
+        if (group == 0)
+        {
+            return sub_bucket;
+        }
+
+        return static_cast<uint64_t>(kSubBucketCount + sub_bucket) << (group - 1);
+    }
+
+    void LatencyHistogram::Merge(const LatencyHistogram& other)
+    {
+        for (size_t i = 0; i < kBucketCount; ++i)
+        {
+            buckets_[i] += other.buckets_[i];
+        }
+
+        total_count_ += other.total_count_;
+    }
+
+    uint64_t LatencyHistogram::ValueAtQuantile(double quantile) const
+    {
+        if (total_count_ == 0)
+        {
+            return 0;
+        }
+
+        // the rank of the sample wanted, counting from 1
+        auto rank = static_cast<uint64_t>(clamp(quantile, 0.0, 1.0) * total_count_);
+        rank = max<uint64_t>(rank, 1);
+
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBucketCount; ++i)
+        {
+            seen += buckets_[i];
+            if (seen >= rank)
+            {
+                return i + 1 < kBucketCount ? BucketLowerBound(i + 1) - 1 : numeric_limits<uint64_t>::max();
+            }
+        }
+
+        return numeric_limits<uint64_t>::max();
+    }
+
+    // Implementation of MatcherStats
+    //
+
+    MatcherStatsSnapshot MatcherStats::Snapshot() const
+    {
+        MatcherStatsSnapshot result;
+        for (const auto& shard : shards_)
+        {
+            for (size_t i = 0; i < kMatcherCounterCount; ++i)
+            {
+                result.counters[i] += shard.counters[i].load(memory_order_relaxed);
+            }
+
+            for (size_t call = 0; call < kMatcherCallCount; ++call)
+            {
+                for (size_t bucket = 0; bucket < LatencyHistogram::kBucketCount; ++bucket)
+                {
+                    auto count = shard.latencies[call][bucket].load(memory_order_relaxed);
+                    if (count != 0)
+                    {
+                        result.latencies[call].Record(LatencyHistogram::BucketLowerBound(bucket), count);
+                    }
+                }
+            }
+        }
+
+        return result;
+    }
+
+    void MatcherStats::Reset()
+    {
+        for (auto& shard : shards_)
+        {
+            for (auto& counter : shard.counters)
+            {
+                counter.store(0, memory_order_relaxed);
+            }
+
+            for (auto& histogram : shard.latencies)
+            {
+                for (auto& bucket : histogram)
+                {
+                    bucket.store(0, memory_order_relaxed);
+                }
+            }
+        }
+    }
+
+    MatcherStats::Shard& MatcherStats::CurrentShard()
+    {
+        // threads take shards in turn
+        static atomic<size_t> next_shard{ 0 };
+        thread_local size_t shard = next_shard.fetch_add(1, memory_order_relaxed) % kShardCount;
+
+        return shards_[shard];
+    }
+
+    // Implementation of CallTimer
+    //
+
+    // depth of calls being timed on this thread
+    static thread_local size_t call_depth = 0;
+
+    CallTimer::CallTimer(MatcherStats& stats, MatcherCall call, size_t input_length)
+        : stats_(stats), call_(call), outermost_(call_depth == 0)
+    {
+        ++call_depth;
+        if (outermost_)
+        {
+            stats_.Add(MatcherCounter::BytesScanned, input_length);
+            start_ = chrono::steady_clock::now();
+        }
+    }
+
+    CallTimer::~CallTimer()
+    {
+        --call_depth;
+        if (outermost_)
+        {
+            auto elapsed = chrono::steady_clock::now() - start_;
+            stats_.RecordLatency(call_, static_cast<uint64_t>(chrono::duration_cast<chrono::nanoseconds>(elapsed).count()));
+        }
+    }
+}
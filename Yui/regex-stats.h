@@ -0,0 +1,211 @@
+// Provides runtime statistics of matchers, which are only collected if YUI_ENABLE_STATS is defined
+
+#pragma once
+#include "class-utils.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+
+namespace yui
+{
+    enum class MatcherCounter
+    {
+        BytesScanned,       // length of inputs given to calls
+        StartsTried,        // start positions tried by searches
+        DfaTransitions,     // transitions taken by DFA, one-pass DFA and TDFA matchers
+        RoutesPushed,       // routes pushed by the NFA backtracker
+        RoutesPopped,       // routes popped by the NFA backtracker
+        Backtracks,         // dead ends where the NFA backtracker resumes an older route
+        CapturePops,        // capture buffer items dropped on backtracking
+    };
+
+    static constexpr size_t kMatcherCounterCount = 7;
+
+    // public operations of RegexMatcher whose latency is recorded
+    // NOTE a call made inside another one is accounted to the outer one
+    enum class MatcherCall
+    {
+        Match,
+        Search,
+        SearchAll,
+        Replace,
+        ReplaceAll,
+        Split,
+        IsMatch,
+        CountMatches,
+        MatchColumn,
+        SearchAllParallel,
+        MatchBatch,
+        SearchBatch,
+        MatchLines,
+        CountMatchingLines,
+    };
+
+    static constexpr size_t kMatcherCallCount = 14;
+
+    // A histogram of latencies in nanoseconds, with buckets in HDR style:
+    // values below 8 have a bucket each, and every power of 2 above is split into 8 buckets of equal width,
+    // so a value is told within 12.5% of its magnitude
+    // NOTE values of 2^(kMaxExponent+1) ns(about 36 minutes) or more fall into the last bucket
+    class LatencyHistogram
+    {
+    public:
+        static constexpr size_t kSubBucketBits = 3;
+        static constexpr size_t kSubBucketCount = 1u << kSubBucketBits;
+        static constexpr size_t kMaxExponent = 40;
+        static constexpr size_t kBucketCount = (kMaxExponent - kSubBucketBits + 2) * kSubBucketCount;
+
+        static size_t BucketOf(uint64_t value);
+
+        // the smallest value of a bucket
+        static uint64_t BucketLowerBound(size_t bucket);
+
+        void Record(uint64_t value, uint64_t count = 1)
+        {
+            buckets_[BucketOf(value)] += count;
+            total_count_ += count;
+        }
+
+        void Merge(const LatencyHistogram& other);
+
+        uint64_t TotalCount() const
+        {
+            return total_count_;
+        }
+
+        uint64_t BucketCount(size_t bucket) const
+        {
+            return buckets_[bucket];
+        }
+
+        // the largest value of the bucket in which the given fraction of samples are reached, e.g. 0.99 for p99
+        // or 0 if there's no sample
+        uint64_t ValueAtQuantile(double quantile) const;
+
+    private:
+        std::array<uint64_t, kBucketCount> buckets_ = {};
+        uint64_t total_count_ = 0;
+    };
+
+    struct MatcherStatsSnapshot
+    {
+        std::array<uint64_t, kMatcherCounterCount> counters = {};
+        std::array<LatencyHistogram, kMatcherCallCount> latencies;
+
+        uint64_t Counter(MatcherCounter counter) const
+        {
+            return counters[static_cast<size_t>(counter)];
+        }
+
+        const LatencyHistogram& Latency(MatcherCall call) const
+        {
+            return latencies[static_cast<size_t>(call)];
+        }
+    };
+
+    // Statistics of a matcher, sharded so that threads seldom touch the same cache line
+    // NOTE every thread picks a shard once, and counters are added with relaxed atomics
+    class MatcherStats : Uncopyable, Unmovable
+    {
+    public:
+        MatcherStats()
+        {
+            Reset();
+        }
+
+        void Add(MatcherCounter counter, uint64_t value)
+        {
+            CurrentShard().counters[static_cast<size_t>(counter)].fetch_add(value, std::memory_order_relaxed);
+        }
+
+        void RecordLatency(MatcherCall call, uint64_t nanoseconds)
+        {
+            auto bucket = LatencyHistogram::BucketOf(nanoseconds);
+            CurrentShard().latencies[static_cast<size_t>(call)][bucket].fetch_add(1, std::memory_order_relaxed);
+        }
+
+        // sums up all shards
+        // NOTE calls in progress may be partly counted
+        MatcherStatsSnapshot Snapshot() const;
+
+        void Reset();
+
+    private:
+        static constexpr size_t kShardCount = 8;
+
+        struct alignas(64) Shard
+        {
+            std::array<std::atomic<uint64_t>, kMatcherCounterCount> counters;
+            std::array<std::array<std::atomic<uint64_t>, LatencyHistogram::kBucketCount>, kMatcherCallCount> latencies;
+        };
+
+        Shard& CurrentShard();
+
+    private:
+        std::array<Shard, kShardCount> shards_;
+    };
+
+    // Counts of a single call, which are added to MatcherStats at once when it goes out of scope
+    // so that loops of matchers count with plain additions
+    class StatsTally : Uncopyable, Unmovable
+    {
+    public:
+        StatsTally(MatcherStats& stats)
+            : stats_(stats) { }
+
+        ~StatsTally()
+        {
+            for (size_t i = 0; i < kMatcherCounterCount; ++i)
+            {
+                if (counts_[i] != 0)
+                {
+                    stats_.Add(static_cast<MatcherCounter>(i), counts_[i]);
+                }
+            }
+        }
+
+        void Add(MatcherCounter counter, uint64_t value)
+        {
+            counts_[static_cast<size_t>(counter)] += value;
+        }
+
+    private:
+        MatcherStats& stats_;
+        std::array<uint64_t, kMatcherCounterCount> counts_ = {};
+    };
+
+    // Records latency of a public call of a matcher, along with the length of its input
+    // NOTE only the outermost call on a thread is recorded
+    class CallTimer : Uncopyable, Unmovable
+    {
+    public:
+        CallTimer(MatcherStats& stats, MatcherCall call, size_t input_length);
+        ~CallTimer();
+
+    private:
+        MatcherStats& stats_;
+        MatcherCall call_;
+        bool outermost_;
+        std::chrono::steady_clock::time_point start_;
+    };
+}
+
+// Macros to collect statistics, which expand to nothing unless YUI_ENABLE_STATS is defined
+// NOTES arguments are not evaluated when statistics are disabled
+//       YUI_STATS_PARAM and YUI_STATS_ARG append a parameter to helpers that count on behalf of a matcher
+#if defined(YUI_ENABLE_STATS)
+#define YUI_STATS_CALL(stats, call, input_length) \
+    ::yui::CallTimer yui_call_timer_{ (stats), ::yui::MatcherCall::call, (input_length) }
+#define YUI_STATS_TALLY(name, stats) ::yui::StatsTally name{ (stats) }
+#define YUI_STATS_COUNT(name, counter, value) name.Add(::yui::MatcherCounter::counter, (value))
+#define YUI_STATS_PARAM(decl) , decl
+#define YUI_STATS_ARG(arg) , arg
+#else
+#define YUI_STATS_CALL(stats, call, input_length) ((void)0)
+#define YUI_STATS_TALLY(name, stats) ((void)0)
+#define YUI_STATS_COUNT(name, counter, value) ((void)0)
+#define YUI_STATS_PARAM(decl)
+#define YUI_STATS_ARG(arg)
+#endif
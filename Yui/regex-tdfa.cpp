@@ -0,0 +1,330 @@
+#include "regex-tdfa.h"
+#include <map>
+#include <tuple>
+#include <algorithm>
+
+using namespace std;
+
+namespace yui
+{
+    static bool operator<(const TagCommand& lhs, const TagCommand& rhs)
+    {
+        return tie(lhs.target_row, lhs.source_row, lhs.slots) < tie(rhs.target_row, rhs.source_row, rhs.slots);
+    }
+
+    // a thread found by following epsilons and captures
+    struct TaggedThread
+    {
+        const NfaTransition* edge;  // entity transition to take next, nullptr if it accepts
+        unsigned source_row;        // the thread it comes from
+        vector<unsigned> slots;     // slots of captures passed
+    };
+
+    // threads of a TDFA state in priority order, the accepting thread is kept apart
+    struct TaggedStateKey
+    {
+        vector<const NfaTransition*> edges;
+        bool accepting;
+
+        bool operator<(const TaggedStateKey& other) const
+        {
+            return tie(edges, accepting) < tie(other.edges, other.accepting);
+        }
+    };
+
+    class TaggedDfaGenerator
+    {
+    public:
+        TaggedDfaGenerator(TagDisambiguation policy)
+            : policy_(policy) { }
+
+        // follows epsilons and captures from seeds in order, a state is taken by the first thread reaching it
+        // so the output is in priority order as well
+        // returns false if a transition not supported is met
+        bool ComputeClosure(const vector<pair<const NfaState*, unsigned>>& seeds, vector<TaggedThread>& output)
+        {
+            // an item either visits a state or emits an entity transition
+            struct WorkItem
+            {
+                const NfaState* state;
+                const NfaTransition* edge;
+                vector<unsigned> slots;
+            };
+
+            unordered_set<const NfaState*> visited;
+            vector<WorkItem> waitlist;
+
+            for (const auto& [seed, source_row] : seeds)
+            {
+                waitlist.push_back(WorkItem{ seed, nullptr, {} });
+                while (!waitlist.empty())
+                {
+                    auto item = std::move(waitlist.back());
+                    waitlist.pop_back();
+
+                    if (item.edge != nullptr)
+                    {
+                        output.push_back(TaggedThread{ item.edge, source_row, std::move(item.slots) });
+                        continue;
+                    }
+
+                    if (!visited.insert(item.state).second)
+                    {
+                        continue;
+                    }
+
+                    if (item.state->is_final)
+                    {
+                        output.push_back(TaggedThread{ nullptr, source_row, item.slots });
+                    }
+
+                    // push in reversed order so that the most prior one comes out first
+                    const auto& exits = SortedExits(item.state);
+                    for (auto it = exits.rbegin(); it != exits.rend(); ++it)
+                    {
+                        const NfaTransition* edge = *it;
+                        switch (edge->type)
+                        {
+                        case TransitionType::Epsilon:
+                            waitlist.push_back(WorkItem{ edge->target, nullptr, item.slots });
+                            break;
+
+                        case TransitionType::BeginCapture:
+                        case TransitionType::EndCapture:
+                        {
+                            auto id = get<unsigned>(edge->data);
+                            auto slot = edge->type == TransitionType::BeginCapture ? id * 2 : id * 2 + 1;
+
+                            auto slots = item.slots;
+                            slots.push_back(slot);
+                            waitlist.push_back(WorkItem{ edge->target, nullptr, std::move(slots) });
+                        }
+                            break;
+
+                        case TransitionType::Entity:
+                        case TransitionType::Class:
+                            waitlist.push_back(WorkItem{ item.state, edge, item.slots });
+                            break;
+
+                        default:
+                            return false;
+                        }
+                    }
+                }
+            }
+
+            return true;
+        }
+
+        // applies disambiguation policy to threads and splits them into the state key and commands
+        // NOTE the accepting thread is dropped if accepting is not allowed
+        pair<TaggedStateKey, TagCommands> MakeState(const vector<TaggedThread>& threads, bool allow_accepting)
+        {
+            TaggedStateKey key{ {}, false };
+            TagCommands commands;
+
+            const TaggedThread* accepting_thread = nullptr;
+            for (const auto& thread : threads)
+            {
+                if (thread.edge == nullptr)
+                {
+                    // only the first accepting thread counts
+                    if (!allow_accepting || accepting_thread != nullptr)
+                    {
+                        continue;
+                    }
+
+                    accepting_thread = &thread;
+
+                    // Perl never tries paths less prior than a match
+                    if (policy_ == TagDisambiguation::Perl)
+                    {
+                        break;
+                    }
+                }
+                else
+                {
+                    AddCommand(commands, static_cast<unsigned>(key.edges.size()), thread);
+                    key.edges.push_back(thread.edge);
+                }
+            }
+
+            if (accepting_thread != nullptr)
+            {
+                // the accepting thread takes the row after all others
+                AddCommand(commands, static_cast<unsigned>(key.edges.size()), *accepting_thread);
+                key.accepting = true;
+            }
+
+            return { std::move(key), std::move(commands) };
+        }
+
+    private:
+        void AddCommand(TagCommands& commands, unsigned target_row, const TaggedThread& thread)
+        {
+            // nothing to do if the thread stays in the same row with nothing to save
+            if (thread.source_row != target_row || !thread.slots.empty())
+            {
+                commands.push_back(TagCommand{ target_row, thread.source_row, thread.slots });
+            }
+        }
+
+        const vector<const NfaTransition*>& SortedExits(const NfaState* state)
+        {
+            auto [iter, inserted] = sorted_exits_.try_emplace(state);
+            if (inserted)
+            {
+                // the order of transitions of the same priority is kept
+                iter->second.assign(state->exits.begin(), state->exits.end());
+                stable_sort(iter->second.begin(), iter->second.end(),
+                    [](const NfaTransition* lhs, const NfaTransition* rhs) {
+                        return CalcTransitionPriority(lhs) < CalcTransitionPriority(rhs);
+                    });
+            }
+
+            return iter->second;
+        }
+
+    private:
+        TagDisambiguation policy_;
+        unordered_map<const NfaState*, vector<const NfaTransition*>> sorted_exits_;
+    };
+
+    // generates a TDFA from a NFA
+    //
+    // it's a subset construction where a subset is an ordered list of NFA threads
+    // order of threads is the priority order of paths reaching them, which tells how to disambiguate
+    TaggedDfaAutomaton::Ptr GenerateTaggedDfa(const NfaAutomaton& atm, TagDisambiguation policy)
+    {
+        // partition the alphabet and count capture slots
+        ByteClassBuilder class_builder;
+        size_t slot_count = 0;
+        EnumerateNfa(atm.IntialState(), [&](const NfaState* state) {
+            for (const NfaTransition* edge : state->exits)
+            {
+                if (IsConsumingTransition(edge))
+                {
+                    class_builder.AddTransition(edge);
+                }
+                else if (edge->type == TransitionType::BeginCapture || edge->type == TransitionType::EndCapture)
+                {
+                    slot_count = max<size_t>(slot_count, get<unsigned>(edge->data) * 2 + 2);
+                }
+            }
+        });
+
+        auto classes = class_builder.Build();
+
+        // a byte representing each class
+        vector<int> class_representative(classes.count);
+        for (int ch = kDfaAlphabetSize - 1; ch >= 0; --ch)
+        {
+            class_representative[classes.class_of[ch]] = ch;
+        }
+
+        TaggedDfaGenerator generator{ policy };
+
+        size_t row_count = 1;
+        vector<unsigned> acceptance_lookup;
+        vector<TaggedTransition> jumptable;
+        vector<TagCommands> commands_list;
+        map<TagCommands, unsigned> commands_lookup;
+
+        map<TaggedStateKey, DfaState> state_map;
+        vector<TaggedStateKey> states;
+
+        const auto LookupCommands = [&](TagCommands commands) {
+            auto [iter, inserted] = commands_lookup.try_emplace(commands, static_cast<unsigned>(commands_list.size()));
+            if (inserted)
+            {
+                commands_list.push_back(std::move(commands));
+            }
+
+            return iter->second;
+        };
+
+        const auto LookupState = [&](TaggedStateKey key) {
+            auto [iter, inserted] = state_map.try_emplace(key, static_cast<DfaState>(states.size()));
+            if (inserted)
+            {
+                auto state_row_count = key.edges.size() + (key.accepting ? 1 : 0);
+                row_count = max(row_count, state_row_count);
+
+                acceptance_lookup.push_back(key.accepting
+                    ? static_cast<unsigned>(key.edges.size())
+                    : TaggedDfaAutomaton::kNotAccepting);
+                states.push_back(std::move(key));
+            }
+
+            return iter->second;
+        };
+
+        // initial state, whose registers are cleared before set
+        auto accepts_empty = false;
+        {
+            vector<TaggedThread> threads;
+            if (!generator.ComputeClosure({ { atm.IntialState(), kNoSourceRow } }, threads))
+            {
+                return nullptr;
+            }
+
+            accepts_empty = any_of(threads.begin(), threads.end(), [](const TaggedThread& thread) { return thread.edge == nullptr; });
+
+            auto [key, commands] = generator.MakeState(threads, false);
+            LookupCommands(std::move(commands));
+            LookupState(std::move(key));
+        }
+
+        for (DfaState source_id = 0; source_id < states.size(); ++source_id)
+        {
+            if (states.size() > kTdfaStateLimit)
+            {
+                return nullptr;
+            }
+
+            // fill up a row of jumptable
+            vector<TaggedTransition> row(classes.count, TaggedTransition{ kInvalidDfaState, 0 });
+            for (unsigned byte_class = 0; byte_class < classes.count; ++byte_class)
+            {
+                auto ch = class_representative[byte_class];
+
+                // threads taking the byte continue in their order
+                vector<pair<const NfaState*, unsigned>> seeds;
+                const auto& edges = states[source_id].edges;
+                for (unsigned source_row = 0; source_row < edges.size(); ++source_row)
+                {
+                    if (TestTransitionByte(edges[source_row], ch))
+                    {
+                        seeds.emplace_back(edges[source_row]->target, source_row);
+                    }
+                }
+
+                if (seeds.empty())
+                {
+                    continue;
+                }
+
+                vector<TaggedThread> threads;
+                if (!generator.ComputeClosure(seeds, threads))
+                {
+                    return nullptr;
+                }
+
+                auto [key, commands] = generator.MakeState(threads, true);
+                if (key.edges.empty() && !key.accepting)
+                {
+                    continue;
+                }
+
+                auto commands_id = LookupCommands(std::move(commands));
+                auto target_id = LookupState(std::move(key));
+                row[byte_class] = TaggedTransition{ target_id, commands_id };
+            }
+
+            jumptable.insert(jumptable.end(), row.begin(), row.end());
+        }
+
+        return make_unique<TaggedDfaAutomaton>(classes, slot_count, row_count, std::move(acceptance_lookup),
+                                               std::move(jumptable), std::move(commands_list), accepts_empty);
+    }
+}
@@ -0,0 +1,150 @@
+// Provides tagged DFA(TDFA) that extracts captures of general patterns in a deterministic pass
+
+#pragma once
+#include "regex-automaton.h"
+#include <vector>
+#include <memory>
+
+namespace yui
+{
+    // How a match and its captures are chosen among paths
+    enum class TagDisambiguation
+    {
+        // the first path in priority order at the leftmost position, as Perl and PCRE take
+        // NOTES the match may be shorter than others at the same position, e.g. a|ab finds "a" in "ab"
+        //       so Match("ab") is false, as Match tests if the match found spans the whole input
+        //       NfaRegexMatcher cuts its search by stack depth rather than by priority, so it may find another
+        Perl,
+
+        // the longest match at the leftmost position, and the first path of it in priority order
+        // NOTES this is not the POSIX rule that prefers longer subexpressions from left to right
+        Longest,
+    };
+
+    // Generation gives up when the automaton grows beyond this
+    static constexpr size_t kTdfaStateLimit = 4096;
+
+    // A state of TDFA is an ordered list of NFA threads(Laurikari),
+    // each of which owns a row of registers holding its capture slots
+    // where slot 2k and 2k+1 holds the begin and the end of capture k
+    //
+    // On a transition, every thread of the target state takes the registers of the thread it comes from,
+    // and then saves the current position into slots of captures it passes
+    // Threads that stay in the same row with nothing to save have no command at all
+
+    static constexpr unsigned kNoSourceRow = std::numeric_limits<unsigned>::max();
+
+    struct TagCommand
+    {
+        unsigned target_row;
+        unsigned source_row;            // kNoSourceRow to clear every slot of the target row
+        std::vector<unsigned> slots;    // slots to save the current position into
+    };
+
+    // NOTES commands are performed as parallel assignment, i.e. every source row is read before written
+    using TagCommands = std::vector<TagCommand>;
+
+    struct TaggedTransition
+    {
+        DfaState target;
+        unsigned commands;  // index of commands performed after consuming the byte
+    };
+
+    // This class should only be constructed via GenerateTaggedDfa
+    class TaggedDfaAutomaton : Uncopyable, Unmovable
+    {
+	private:
+		friend std::unique_ptr<TaggedDfaAutomaton> GenerateTaggedDfa(const NfaAutomaton& atm, TagDisambiguation policy);
+		struct ConstructionDummy { };
+
+	public:
+		using Ptr = std::unique_ptr<TaggedDfaAutomaton>;
+
+        // an entry of acceptance lookup is the row of the accepting thread
+        static constexpr unsigned kNotAccepting = std::numeric_limits<unsigned>::max();
+
+        TaggedDfaAutomaton(const ByteClasses& classes, size_t slot_count, size_t row_count,
+                           std::vector<unsigned> acc, std::vector<TaggedTransition> jumptable,
+                           std::vector<TagCommands> commands, bool accepts_empty, ConstructionDummy = {})
+            : classes_(classes)
+            , slot_count_(slot_count)
+            , row_count_(row_count)
+            , acceptance_lookup_(std::move(acc))
+            , jumptable_(std::move(jumptable))
+            , commands_(std::move(commands))
+            , accepts_empty_(accepts_empty) { }
+
+        size_t StateCount() const
+        {
+            return jumptable_.size() / classes_.count;
+        }
+
+        size_t SlotCount() const
+        {
+            return slot_count_;
+        }
+
+        // maximum number of rows used by a state
+        size_t RowCount() const
+        {
+            return row_count_;
+        }
+
+        DfaState InitialState() const
+        {
+            return 0;
+        }
+
+        // commands to set up registers of the initial state at the start position
+        unsigned InitialCommands() const
+        {
+            return 0;
+        }
+
+        bool IsAccepting(DfaState state) const
+        {
+            return acceptance_lookup_[state] != kNotAccepting;
+        }
+
+        // tests if the NFA matches an empty string, which the initial state never accepts
+        bool AcceptsEmpty() const
+        {
+            return accepts_empty_;
+        }
+
+        // NOTE valid only if the state is accepting
+        unsigned AcceptingRow(DfaState state) const
+        {
+            return acceptance_lookup_[state];
+        }
+
+        // target of the returned transition is kInvalidDfaState if there's none
+        const TaggedTransition& Transit(DfaState src, int ch) const
+        {
+            assert(src < StateCount());
+            assert(ch >= 0 && ch < static_cast<int>(kDfaAlphabetSize));
+
+            return jumptable_[src * classes_.count + classes_.class_of[ch]];
+        }
+
+        const TagCommands& Commands(unsigned index) const
+        {
+            return commands_[index];
+        }
+
+    private:
+        ByteClasses classes_;
+        size_t slot_count_;
+        size_t row_count_;
+
+        std::vector<unsigned> acceptance_lookup_;
+        std::vector<TaggedTransition> jumptable_;
+        std::vector<TagCommands> commands_;
+        bool accepts_empty_;
+    };
+
+    // Returns nullptr if the NFA has transitions other than entities, captures and epsilons,
+    // or the automaton exceeds kTdfaStateLimit
+    // NOTE empty matches are never accepted, as with DfaAutomaton
+    TaggedDfaAutomaton::Ptr GenerateTaggedDfa(const NfaAutomaton& atm, TagDisambiguation policy);
+}
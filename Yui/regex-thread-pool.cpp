@@ -0,0 +1,173 @@
+#include "regex-thread-pool.h"
+#include <algorithm>
+
+using namespace std;
+
+namespace yui
+{
+    // Implementation of WorkStealingPool
+    //
+
+    WorkStealingPool::WorkStealingPool(size_t thread_count)
+    {
+        for (size_t i = 0; i <= thread_count; ++i)
+        {
+            queues_.push_back(make_unique<WorkerQueue>());
+        }
+
+        for (size_t i = 0; i < thread_count; ++i)
+        {
+            threads_.emplace_back([this, i] { WorkerMain(i + 1); });
+        }
+    }
+
+    WorkStealingPool::~WorkStealingPool()
+    {
+        {
+            lock_guard<mutex> guard{ lock_ };
+            stopping_ = true;
+        }
+
+        wake_.notify_all();
+        for (auto& thread : threads_)
+        {
+            thread.join();
+        }
+    }
+
+    void WorkStealingPool::Run(size_t task_count, size_t max_workers, const function<void(size_t, size_t)>& task)
+    {
+        if (task_count == 0)
+        {
+            return;
+        }
+
+        lock_guard<mutex> run_guard{ run_lock_ };
+
+        auto worker_count = max_workers != 0 ? min(max_workers, WorkerCount()) : WorkerCount();
+        worker_count = min(worker_count, task_count);
+
+        // contiguous blocks keep neighbouring tasks on the same worker until they're stolen
+        for (size_t worker = 0; worker < worker_count; ++worker)
+        {
+            auto& queue = *queues_[worker];
+            lock_guard<mutex> guard{ queue.lock };
+            for (auto i = worker * task_count / worker_count; i < (worker + 1) * task_count / worker_count; ++i)
+            {
+                queue.tasks.push_back(i);
+            }
+        }
+
+        {
+            lock_guard<mutex> guard{ lock_ };
+            task_ = &task;
+            error_ = nullptr;
+            active_count_ = worker_count;
+            running_count_ = worker_count - 1;
+            generation_ += 1;
+        }
+
+        wake_.notify_all();
+        Work(0);
+
+        exception_ptr error;
+        {
+            unique_lock<mutex> guard{ lock_ };
+            done_.wait(guard, [&] { return running_count_ == 0; });
+
+            task_ = nullptr;
+            error = std::move(error_);
+        }
+
+        if (error)
+        {
+            rethrow_exception(error);
+        }
+    }
+
+    WorkStealingPool& WorkStealingPool::Shared()
+    {
+        static WorkStealingPool pool{ max<size_t>(thread::hardware_concurrency(), 1) - 1 };
+        return pool;
+    }
+
+    void WorkStealingPool::WorkerMain(size_t worker)
+    {
+        uint64_t seen_generation = 0;
+        while (true)
+        {
+            {
+                unique_lock<mutex> guard{ lock_ };
+                wake_.wait(guard, [&] { return stopping_ || generation_ != seen_generation; });
+                if (stopping_)
+                {
+                    return;
+                }
+
+                seen_generation = generation_;
+                if (worker >= active_count_)
+                {
+                    continue;
+                }
+            }
+
+            Work(worker);
+
+            lock_guard<mutex> guard{ lock_ };
+            if (--running_count_ == 0)
+            {
+                done_.notify_all();
+            }
+        }
+    }
+
+    void WorkStealingPool::Work(size_t worker)
+    {
+        size_t task;
+        while (TakeTask(worker, task))
+        {
+            try
+            {
+                (*task_)(worker, task);
+            }
+            catch (...)
+            {
+                lock_guard<mutex> guard{ lock_ };
+                if (!error_)
+                {
+                    error_ = current_exception();
+                }
+            }
+        }
+    }
+
+    bool WorkStealingPool::TakeTask(size_t worker, size_t& task)
+    {
+        {
+            auto& own = *queues_[worker];
+            lock_guard<mutex> guard{ own.lock };
+            if (!own.tasks.empty())
+            {
+                task = own.tasks.back();
+                own.tasks.pop_back();
+                return true;
+            }
+        }
+
+        // every task is queued before the batch starts, so once all queues are empty it's done
+        // NOTE workers not taking part have empty queues
+        for (size_t i = 1; i < queues_.size(); ++i)
+        {
+            auto& victim = *queues_[(worker + i) % queues_.size()];
+            lock_guard<mutex> guard{ victim.lock };
+            if (!victim.tasks.empty())
+            {
+                task = victim.tasks.front();
+                victim.tasks.pop_front();
+                return true;
+            }
+        }
+
+        return false;
+    }
+}
@@ -0,0 +1,78 @@
+// Provides a work-stealing thread pool that runs batches of matching tasks
+
+#pragma once
+#include "class-utils.hpp"
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace yui
+{
+    // A fixed set of worker threads, each with a queue of its own
+    //
+    // Tasks of a batch are dealt to the queues of workers taking part in contiguous blocks.
+    // A worker takes tasks from the back of its own queue and, once it runs dry,
+    // steals from the front of the others, so a worker stuck on a long task never holds up the rest
+    //
+    // NOTES workers live as long as the pool, so scratch buffers they keep in thread_local storage
+    //       are reused across batches rather than allocated for every one
+    //       the calling thread takes part in its batch as worker 0
+    class WorkStealingPool : Uncopyable, Unmovable
+    {
+    public:
+        // the pool has thread_count threads of its own, in addition to the calling one
+        WorkStealingPool(size_t thread_count);
+        ~WorkStealingPool();
+
+        // number of workers a batch may use, including the calling thread
+        size_t WorkerCount() const
+        {
+            return threads_.size() + 1;
+        }
+
+        // runs task(worker, i) for every i in [0, task_count) and returns once all are done
+        // where worker is below WorkerCount(), and no two tasks run on the same worker at once
+        // NOTES at most max_workers workers take part, or all of them if it's 0
+        //       batches from different threads run one after another, so a task must not run a batch itself
+        //       the first exception thrown by a task is rethrown here after the batch is done
+        void Run(size_t task_count, size_t max_workers, const std::function<void(size_t worker, size_t task)>& task);
+
+        // a pool shared by the process, with a worker for each hardware thread
+        static WorkStealingPool& Shared();
+
+    private:
+        struct alignas(64) WorkerQueue
+        {
+            std::mutex lock;
+            std::deque<size_t> tasks;
+        };
+
+        void WorkerMain(size_t worker);
+
+        // runs tasks of the current batch until every queue is empty
+        void Work(size_t worker);
+        bool TakeTask(size_t worker, size_t& task);
+
+    private:
+        std::vector<std::unique_ptr<WorkerQueue>> queues_;  // one for each worker
+        std::vector<std::thread> threads_;                  // worker i + 1 runs on threads_[i]
+
+        std::mutex run_lock_;                               // held through a batch
+
+        std::mutex lock_;
+        std::condition_variable wake_;
+        std::condition_variable done_;
+        uint64_t generation_ = 0;                           // incremented for every batch
+        bool stopping_ = false;
+        size_t active_count_ = 0;                           // workers taking part in the batch
+        size_t running_count_ = 0;                          // pool threads still working on the batch
+        const std::function<void(size_t, size_t)>* task_ = nullptr;
+        std::exception_ptr error_;
+    };
+}
@@ -0,0 +1,623 @@
+// yui-grep, prints lines of files that match a pattern, see PrintUsage
+//
+// Files are mapped into memory and cut into chunks at line breaks, and chunks of every file
+// are scanned by workers of WorkStealingPool::Shared(), so a single huge file is scanned
+// as much in parallel as many small ones. Results are printed in order once a batch of files is done
+//
+// NOTES the pattern is compiled once, see CreateEngine, and its matcher is shared by all workers
+//       lines are matched one at a time, see RegexMatcher::MatchLines, so a match never spans a line break
+
+#include "regex-parser.h"
+#include "regex-matcher.h"
+#include "regex-thread-pool.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#if defined(_WIN32)
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <io.h>
+#include <fcntl.h>
+#else
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+using namespace std;
+using namespace yui;
+
+// chunks a file is cut into, large enough that a chunk takes far longer to scan than to schedule
+static constexpr size_t kChunkSize = size_t{ 1 } << 24;
+
+// bytes of files mapped at once, results of which are held until they're printed
+static constexpr size_t kBatchSize = size_t{ 1 } << 30;
+static constexpr size_t kBatchFileCount = 1024;
+
+struct Options
+{
+    bool count = false;             // -c
+    bool list_files = false;        // -l
+    bool only_matching = false;     // -o
+    bool line_number = false;       // -n
+    int with_filename = -1;         // -H or -h, or -1 to print names if there's more than one file
+    size_t thread_count = 0;        // -j, 0 to use every worker of the pool
+    bool stats = false;             // --stats
+
+    string pattern;
+    vector<string> paths;           // "-" is the standard input
+};
+
+static void PrintUsage()
+{
+    fprintf(stderr,
+        "usage: yui-grep [options] pattern [file...]\n"
+        "prints lines of files, or the standard input if there's none, that match the pattern\n"
+        "\n"
+        "  -c          print the number of matching lines of each file\n"
+        "  -l          print the name of each file that has a matching line\n"
+        "  -o          print each match on a line of its own\n"
+        "  -n          prefix lines with their line numbers\n"
+        "  -H, -h      always, or never, prefix lines with file names\n"
+        "  -j N        scan with N threads at most\n"
+        "  --stats     print the engine picked and the throughput to stderr\n"
+        "\n"
+        "exits with 0 if any line matches, 1 if none does, or 2 on errors\n");
+}
+
+// returns false if the command line is malformed
+static bool ParseOptions(int argc, char** argv, Options& options)
+{
+    auto pattern_given = false;
+    auto options_done = false;
+    for (int i = 1; i < argc; ++i)
+    {
+        string_view arg = argv[i];
+        if (options_done || arg.size() < 2 || arg[0] != '-')
+        {
+            if (!pattern_given)
+            {
+                options.pattern = arg;
+                pattern_given = true;
+            }
+            else
+            {
+                options.paths.emplace_back(arg);
+            }
+
+            continue;
+        }
+
+        if (arg == "--")
+        {
+            options_done = true;
+            continue;
+        }
+        else if (arg == "--stats")
+        {
+            options.stats = true;
+            continue;
+        }
+        else if (arg[1] == '-')
+        {
+            return false;
+        }
+
+        // single letter flags may be combined, e.g. -cn
+        for (size_t k = 1; k < arg.size(); ++k)
+        {
+            switch (arg[k])
+            {
+            case 'c': options.count = true; break;
+            case 'l': options.list_files = true; break;
+            case 'o': options.only_matching = true; break;
+            case 'n': options.line_number = true; break;
+            case 'H': options.with_filename = 1; break;
+            case 'h': options.with_filename = 0; break;
+            case 'j':
+            {
+                // the count is either the rest of the argument or the next one
+                auto value = k + 1 < arg.size() ? string{ arg.substr(k + 1) } : (i + 1 < argc ? string{ argv[++i] } : string{});
+                auto count = strtoul(value.c_str(), nullptr, 10);
+                if (count == 0)
+                {
+                    return false;
+                }
+
+                options.thread_count = count;
+                k = arg.size();
+                break;
+            }
+            default:
+                return false;
+            }
+        }
+    }
+
+    if (!pattern_given)
+    {
+        return false;
+    }
+
+    if (options.paths.empty())
+    {
+        options.paths.emplace_back("-");
+    }
+
+    return true;
+}
+
+// Picks the fastest engine the pattern allows
+//   1. a DFA compiled into native code, or walked if it cannot be, if the DFA fits in the budget
+//   2. a lazy DFA, which caches the states lines actually reach, if it's too large to build up front
+//   3. a NFA matcher, for patterns with references or assertions
+// NOTES groups don't capture unless references need them, as the pattern is parsed without captures
+//       engines may differ in the matches printed by -o where there're many,
+//       but never in the lines that match, where an empty match selects a line too
+static RegexMatcher::Ptr CreateEngine(const ManagedRegex& regex, const char*& name)
+{
+    NfaBuilder builder;
+    auto branch = builder.NewBranch(true);
+    regex.Expr()->ConnectNfa(builder, branch);
+    auto nfa = builder.Build(branch.begin);
+
+    if (nfa->DfaCompatible())
+    {
+        if (auto dfa = GenerateDfa(*nfa, kDefaultDfaStateLimit))
+        {
+            name = "dfa";
+            return CreateJitMatcher(std::move(dfa));
+        }
+
+        name = "lazy-dfa";
+        return CreateLazyDfaMatcher(GenerateLazyDfa(*nfa));
+    }
+
+    name = "nfa";
+    return CreateMatcher(*nfa);
+}
+
+// Contents of a file, mapped into memory if it's a regular file, or read otherwise
+// NOTE the mapping is advised to be read sequentially, so pages are read ahead and dropped early
+class InputFile : Uncopyable, Unmovable
+{
+public:
+    InputFile() = default;
+
+    ~InputFile()
+    {
+        if (mapped_ == nullptr)
+        {
+            return;
+        }
+
+#if defined(_WIN32)
+        UnmapViewOfFile(mapped_);
+#else
+        munmap(mapped_, size_);
+#endif
+    }
+
+    // returns false with the reason written into error if the file cannot be read
+    bool Open(const string& path, string& error)
+    {
+        if (path == "-")
+        {
+            return ReadStream(stdin, error);
+        }
+
+#if defined(_WIN32)
+        auto file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                                OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+        {
+            error = "cannot open file";
+            return false;
+        }
+
+        LARGE_INTEGER size;
+        auto ok = GetFileSizeEx(file, &size) != 0;
+        if (ok && size.QuadPart > 0)
+        {
+            // the view keeps the file open once both handles are closed
+            auto mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+            mapped_ = mapping != nullptr ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+            ok = mapped_ != nullptr;
+            size_ = static_cast<size_t>(size.QuadPart);
+
+            if (mapping != nullptr)
+            {
+                CloseHandle(mapping);
+            }
+        }
+
+        CloseHandle(file);
+        if (!ok)
+        {
+            error = "cannot map file";
+            return false;
+        }
+#else
+        auto fd = open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            error = strerror(errno);
+            return false;
+        }
+
+        struct stat info;
+        auto ok = fstat(fd, &info) == 0;
+        if (!ok)
+        {
+            error = strerror(errno);
+        }
+        else if (S_ISDIR(info.st_mode))
+        {
+            ok = false;
+            error = "is a directory";
+        }
+        else if (!S_ISREG(info.st_mode))
+        {
+            // pipes and devices cannot be mapped
+            ok = ReadDescriptor(fd, error);
+        }
+        else if (info.st_size > 0)
+        {
+            size_ = static_cast<size_t>(info.st_size);
+            auto mapped = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+            if (mapped == MAP_FAILED)
+            {
+                ok = false;
+                error = strerror(errno);
+            }
+            else
+            {
+                mapped_ = mapped;
+                madvise(mapped_, size_, MADV_SEQUENTIAL);
+            }
+        }
+
+        // the mapping keeps the file open
+        close(fd);
+        if (!ok)
+        {
+            return false;
+        }
+#endif
+
+        return true;
+    }
+
+    string_view View() const
+    {
+        if (mapped_ != nullptr)
+        {
+            return { static_cast<const char*>(mapped_), size_ };
+        }
+
+        return buffer_;
+    }
+
+private:
+    bool ReadStream(FILE* stream, string& error)
+    {
+#if defined(_WIN32)
+        _setmode(_fileno(stream), _O_BINARY);
+#endif
+        char block[1 << 16];
+        size_t length;
+        while ((length = fread(block, 1, sizeof(block), stream)) > 0)
+        {
+            buffer_.append(block, length);
+        }
+
+        if (ferror(stream))
+        {
+            error = "read error";
+            return false;
+        }
+
+        return true;
+    }
+
+#if !defined(_WIN32)
+    bool ReadDescriptor(int fd, string& error)
+    {
+        char block[1 << 16];
+        while (true)
+        {
+            auto length = read(fd, block, sizeof(block));
+            if (length == 0)
+            {
+                return true;
+            }
+            else if (length < 0 && errno != EINTR)
+            {
+                error = strerror(errno);
+                return false;
+            }
+            else if (length > 0)
+            {
+                buffer_.append(block, static_cast<size_t>(length));
+            }
+        }
+    }
+#endif
+
+private:
+    void* mapped_ = nullptr;
+    size_t size_ = 0;
+    string buffer_;             // contents of files that cannot be mapped
+};
+
+// a line, or a match with -o, to be printed
+struct Hit
+{
+    size_t line;                // index of the line in its chunk
+    size_t begin, end;          // offsets into the file
+};
+
+struct Chunk
+{
+    size_t file;
+    size_t begin, end;          // offsets into the file, at line starts
+
+    size_t line_count = 0;
+    size_t match_count = 0;     // matching lines
+    vector<Hit> hits;           // empty with -c or -l
+};
+
+struct FileResult
+{
+    string path;
+    InputFile input;
+    string error;
+
+    atomic<bool> matched{ false };
+
+    // as printed, where "-" is the standard input
+    const char* Name() const
+    {
+        return path == "-" ? "(standard input)" : path.c_str();
+    }
+};
+
+// cuts the file into chunks, each ends right after a line break but the last
+static void CutChunks(size_t file, string_view data, vector<Chunk>& chunks)
+{
+    size_t begin = 0;
+    do
+    {
+        auto end = data.size();
+        if (data.size() - begin > kChunkSize)
+        {
+            auto cut = data.data() + begin + kChunkSize;
+            end = static_cast<size_t>(FindLineBreak(cut, data.data() + data.size()) - data.data());
+            end = min(end + 1, data.size());
+        }
+
+        Chunk chunk;
+        chunk.file = file;
+        chunk.begin = begin;
+        chunk.end = end;
+        chunks.push_back(std::move(chunk));
+
+        begin = end;
+    } while (begin < data.size());
+}
+
+static void ScanChunk(const RegexMatcher& matcher, const Options& options, FileResult& file, Chunk& chunk)
+{
+    // a file known to match already is done with -l
+    if (options.list_files && file.matched.load(memory_order_relaxed))
+    {
+        return;
+    }
+
+    thread_local vector<LineMatch> lines;
+    thread_local RegexMatchBuffer matches;
+
+    const auto view = file.input.View().substr(chunk.begin, chunk.end - chunk.begin);
+    if (options.list_files)
+    {
+        chunk.line_count = matcher.MatchLines(view, lines, 1);
+        chunk.match_count = lines.size();
+        if (!lines.empty())
+        {
+            file.matched.store(true, memory_order_relaxed);
+        }
+
+        return;
+    }
+    else if (options.count)
+    {
+        chunk.match_count = matcher.CountMatchingLines(view);
+        return;
+    }
+
+    chunk.line_count = matcher.MatchLines(view, lines);
+    chunk.match_count = lines.size();
+    for (const auto& line : lines)
+    {
+        auto line_offset = chunk.begin + line.begin;
+        if (!options.only_matching)
+        {
+            chunk.hits.push_back({ line.number, line_offset, chunk.begin + line.end });
+            continue;
+        }
+
+        // matches are only located in lines known to have one
+        matcher.SearchAll(view.substr(line.begin, line.end - line.begin), matches);
+        for (size_t i = 0; i < matches.Size(); ++i)
+        {
+            chunk.hits.push_back({ line.number, line_offset + matches.Begin(i), line_offset + matches.End(i) });
+        }
+    }
+}
+
+// NOTE line numbers of a chunk are only known once chunks before it are counted, so hits are printed here
+static void PrintFile(const Options& options, bool with_filename, const FileResult& file,
+                      const Chunk* chunks, size_t chunk_count)
+{
+    const auto data = file.input.View();
+
+    size_t match_count = 0;
+    for (size_t i = 0; i < chunk_count; ++i)
+    {
+        match_count += chunks[i].match_count;
+    }
+
+    if (options.list_files)
+    {
+        if (match_count != 0)
+        {
+            printf("%s\n", file.Name());
+        }
+
+        return;
+    }
+    else if (options.count)
+    {
+        if (with_filename)
+        {
+            printf("%s:", file.Name());
+        }
+
+        printf("%zu\n", match_count);
+        return;
+    }
+
+    size_t line_base = 1;
+    for (size_t i = 0; i < chunk_count; ++i)
+    {
+        for (const auto& hit : chunks[i].hits)
+        {
+            if (with_filename)
+            {
+                printf("%s:", file.Name());
+            }
+
+            if (options.line_number)
+            {
+                printf("%zu:", line_base + hit.line);
+            }
+
+            fwrite(data.data() + hit.begin, 1, hit.end - hit.begin, stdout);
+            putchar('\n');
+        }
+
+        line_base += chunks[i].line_count;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    if (!ParseOptions(argc, argv, options))
+    {
+        PrintUsage();
+        return 2;
+    }
+
+    auto compile_start = chrono::steady_clock::now();
+
+    // lines are only tested and located, so groups need not capture
+    string error;
+    auto regex = ParseRegex(options.pattern, &error, false);
+    if (regex == nullptr)
+    {
+        fprintf(stderr, "yui-grep: %s\n", error.c_str());
+        return 2;
+    }
+
+    const char* engine_name;
+    auto matcher = CreateEngine(*regex, engine_name);
+
+    auto scan_start = chrono::steady_clock::now();
+
+    // lines are printed a lot at a time, so output is fully buffered
+    setvbuf(stdout, nullptr, _IOFBF, 1 << 16);
+
+    const auto with_filename = options.with_filename >= 0 ? options.with_filename == 1 : options.paths.size() > 1;
+
+    auto any_matched = false;
+    auto any_error = false;
+    size_t total_bytes = 0;
+
+    for (size_t next = 0; next < options.paths.size(); )
+    {
+        // files are mapped a batch at a time to bound address space and results held
+        vector<unique_ptr<FileResult>> files;
+        vector<Chunk> chunks;
+        size_t batch_bytes = 0;
+        while (next < options.paths.size() && batch_bytes < kBatchSize && files.size() < kBatchFileCount)
+        {
+            auto file = make_unique<FileResult>();
+            file->path = options.paths[next++];
+            if (file->input.Open(file->path, file->error))
+            {
+                auto data = file->input.View();
+                CutChunks(files.size(), data, chunks);
+                batch_bytes += data.size();
+            }
+
+            files.push_back(std::move(file));
+        }
+
+        WorkStealingPool::Shared().Run(chunks.size(), options.thread_count, [&](size_t, size_t i) {
+            ScanChunk(*matcher, options, *files[chunks[i].file], chunks[i]);
+        });
+
+        // chunks of a file are adjacent, in order
+        size_t first_chunk = 0;
+        for (size_t i = 0; i < files.size(); ++i)
+        {
+            const auto& file = *files[i];
+            if (!file.error.empty())
+            {
+                fprintf(stderr, "yui-grep: %s: %s\n", file.Name(), file.error.c_str());
+                any_error = true;
+                continue;
+            }
+
+            auto chunk_count = size_t{ 0 };
+            while (first_chunk + chunk_count < chunks.size() && chunks[first_chunk + chunk_count].file == i)
+            {
+                any_matched |= chunks[first_chunk + chunk_count].match_count != 0;
+                chunk_count += 1;
+            }
+
+            PrintFile(options, with_filename, file, chunks.data() + first_chunk, chunk_count);
+            first_chunk += chunk_count;
+        }
+
+        total_bytes += batch_bytes;
+    }
+
+    fflush(stdout);
+
+    if (options.stats)
+    {
+        auto end = chrono::steady_clock::now();
+        auto compile_ms = chrono::duration<double, milli>(scan_start - compile_start).count();
+        auto scan_seconds = chrono::duration<double>(end - scan_start).count();
+
+        fprintf(stderr, "engine: %s, compiled in %.3f ms\n", engine_name, compile_ms);
+        fprintf(stderr, "scanned %zu bytes of %zu files in %.3f s, %.1f MB/s\n",
+                total_bytes, options.paths.size(), scan_seconds,
+                scan_seconds > 0 ? total_bytes / scan_seconds / 1e6 : 0.0);
+    }
+
+    return any_error ? 2 : (any_matched ? 0 : 1);
+}
@@ -0,0 +1,1510 @@
+// yui-test, regression tests of the library, run without arguments
+//
+// Every test is a function listed in kTests, which reports failed checks via CHECK
+// the exit code is non-zero if any check fails, so that a build script can run it as is
+//
+// NOTE tests check matches against results known in advance, and some compare engines against each other
+//      on the same pattern as well, as every engine is expected to find the same matches
+
+#include "regex-parser.h"
+#include "regex-factory.h"
+#include "regex-matcher.h"
+#include "regex-jit.h"
+#include "regex-glushkov.h"
+#include <cstdio>
+#include <functional>
+#include <random>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+using namespace yui;
+
+static size_t failure_count = 0;
+
+static void ReportFailure(const char* test, const char* expr, int line)
+{
+    fprintf(stderr, "yui-test.cpp:%d: %s: check failed: %s\n", line, test, expr);
+    failure_count += 1;
+}
+
+#define CHECK(expr) do { if (!(expr)) ReportFailure(__func__, #expr, __LINE__); } while (0)
+
+// Helpers
+//
+
+// builds the tree returned by a function, so that a test needs no factory class of its own
+class TestFactory : public RegexFactoryBase
+{
+public:
+    using Builder = function<RegexExpr*(TestFactory&)>;
+
+    TestFactory(Builder builder, bool simplify = true)
+        : RegexFactoryBase(simplify), builder_(std::move(builder)) { }
+
+    using RegexFactoryBase::Range;
+    using RegexFactoryBase::Char;
+    using RegexFactoryBase::String;
+    using RegexFactoryBase::Class;
+    using RegexFactoryBase::Letter;
+    using RegexFactoryBase::Digit;
+    using RegexFactoryBase::CodepointRange;
+    using RegexFactoryBase::Codepoint;
+    using RegexFactoryBase::CodepointClass;
+    using RegexFactoryBase::Concat;
+    using RegexFactoryBase::Alter;
+    using RegexFactoryBase::Repeat;
+    using RegexFactoryBase::Optional;
+    using RegexFactoryBase::Star;
+    using RegexFactoryBase::Plus;
+    using RegexFactoryBase::Anchor;
+    using RegexFactoryBase::Capture;
+    using RegexFactoryBase::Reference;
+    using RegexFactoryBase::Assertion;
+
+protected:
+    RegexExpr* Construct() override
+    {
+        return builder_(*this);
+    }
+
+private:
+    Builder builder_;
+};
+
+static NfaAutomaton::Ptr BuildNfa(const ManagedRegex& regex)
+{
+    NfaBuilder builder;
+    auto branch = builder.NewBranch(true);
+    regex.Expr()->ConnectNfa(builder, branch);
+    return builder.Build(branch.begin);
+}
+
+static NfaAutomaton::Ptr BuildNfa(const TestFactory::Builder& builder)
+{
+    return BuildNfa(*TestFactory{ builder }.Generate());
+}
+
+// offsets of the match in s, e.g. "1-3", or "none"
+static string Span(string_view s, const RegexMatchOpt& match)
+{
+    if (!match)
+    {
+        return "none";
+    }
+
+    auto begin = static_cast<size_t>(match->content.data() - s.data());
+    return to_string(begin) + "-" + to_string(begin + match->content.size());
+}
+
+// offsets of every match in s, e.g. "0-2 3-5"
+static string Spans(string_view s, const RegexMatchVec& matches)
+{
+    string result;
+    for (const auto& match : matches)
+    {
+        result += (result.empty() ? "" : " ") + Span(s, match);
+    }
+
+    return result;
+}
+
+struct Engine
+{
+    const char* name;
+    RegexMatcher::Ptr matcher;
+};
+
+// builds a matcher of every engine able to run the pattern
+static vector<Engine> CreateEngines(string_view pattern, bool captures = false)
+{
+    vector<Engine> engines;
+
+    auto regex = ParseRegex(pattern, nullptr, captures);
+    if (regex == nullptr)
+    {
+        return engines;
+    }
+
+    auto nfa = BuildNfa(*regex);
+    engines.push_back({ "nfa", CreateNfaMatcher(EliminateEpsilon(*nfa)) });
+    engines.push_back({ "auto", CreateMatcher(*nfa) });
+
+    if (nfa->DfaCompatible())
+    {
+        engines.push_back({ "dfa", CreateDfaMatcher(GenerateDfa(*nfa)) });
+        engines.push_back({ "jit", CreateJitMatcher(GenerateDfa(*nfa)) });
+        engines.push_back({ "lazy-dfa", CreateLazyDfaMatcher(GenerateLazyDfa(*nfa)) });
+    }
+
+    if (auto one_pass = GenerateOnePassDfa(*nfa))
+    {
+        engines.push_back({ "one-pass", CreateOnePassMatcher(std::move(one_pass)) });
+    }
+
+    if (auto tdfa = GenerateTaggedDfa(*nfa, TagDisambiguation::Perl))
+    {
+        engines.push_back({ "tdfa", CreateTaggedDfaMatcher(std::move(tdfa)) });
+    }
+
+    return engines;
+}
+
+// Tests
+//
+
+// (ab|aa)+, the pattern of the demo driver, on the backtracker and the DFA
+static void TestBasicMatching()
+{
+    auto nfa = BuildNfa([](TestFactory& f) { return f.Plus(f.Alter({ f.String("ab"), f.String("aa") })); });
+    CHECK(nfa->DfaCompatible());
+
+    RegexMatcher::Ptr matchers[] = { CreateNfaMatcher(EliminateEpsilon(*nfa)), CreateDfaMatcher(GenerateDfa(*nfa)) };
+    for (const auto& matcher : matchers)
+    {
+        CHECK(matcher->Match("abaa") && matcher->Match("ab"));
+        CHECK(!matcher->Match("aba") && !matcher->Match("") && !matcher->Match("abx"));
+
+        const string_view text = "xxabab!";
+        CHECK(Span(text, matcher->Search(text)) == "2-6");
+        CHECK(!matcher->Search("ba b"));
+
+        const string_view words = "ab aa ba abaa";
+        CHECK(Spans(words, matcher->SearchAll(words)) == "0-2 3-5 9-13");
+    }
+
+    // a reference needs the backtracker, which finds the leftmost match
+    nfa = BuildNfa([](TestFactory& f) {
+        return f.Concat({ f.Capture(0, f.Plus(f.Char('a'))), f.Char('b'), f.Reference(0) });
+    });
+    CHECK(!nfa->DfaCompatible());
+
+    auto matcher = CreateNfaMatcher(EliminateEpsilon(*nfa));
+    auto match = matcher->Search("xaabaa");
+    CHECK(match && match->content == "aabaa" && match->capture[0] == "aa");
+
+    match = matcher->Search("xaaba");
+    CHECK(match && match->content == "aba" && match->capture[0] == "a");
+    CHECK(!matcher->Search("aab"));
+}
+
+// the JIT finds the matches of the jumptable it's compiled from
+static void TestJitMatcher()
+{
+    auto nfa = BuildNfa([](TestFactory& f) { return f.Plus(f.Alter({ f.String("ab"), f.String("aa") })); });
+
+#if defined(__x86_64__) || defined(_M_X64)
+    // the program returns the end of the longest match anchored at begin
+    auto program = CompileDfa(*GenerateDfa(*nfa));
+    CHECK(program != nullptr && program->CodeSize() > 0);
+    if (program)
+    {
+        const string_view text = "abaax";
+        CHECK(program->Run(text.data(), text.data() + text.size()) == text.data() + 4);
+        CHECK(program->Run(text.data() + 1, text.data() + text.size()) == nullptr);
+        CHECK(program->Run(text.data(), text.data() + 1) == nullptr);
+    }
+#endif
+
+    auto jit = CreateJitMatcher(GenerateDfa(*nfa));
+    CHECK(jit->Match("abaa") && !jit->Match("aba"));
+
+    const string_view words = "ab aa ba abaa";
+    CHECK(Spans(words, jit->SearchAll(words)) == "0-2 3-5 9-13");
+
+    auto digits = CreateJitMatcher(GenerateDfa(*BuildNfa([](TestFactory& f) { return f.Plus(f.Digit()); })));
+    const string_view text = "a1 22 333";
+    CHECK(Spans(text, digits->SearchAll(text)) == "1-2 3-5 6-9");
+    CHECK(Span(text, digits->Search(text)) == "1-2");
+    CHECK(digits->Match("123") && !digits->Match("12a") && !digits->Match(""));
+
+    // an accepting initial state records no empty match, as with the jumptable
+    auto star = CreateJitMatcher(GenerateDfa(*BuildNfa([](TestFactory& f) { return f.Star(f.Char('a')); })));
+    CHECK(Spans("bab", star->SearchAll("bab")) == "1-2");
+}
+
+// a selection bit is set for every string that matches as a whole
+static void TestMatchColumn()
+{
+    const char* strings[] = { "ab", "", "aaab", "abab", "b", "aa", "abx", "aaaa", "ab", "a" };
+
+    string data;
+    vector<int32_t> offsets = { 0 };
+    for (auto s : strings)
+    {
+        data += s;
+        offsets.push_back(static_cast<int32_t>(data.size()));
+    }
+
+    StringColumn column{ offsets.data(), data.data(), size(strings) };
+
+    // strings 0, 2, 3, 5, 7 and 8 match
+    const SelectionBitmap expected = { 0xad, 0x01 };
+
+    auto nfa = BuildNfa([](TestFactory& f) { return f.Plus(f.Alter({ f.String("ab"), f.String("aa") })); });
+    RegexMatcher::Ptr matchers[] = { CreateNfaMatcher(EliminateEpsilon(*nfa)), CreateDfaMatcher(GenerateDfa(*nfa)),
+                                     CreateJitMatcher(GenerateDfa(*nfa)) };
+    for (const auto& matcher : matchers)
+    {
+        CHECK(matcher->MatchColumn(column) == expected);
+    }
+
+    // an empty column selects nothing
+    StringColumn empty{ offsets.data(), data.data(), 0 };
+    CHECK(matchers[1]->MatchColumn(empty).empty());
+}
+
+// matches of a parallel scan across chunk boundaries are found as SearchAll finds them
+static void TestParallelSearch()
+{
+    ParallelOptions options;
+    options.thread_count = 4;
+    options.min_chunk_size = 64;
+
+    string text;
+    for (size_t i = 0; i < 1000; ++i)
+    {
+        text += "ab ";
+    }
+
+    auto ab = CreateDfaMatcher(GenerateDfa(*BuildNfa([](TestFactory& f) { return f.String("ab"); })));
+    auto matches = ab->SearchAllParallel(text, options);
+    CHECK(matches.size() == 1000 && Span(text, matches.front()) == "0-2" && Span(text, matches.back()) == "2997-2999");
+    CHECK(ab->CountAllParallel(text, options) == 1000);
+
+    // a match spanning many chunks is found once
+    text = string(1000, 'a') + "b" + string(10, 'a');
+    auto run = CreateDfaMatcher(GenerateDfa(*BuildNfa([](TestFactory& f) { return f.Plus(f.Char('a')); })));
+    CHECK(Spans(text, run->SearchAllParallel(text, options)) == "0-1000 1001-1011");
+    CHECK(run->CountAllParallel(text, options) == 2);
+
+    // and so it is with a small input, which is scanned as a whole
+    CHECK(Spans("aab", run->SearchAllParallel("aab", options)) == "0-2");
+}
+
+// bytes above 0x7f and NUL are ordinary bytes to every engine
+static void TestByteAlphabet()
+{
+    auto high = BuildNfa([](TestFactory& f) { return f.Plus(f.Range({ 0x80, 0xff })); });
+    auto nul = BuildNfa([](TestFactory& f) { return f.Concat({ f.Char(0), f.Char(0xff) }); });
+
+    const string_view text = "a\xc3\xa9" "b\xff";
+    const string_view binary{ "x\0\xff\xff", 4 };
+
+    RegexMatcher::Ptr matchers[][2] = {
+        { CreateNfaMatcher(EliminateEpsilon(*high)), CreateNfaMatcher(EliminateEpsilon(*nul)) },
+        { CreateDfaMatcher(GenerateDfa(*high)), CreateDfaMatcher(GenerateDfa(*nul)) },
+        { CreateJitMatcher(GenerateDfa(*high)), CreateJitMatcher(GenerateDfa(*nul)) },
+    };
+
+    for (const auto& pair : matchers)
+    {
+        CHECK(Spans(text, pair[0]->SearchAll(text)) == "1-3 4-5");
+        CHECK(!pair[0]->Search("abc"));
+
+        CHECK(Span(binary, pair[1]->Search(binary)) == "1-3");
+        CHECK(pair[1]->Match(binary.substr(1, 2)) && !pair[1]->Match(binary.substr(2, 2)));
+    }
+}
+
+// code points are matched as their UTF-8 sequences, and never as a part of a longer one
+static void TestUtf8Codepoints()
+{
+    const auto Engines = [](const NfaAutomaton& nfa) {
+        vector<RegexMatcher::Ptr> matchers;
+        matchers.push_back(CreateNfaMatcher(EliminateEpsilon(nfa)));
+        matchers.push_back(CreateDfaMatcher(GenerateDfa(nfa)));
+        return matchers;
+    };
+
+    // U+20AC, encoded as e2 82 ac
+    auto euro = BuildNfa([](TestFactory& f) { return f.Codepoint(0x20ac); });
+    for (const auto& matcher : Engines(*euro))
+    {
+        const string_view text = "a\xe2\x82\xac b\xe2\x82\xac";
+        CHECK(Spans(text, matcher->SearchAll(text)) == "1-4 6-9");
+        CHECK(!matcher->Search("\xe2\x82\xad"));
+    }
+
+    // two-byte sequences only, where the continuation bytes of a three-byte one don't count
+    auto two_bytes = BuildNfa([](TestFactory& f) { return f.Plus(f.CodepointRange({ 0x80, 0x7ff })); });
+    for (const auto& matcher : Engines(*two_bytes))
+    {
+        // "a", U+00E9, U+20AC and U+00F1
+        const string_view text = "a\xc3\xa9\xe2\x82\xac\xc3\xb1";
+        CHECK(Spans(text, matcher->SearchAll(text)) == "1-3 6-8");
+    }
+
+    // a range across the boundaries of encoded lengths
+    auto across = BuildNfa([](TestFactory& f) { return f.CodepointRange({ 0x7f, 0x800 }); });
+    for (const auto& matcher : Engines(*across))
+    {
+        CHECK(matcher->Match("\x7f") && matcher->Match("\xc2\x80") && matcher->Match("\xdf\xbf") && matcher->Match("\xe0\xa0\x80"));
+        CHECK(!matcher->Match("\x7e") && !matcher->Match("\xe0\xa0\x81") && !matcher->Match("\xc2"));
+    }
+
+    // surrogates are never matched, even inside a range
+    auto surrogates = BuildNfa([](TestFactory& f) { return f.CodepointRange({ 0xd000, 0xe000 }); });
+    for (const auto& matcher : Engines(*surrogates))
+    {
+        CHECK(matcher->Match("\xed\x9f\xbf") && matcher->Match("\xee\x80\x80"));
+        CHECK(!matcher->Match("\xed\xa0\x80") && !matcher->Match("\xed\xbf\xbf"));
+    }
+
+    // four-byte sequences up to kMaxCodepoint
+    auto supplementary = BuildNfa([](TestFactory& f) {
+        return f.CodepointClass({ { 'a', 'a' }, { 0x10000, kMaxCodepoint } });
+    });
+    for (const auto& matcher : Engines(*supplementary))
+    {
+        CHECK(matcher->Match("a") && matcher->Match("\xf0\x9f\x98\x80") && matcher->Match("\xf4\x8f\xbf\xbf"));
+        CHECK(!matcher->Match("b") && !matcher->Match("\xf4\x90\x80\x80") && !matcher->Match("\xef\xbf\xbf"));
+    }
+}
+
+// line and word anchors are resolved inside the DFA, with the bytes before a resume point in sight
+static void TestDfaAnchors()
+{
+    const auto Engines = [](const NfaAutomaton& nfa) {
+        vector<RegexMatcher::Ptr> matchers;
+        matchers.push_back(CreateNfaMatcher(EliminateEpsilon(nfa)));
+        matchers.push_back(CreateDfaMatcher(GenerateDfa(nfa)));
+        matchers.push_back(CreateJitMatcher(GenerateDfa(nfa)));
+        return matchers;
+    };
+
+    // \bab\b, where '_' is a word byte
+    auto word = BuildNfa([](TestFactory& f) {
+        return f.Concat({ f.Anchor(AnchorType::WordBoundary), f.String("ab"), f.Anchor(AnchorType::WordBoundary) });
+    });
+    CHECK(word->DfaCompatible());
+
+    for (const auto& matcher : Engines(*word))
+    {
+        const string_view text = "ab cab ab_ ab";
+        CHECK(Spans(text, matcher->SearchAll(text)) == "0-2 11-13");
+        CHECK(matcher->Match("ab") && !matcher->Match("abc"));
+    }
+
+    // ^a+ and a$, where line breaks end lines
+    auto start = BuildNfa([](TestFactory& f) { return f.Concat({ f.Anchor(AnchorType::LineStart), f.Plus(f.Char('a')) }); });
+    auto end = BuildNfa([](TestFactory& f) { return f.Concat({ f.Char('a'), f.Anchor(AnchorType::LineBreak) }); });
+    CHECK(start->DfaCompatible() && end->DfaCompatible());
+
+    for (const auto& matcher : Engines(*start))
+    {
+        const string_view text = "aa\na ba\naaa";
+        CHECK(Spans(text, matcher->SearchAll(text)) == "0-2 3-4 8-11");
+    }
+
+    for (const auto& matcher : Engines(*end))
+    {
+        const string_view text = "ba\nab\na";
+        CHECK(Spans(text, matcher->SearchAll(text)) == "1-2 6-7");
+    }
+
+    // \bb, where the b after a is not at a boundary though the scan resumes there
+    auto resume = BuildNfa([](TestFactory& f) { return f.Concat({ f.Anchor(AnchorType::WordBoundary), f.Char('b') }); });
+    for (const auto& matcher : Engines(*resume))
+    {
+        CHECK(Spans("ab b", matcher->SearchAll("ab b")) == "3-4");
+    }
+}
+
+// a one-pass pattern gets its captures in a single walk, others are refused
+static void TestOnePassCaptures()
+{
+    // (a+)b(c|d)
+    auto nfa = BuildNfa([](TestFactory& f) {
+        return f.Concat({ f.Capture(0, f.Plus(f.Char('a'))), f.Char('b'), f.Capture(1, f.Alter({ f.Char('c'), f.Char('d') })) });
+    });
+
+    auto one_pass = GenerateOnePassDfa(*nfa);
+    CHECK(one_pass != nullptr);
+    if (one_pass)
+    {
+        auto matcher = CreateOnePassMatcher(std::move(one_pass));
+        auto match = matcher->Search("xaabdc");
+        CHECK(match && match->content == "aabd" && match->capture[0] == "aa" && match->capture[1] == "d");
+        CHECK(matcher->Match("abc") && !matcher->Match("abcd"));
+
+        const string_view text = "abc ab abd";
+        auto matches = matcher->SearchAll(text);
+        CHECK(Spans(text, matches) == "0-3 7-10" && matches[1].capture[1] == "d");
+    }
+
+    // (a*)a, where whether a is taken by the star is known only after it
+    nfa = BuildNfa([](TestFactory& f) { return f.Concat({ f.Capture(0, f.Star(f.Char('a'))), f.Char('a') }); });
+    CHECK(GenerateOnePassDfa(*nfa) == nullptr);
+
+    // a reference or an anchor is refused
+    nfa = BuildNfa([](TestFactory& f) { return f.Concat({ f.Capture(0, f.Char('a')), f.Reference(0) }); });
+    CHECK(GenerateOnePassDfa(*nfa) == nullptr);
+
+    nfa = BuildNfa([](TestFactory& f) { return f.Concat({ f.Anchor(AnchorType::LineStart), f.Capture(0, f.Char('a')) }); });
+    CHECK(GenerateOnePassDfa(*nfa) == nullptr);
+}
+
+// a tagged DFA gets the captures of patterns that are not one-pass
+static void TestTaggedDfaCaptures()
+{
+    // (a*)(a)
+    auto nfa = BuildNfa([](TestFactory& f) {
+        return f.Concat({ f.Capture(0, f.Star(f.Char('a'))), f.Capture(1, f.Char('a')) });
+    });
+    CHECK(GenerateOnePassDfa(*nfa) == nullptr);
+
+    for (auto mode : { TagDisambiguation::Perl, TagDisambiguation::Longest })
+    {
+        auto matcher = CreateTaggedDfaMatcher(GenerateTaggedDfa(*nfa, mode));
+        auto match = matcher->Search("baaa");
+        CHECK(match && match->content == "aaa" && match->capture[0] == "aa" && match->capture[1] == "a");
+    }
+
+    // (a|b)*c, where a capture in a loop holds its last iteration
+    nfa = BuildNfa([](TestFactory& f) {
+        return f.Concat({ f.Star(f.Capture(0, f.Alter({ f.Char('a'), f.Char('b') }))), f.Char('c') });
+    });
+
+    auto matcher = CreateTaggedDfaMatcher(GenerateTaggedDfa(*nfa, TagDisambiguation::Perl));
+    auto match = matcher->Search("xabac");
+    CHECK(match && match->content == "abac" && match->capture[0] == "a");
+
+    const string_view text = "bc c";
+    auto matches = matcher->SearchAll(text);
+    CHECK(Spans(text, matches) == "0-2 3-4" && matches[0].capture[0] == "b" && matches[1].capture[0].empty());
+
+    // references and anchors are refused
+    nfa = BuildNfa([](TestFactory& f) { return f.Concat({ f.Capture(0, f.Char('a')), f.Reference(0) }); });
+    CHECK(GenerateTaggedDfa(*nfa, TagDisambiguation::Perl) == nullptr);
+}
+
+// lookaheads test their body at the position without consuming it
+static void TestLookahead()
+{
+    const auto Backtracker = [](const TestFactory::Builder& builder) {
+        return CreateNfaMatcher(EliminateEpsilon(*BuildNfa(builder)));
+    };
+
+    // a(?=b) and a(?!b)
+    auto positive = Backtracker([](TestFactory& f) {
+        return f.Concat({ f.Char('a'), f.Assertion(AssertionType::Positive, f.Char('b')) });
+    });
+    auto negative = Backtracker([](TestFactory& f) {
+        return f.Concat({ f.Char('a'), f.Assertion(AssertionType::Negative, f.Char('b')) });
+    });
+
+    const string_view text = "acab a";
+    CHECK(Spans(text, positive->SearchAll(text)) == "2-3");
+    CHECK(Spans(text, negative->SearchAll(text)) == "0-1 5-6");
+    CHECK(!positive->Match("a") && negative->Match("a"));
+
+    // the memo of assertions is kept between searches on a thread, but never its results
+    CHECK(positive->IsMatch("ab") && !negative->IsMatch("ab"));
+    CHECK(!positive->IsMatch("ac") && negative->IsMatch("ac"));
+    CHECK(positive->CountMatches(text) == 1 && negative->CountMatches(text) == 2);
+
+    // (?=[a-z]*[0-9])[a-z0-9]+, a word with a digit
+    auto digit = Backtracker([](TestFactory& f) {
+        auto lower = f.Range({ 'a', 'z' });
+        return f.Concat({
+            f.Assertion(AssertionType::Positive, f.Concat({ f.Star(lower), f.Digit() })),
+            f.Plus(f.Alter({ lower, f.Digit() })),
+        });
+    });
+
+    const string_view words = "abc x1y 22";
+    CHECK(Spans(words, digit->SearchAll(words)) == "4-7 8-10");
+
+    // an anchor inside a body sees the bytes around it
+    auto boundary = Backtracker([](TestFactory& f) {
+        return f.Concat({ f.Char('a'), f.Assertion(AssertionType::Positive, f.Anchor(AnchorType::WordBoundary)) });
+    });
+    CHECK(Spans("ab a a_", boundary->SearchAll("ab a a_")) == "3-4");
+}
+
+// IsMatch and CountMatches agree with Search and SearchAll on every engine
+static void TestIsMatchAndCount()
+{
+    // (a)b, and ab for the DFA
+    auto captured = BuildNfa([](TestFactory& f) { return f.Concat({ f.Capture(0, f.Char('a')), f.Char('b') }); });
+    auto plain = BuildNfa([](TestFactory& f) { return f.String("ab"); });
+
+    vector<RegexMatcher::Ptr> matchers;
+    matchers.push_back(CreateNfaMatcher(EliminateEpsilon(*captured)));
+    matchers.push_back(CreateDfaMatcher(GenerateDfa(*plain)));
+    matchers.push_back(CreateJitMatcher(GenerateDfa(*plain)));
+    matchers.push_back(CreateOnePassMatcher(GenerateOnePassDfa(*captured)));
+    matchers.push_back(CreateTaggedDfaMatcher(GenerateTaggedDfa(*captured, TagDisambiguation::Perl)));
+
+    for (const auto& matcher : matchers)
+    {
+        CHECK(matcher->IsMatch("xxab") && matcher->IsMatch("ab"));
+        CHECK(!matcher->IsMatch("ba") && !matcher->IsMatch(""));
+
+        CHECK(matcher->CountMatches("abxab aab") == 3);
+        CHECK(matcher->CountMatches("bbb") == 0);
+    }
+
+    // (a)\1, where a reference is tested before its group is captured too
+    auto reference = CreateNfaMatcher(EliminateEpsilon(*BuildNfa([](TestFactory& f) {
+        return f.Concat({ f.Capture(0, f.Char('a')), f.Reference(0) });
+    })));
+    CHECK(reference->CountMatches("aa aaa a") == 2);
+    CHECK(reference->IsMatch("baa") && !reference->IsMatch("aba"));
+
+    auto late = CreateNfaMatcher(EliminateEpsilon(*BuildNfa([](TestFactory& f) {
+        return f.Concat({ f.Reference(0), f.Capture(0, f.Char('a')) });
+    })));
+    CHECK(late->IsMatch("a") == late->Search("a").has_value());
+}
+
+// a buffer holds offsets of matches and their captures, and is refilled in place
+static void TestMatchBuffer()
+{
+    // (a)(b)?
+    auto nfa = BuildNfa([](TestFactory& f) {
+        return f.Concat({ f.Capture(0, f.Char('a')), f.Optional(f.Capture(1, f.Char('b'))) });
+    });
+
+    vector<RegexMatcher::Ptr> matchers;
+    matchers.push_back(CreateNfaMatcher(EliminateEpsilon(*nfa)));
+    matchers.push_back(CreateTaggedDfaMatcher(GenerateTaggedDfa(*nfa, TagDisambiguation::Perl)));
+
+    for (const auto& matcher : matchers)
+    {
+        RegexMatchBuffer buffer;
+        matcher->SearchAll("ab xa", buffer);
+
+        CHECK(buffer.Size() == 2 && buffer.CaptureCount() == 2 && buffer.Subject() == "ab xa");
+        if (buffer.Size() != 2 || buffer.CaptureCount() != 2)
+        {
+            continue;
+        }
+
+        CHECK(buffer.Begin(0) == 0 && buffer.End(0) == 2 && buffer.Content(0) == "ab");
+        CHECK(buffer.CaptureBegin(0, 0) == 0 && buffer.CaptureEnd(0, 0) == 1 && buffer.Capture(0, 1) == "b");
+
+        CHECK(buffer.Begin(1) == 4 && buffer.End(1) == 5 && buffer.Capture(1, 0) == "a");
+        CHECK(buffer.CaptureBegin(1, 1) == RegexMatchBuffer::npos && buffer.Capture(1, 1).data() == nullptr);
+
+        // the previous matches are replaced
+        matcher->SearchAll("b", buffer);
+        CHECK(buffer.Empty() && buffer.Subject() == "b");
+
+        matcher->SearchAll("a", buffer);
+        CHECK(buffer.Size() == 1 && buffer.Content(0) == "a");
+    }
+
+    // a matcher without captures leaves no slot
+    nfa = BuildNfa([](TestFactory& f) { return f.Concat({ f.Plus(f.Char('a')), f.Optional(f.Char('b')) }); });
+
+    RegexMatchBuffer buffer;
+    CreateDfaMatcher(GenerateDfa(*nfa))->SearchAll("aab xa", buffer);
+    CHECK(buffer.Size() == 2 && buffer.CaptureCount() == 0 && buffer.Content(1) == "a");
+}
+
+// matches are found one by one as the iteration goes, in the order of SearchAll
+static void TestSearchLazy()
+{
+    auto matcher = CreateDfaMatcher(GenerateDfa(*BuildNfa([](TestFactory& f) { return f.Plus(f.Digit()); })));
+
+    vector<string_view> found;
+    for (const auto& match : matcher->SearchLazy("1 22 x333"))
+    {
+        found.push_back(match.content);
+    }
+
+    CHECK(found == vector<string_view>({ "1", "22", "333" }));
+
+    // the range can be left early, or started over
+    auto range = matcher->SearchLazy("1 22 x333");
+    auto it = range.begin();
+    CHECK(it != range.end() && it->content == "1");
+    CHECK((++it)->content == "22");
+    CHECK(range.begin()->content == "1");
+
+    range = matcher->SearchLazy("none");
+    CHECK(range.begin() == range.end());
+}
+
+// collects every piece appended, for checks of Split
+class PieceSink : public OutputSink
+{
+public:
+    void Append(string_view piece) override
+    {
+        pieces.emplace_back(piece);
+    }
+
+    vector<string> pieces;
+};
+
+// $n expands to capture n - 1 in Replace and ReplaceAll, and Split yields the fields between matches
+static void TestReplaceAndSplit()
+{
+    // (a+)(b)
+    auto nfa = BuildNfa([](TestFactory& f) {
+        return f.Concat({ f.Capture(0, f.Plus(f.Char('a'))), f.Capture(1, f.Char('b')) });
+    });
+
+    vector<RegexMatcher::Ptr> matchers;
+    matchers.push_back(CreateNfaMatcher(EliminateEpsilon(*nfa)));
+    matchers.push_back(CreateOnePassMatcher(GenerateOnePassDfa(*nfa)));
+
+    for (const auto& matcher : matchers)
+    {
+        const string_view text = "xaab ab";
+        CHECK(matcher->ReplaceAll(text, ReplaceTemplate{ "[$2$1]" }) == "x[baa] [ba]");
+        CHECK(matcher->Replace(text, ReplaceTemplate{ "[$2$1]" }) == "x[baa] ab");
+        CHECK(matcher->ReplaceAll(text, ReplaceTemplate{ "$0$0" }) == "xaabaab abab");
+
+        // $$ is '$', and a '$' before anything else or a capture that doesn't exist
+        CHECK(matcher->Replace(text, ReplaceTemplate{ "$$1" }) == "x$1 ab");
+        CHECK(matcher->Replace(text, ReplaceTemplate{ "$x$" }) == "x$x$ ab");
+        CHECK(matcher->Replace(text, ReplaceTemplate{ "<$9>" }) == "x<> ab");
+
+        // no match leaves the text as it is
+        CHECK(matcher->ReplaceAll("bbb", ReplaceTemplate{ "$1" }) == "bbb");
+
+        string output = "> ";
+        StringSink sink{ output };
+        matcher->ReplaceAll(text, ReplaceTemplate{ "$1" }, sink);
+        CHECK(output == "> xaa a");
+    }
+
+    // a field between adjacent separators, and at both ends, is empty
+    auto comma = CreateDfaMatcher(GenerateDfa(*BuildNfa([](TestFactory& f) { return f.Char(','); })));
+
+    PieceSink fields;
+    comma->Split(",a,,bc,", fields);
+    CHECK(fields.pieces == vector<string>({ "", "a", "", "bc", "" }));
+
+    PieceSink whole;
+    comma->Split("abc", whole);
+    CHECK(whole.pieces == vector<string>({ "abc" }));
+}
+
+// simplified trees find the matches of the trees constructed
+static void TestSimplifiedMatches()
+{
+    // ab|ac|d, factored into a(b|c)|d
+    auto factored = BuildNfa([](TestFactory& f) { return f.Alter({ f.String("ab"), f.String("ac"), f.Char('d') }); });
+
+    // a|(b|a)|c, with a duplicate in a nested alternation
+    auto nested = BuildNfa([](TestFactory& f) {
+        return f.Concat({ f.Alter({ f.Char('a'), f.Alter({ f.Char('b'), f.Char('a') }), f.Char('c') }), f.Char('x') });
+    });
+
+    vector<RegexMatcher::Ptr> matchers;
+    for (const auto& nfa : { factored.get(), nested.get() })
+    {
+        matchers.push_back(CreateNfaMatcher(EliminateEpsilon(*nfa)));
+        matchers.push_back(CreateDfaMatcher(GenerateDfa(*nfa)));
+    }
+
+    const string_view text = "acd abx cx dbx";
+    CHECK(Spans(text, matchers[0]->SearchAll(text)) == "0-2 2-3 4-6 11-12");
+    CHECK(Spans(text, matchers[1]->SearchAll(text)) == "0-2 2-3 4-6 11-12");
+    CHECK(Spans(text, matchers[2]->SearchAll(text)) == "5-7 8-10 12-14");
+    CHECK(Spans(text, matchers[3]->SearchAll(text)) == "5-7 8-10 12-14");
+
+    // (ab|ac)(c?), where a factored alternation still captures what it did
+    auto nfa = BuildNfa([](TestFactory& f) {
+        return f.Concat({ f.Capture(0, f.Alter({ f.String("ab"), f.String("ac") })), f.Capture(1, f.Optional(f.Char('c'))) });
+    });
+
+    auto match = CreateTaggedDfaMatcher(GenerateTaggedDfa(*nfa, TagDisambiguation::Perl))->Search("xacc");
+    CHECK(match && match->content == "acc" && match->capture[0] == "ac" && match->capture[1] == "c");
+}
+
+// a class is a set of bytes, matched by a single transition
+static void TestCharClass()
+{
+    CharClass letters{ { 'a', 'c' }, { 'x', 'x' } };
+    CHECK(letters.Contain('a') && letters.Contain('c') && letters.Contain('x'));
+    CHECK(!letters.Contain('d') && !letters.Contain('w') && !CharClass{}.Contain('a') && CharClass{}.Empty());
+
+    auto others = letters.Negate();
+    CHECK(!others.Contain('b') && others.Contain('d') && others.Contain(0) && others.Contain(0xff));
+    CHECK(letters.Union(others).Ranges().size() == 1 && letters.Intersect(others).Empty());
+
+    auto ranges = letters.Union(CharClass{ { 'd', 'f' } }).Ranges();
+    CHECK(ranges.size() == 2 && ranges[0].Min() == 'a' && ranges[0].Max() == 'f' && ranges[1].Min() == 'x');
+
+    auto nfa = BuildNfa([](TestFactory& f) { return f.Plus(f.Class(CharClass{ { 'a', 'c' }, { 'x', 'x' } })); });
+    auto negated = BuildNfa([](TestFactory& f) { return f.Class(CharClass{ { 'a', 'z' } }.Negate()); });
+
+    const string_view text = "abxyd cax";
+    const string_view binary = "a\xff" "b.";
+
+    vector<RegexMatcher::Ptr> matchers;
+    for (const auto& atm : { nfa.get(), negated.get() })
+    {
+        matchers.push_back(CreateNfaMatcher(EliminateEpsilon(*atm)));
+        matchers.push_back(CreateDfaMatcher(GenerateDfa(*atm)));
+    }
+
+    for (size_t i = 0; i < 2; ++i)
+    {
+        CHECK(Spans(text, matchers[i]->SearchAll(text)) == "0-3 6-9");
+        CHECK(Spans(binary, matchers[i + 2]->SearchAll(binary)) == "1-2 3-4");
+    }
+
+    // the one-pass DFA takes a class too
+    auto one_pass = GenerateOnePassDfa(*nfa);
+    CHECK(one_pass && Spans(text, CreateOnePassMatcher(std::move(one_pass))->SearchAll(text)) == "0-3 6-9");
+}
+
+// a Glushkov NFA has no epsilon, and its automata find the matches of the Thompson NFA
+static void TestGlushkovNfa()
+{
+    // (ab|aa)+b
+    auto regex = TestFactory{ [](TestFactory& f) {
+        return f.Concat({ f.Plus(f.Alter({ f.String("ab"), f.String("aa") })), f.Char('b') });
+    } }.Generate();
+
+    auto glushkov = GenerateGlushkovNfa(*regex->Expr());
+    CHECK(glushkov != nullptr && !glushkov->HasEpsilon() && glushkov->DfaCompatible());
+
+    const string_view text = "abb aaabb aab";
+    auto dfa = CreateDfaMatcher(GenerateDfa(*glushkov));
+    CHECK(Spans(text, dfa->SearchAll(text)) == "0-3 4-9 10-13");
+    CHECK(dfa->Match("aaabb") && !dfa->Match("ab"));
+
+    // simplified into (?:a[ab])+b, a state for each of the three positions and the initial one
+    CHECK(MeasureNfa(*glushkov).state_count == 4);
+
+    // a reference takes a position too, which leaves it for the backtracker
+    regex = TestFactory{ [](TestFactory& f) {
+        return f.Concat({ f.Capture(0, f.Char('a')), f.Reference(0) });
+    } }.Generate();
+    glushkov = GenerateGlushkovNfa(*regex->Expr());
+    CHECK(glushkov != nullptr && !glushkov->HasEpsilon() && !glushkov->DfaCompatible());
+}
+
+// a reduced NFA takes fewer states, and its DFA finds the same matches
+static void TestReduceNfa()
+{
+    // (?:ab|x|cb)y, where the states after a and c both go on to b
+    auto nfa = BuildNfa([](TestFactory& f) {
+        return f.Concat({ f.Alter({ f.String("ab"), f.Char('x'), f.String("cb") }), f.Char('y') });
+    });
+    auto reduced = ReduceNfa(*EliminateEpsilon(*nfa));
+    CHECK(reduced != nullptr && !reduced->HasEpsilon());
+
+    const string_view text = "aby cb xy cby by";
+    CHECK(Spans(text, CreateDfaMatcher(GenerateDfa(*reduced))->SearchAll(text)) == "0-3 7-9 10-13");
+    CHECK(GenerateDfa(*reduced)->StateCount() <= GenerateDfa(*nfa)->StateCount());
+
+    // the states before b are merged, and so are those after it
+    auto before = MeasureNfa(*EliminateEpsilon(*nfa)), after = MeasureNfa(*reduced);
+    CHECK(after.state_count < before.state_count && after.transition_count < before.transition_count);
+}
+
+// (a|b)*a(a|b){4}, whose DFA has a state for each of the 2^5 choices of the last five bytes, and the initial one
+static NfaAutomaton::Ptr BuildWideNfa()
+{
+    return BuildNfa([](TestFactory& f) {
+        auto any = f.Alter({ f.Char('a'), f.Char('b') });
+        return f.Concat({ f.Star(any), f.Char('a'), f.Repeat(any, Repetition{ 4, 4 }, ClosureStrategy::Greedy) });
+    });
+}
+
+// every subset is interned once, however many times it's reached
+static void TestDfaSubsets()
+{
+    auto nfa = BuildWideNfa();
+    auto dfa = GenerateDfa(*nfa);
+    CHECK(dfa->StateCount() == 33);
+
+    const string_view text = "xabbbbx babbbbb abbbb";
+    auto matcher = CreateDfaMatcher(std::move(dfa));
+    CHECK(Spans(text, matcher->SearchAll(text)) == "1-6 8-14 16-21");
+    CHECK(matcher->Match("ababa") && !matcher->Match("abbbbb"));
+}
+
+// determinization stops at the state limit, and CreateMatcher falls back to another engine
+static void TestDfaStateLimit()
+{
+    auto nfa = BuildWideNfa();
+    CHECK(GenerateDfa(*nfa, 32) == nullptr);
+    CHECK(GenerateDfa(*nfa, 33) != nullptr && GenerateDfa(*nfa, kNoDfaStateLimit) != nullptr);
+
+    // the tree is simplified, so out of budget it's a lazy DFA finding the matches of the DFA
+    CHECK(nfa->Simplified());
+
+    const string_view text = "xabbbbx babbbbb abbbb aaaaab";
+    for (size_t limit : { size_t{ 0 }, size_t{ 1 }, size_t{ 32 }, size_t{ 33 }, kDefaultDfaStateLimit })
+    {
+        auto matcher = CreateMatcher(*nfa, limit);
+        CHECK(matcher && Spans(text, matcher->SearchAll(text)) == "1-6 8-14 16-21 22-28");
+    }
+}
+
+// counters and latencies are collected only where YUI_ENABLE_STATS is defined
+static void TestMatcherStats()
+{
+    auto matcher = CreateDfaMatcher(GenerateDfa(*BuildNfa([](TestFactory& f) { return f.String("ab"); })));
+    matcher->Search("xxab");
+    matcher->Search("ab");
+
+    auto stats = matcher->Stats();
+#if defined(YUI_ENABLE_STATS)
+    CHECK(stats.Counter(MatcherCounter::BytesScanned) == 6);
+    CHECK(stats.Counter(MatcherCounter::DfaTransitions) > 0);
+    CHECK(stats.Latency(MatcherCall::Search).TotalCount() == 2 && stats.Latency(MatcherCall::Match).TotalCount() == 0);
+#else
+    CHECK(stats.Counter(MatcherCounter::BytesScanned) == 0 && stats.Latency(MatcherCall::Search).TotalCount() == 0);
+#endif
+
+    matcher->ResetStats();
+    stats = matcher->Stats();
+    CHECK(stats.Counter(MatcherCounter::BytesScanned) == 0 && stats.Latency(MatcherCall::Search).TotalCount() == 0);
+
+    // buckets are an eighth of a power of 2 wide
+    LatencyHistogram histogram;
+    CHECK(histogram.TotalCount() == 0 && histogram.ValueAtQuantile(0.5) == 0);
+
+    histogram.Record(100, 99);
+    histogram.Record(10000);
+    CHECK(histogram.TotalCount() == 100);
+    CHECK(histogram.ValueAtQuantile(0.5) >= 100 && histogram.ValueAtQuantile(0.5) < 100 * 9 / 8 + 1);
+    CHECK(histogram.ValueAtQuantile(1.0) >= 10000 && histogram.ValueAtQuantile(1.0) < 10000 * 9 / 8 + 1);
+
+    for (uint64_t value : { 0, 1, 7, 8, 9, 100, 1000000 })
+    {
+        auto bucket = LatencyHistogram::BucketOf(value);
+        CHECK(LatencyHistogram::BucketLowerBound(bucket) <= value && value < LatencyHistogram::BucketLowerBound(bucket + 1));
+    }
+
+    LatencyHistogram other;
+    other.Record(100);
+    histogram.Merge(other);
+    CHECK(histogram.TotalCount() == 101);
+}
+
+// a report holds sizes of every phase run, and the budget a DFA ran out of
+static void TestCompileReport()
+{
+    TestFactory factory{ [](TestFactory& f) {
+        auto any = f.Alter({ f.Char('a'), f.Char('b') });
+        return f.Concat({ f.Star(any), f.Char('a'), f.Repeat(any, Repetition{ 4, 4 }, ClosureStrategy::Greedy) });
+    } };
+
+    CompileReport report;
+    auto matcher = CompileRegex(factory, kDefaultDfaStateLimit, &report);
+    CHECK(matcher && matcher->Match("aabbb"));
+
+    CHECK(report.nfa_size.state_count > 0 && report.nfa_size.transition_count > 0);
+    CHECK(report.dfa_state_count == 33 && report.table_bytes > 0 && !report.dfa_out_of_budget);
+    CHECK(report.simulated_size.state_count == 0 && report.arena_bytes > 0);
+    CHECK(report.TotalTime() >= report.determinize_time);
+
+    // out of budget, a simplified tree takes a lazy DFA
+    report = CompileReport{};
+    matcher = CompileRegex(factory, 32, &report);
+    CHECK(matcher && matcher->Match("aabbb"));
+    CHECK(report.dfa_state_count == 0 && report.table_bytes == 0 && report.dfa_out_of_budget);
+    CHECK(report.simulated_size.state_count == 0);
+
+    // while the epsilon-free NFA of a tree as constructed is simulated
+    TestFactory plain{ [](TestFactory& f) {
+        auto any = f.Alter({ f.Char('a'), f.Char('b') });
+        return f.Concat({ f.Star(any), f.Char('a'), f.Repeat(any, Repetition{ 4, 4 }, ClosureStrategy::Greedy) });
+    }, false };
+
+    report = CompileReport{};
+    matcher = CompileRegex(plain, 32, &report);
+    CHECK(matcher && matcher->Match("aabbb"));
+    CHECK(report.dfa_out_of_budget && report.simulated_size.state_count > 0);
+
+    // MeasureNfa counts states and transitions reachable
+    auto size = MeasureNfa(*BuildNfa([](TestFactory& f) { return f.String("abc"); }));
+    CHECK(size.state_count >= 4 && size.transition_count >= 3);
+    CHECK(MeasureNfa(*EliminateEpsilon(*BuildNfa([](TestFactory& f) { return f.String("abc"); }))).transition_count == 3);
+}
+
+// a lazy DFA finds the matches of the full DFA, even where its cache is full
+static void TestLazyDfa()
+{
+    auto nfa = BuildWideNfa();
+
+    const string_view text = "xabbbbx babbbbb abbbb";
+    for (size_t limit : { size_t{ 2 }, size_t{ 8 }, kNoDfaStateLimit })
+    {
+        auto matcher = CreateLazyDfaMatcher(GenerateLazyDfa(*nfa, limit));
+        CHECK(Spans(text, matcher->SearchAll(text)) == "1-6 8-14 16-21");
+        CHECK(matcher->Match("ababa") && !matcher->Match("abbbbb"));
+
+        // a warm cache answers the same
+        CHECK(Spans(text, matcher->SearchAll(text)) == "1-6 8-14 16-21");
+    }
+
+    // states are built on demand, no more than the full DFA has
+    auto atm = GenerateLazyDfa(*nfa);
+    auto matcher = CreateLazyDfaMatcher(std::move(atm));
+    matcher->SearchAll(text);
+    CHECK(matcher->Match("aabbb"));
+
+    // and anchors are resolved as in the full DFA
+    auto word = BuildNfa([](TestFactory& f) {
+        return f.Concat({ f.Anchor(AnchorType::WordBoundary), f.String("ab"), f.Anchor(AnchorType::WordBoundary) });
+    });
+    CHECK(Spans("ab cab ab_ ab", CreateLazyDfaMatcher(GenerateLazyDfa(*word))->SearchAll("ab cab ab_ ab")) == "0-2 11-13");
+}
+
+// a batch gets the results of Match and Search of every input, in order
+static void TestBatch()
+{
+    vector<string_view> inputs = { "ab", "", "aaab", "abab", "b", "aa", "abx", "aaaa", "ab", "a" };
+
+    auto nfa = BuildNfa([](TestFactory& f) { return f.Plus(f.Alter({ f.String("ab"), f.String("aa") })); });
+    RegexMatcher::Ptr matchers[] = { CreateNfaMatcher(EliminateEpsilon(*nfa)), CreateDfaMatcher(GenerateDfa(*nfa)) };
+
+    for (const auto& matcher : matchers)
+    {
+        for (size_t min_chunk_size : { size_t{ 1 }, size_t{ 1 } << 16 })
+        {
+            ParallelOptions options;
+            options.min_chunk_size = min_chunk_size;
+
+            CHECK(matcher->MatchBatch(inputs, options) == SelectionBitmap({ 0xad, 0x01 }));
+
+            auto results = matcher->SearchBatch(inputs, options);
+            CHECK(results.size() == inputs.size());
+            CHECK(Span(inputs[2], results[2]) == "0-4" && Span(inputs[6], results[6]) == "0-2" && !results[4] && !results[1]);
+        }
+
+        CHECK(matcher->MatchBatch({}).empty() && matcher->SearchBatch({}).empty());
+    }
+
+    // huge inputs between small ones, where a range closes after each huge one so that ranges share a byte
+    string repeated;
+    for (size_t i = 0; i < (1u << 19); ++i)
+    {
+        repeated += "ab";
+    }
+
+    const auto unmatched = repeated + "b", prefixed = "x" + repeated;
+    const vector<string_view> mixed = { "ab", repeated, "x", unmatched, "aa", prefixed };
+
+    for (size_t thread_count : { 1, 4 })
+    {
+        ParallelOptions options;
+        options.thread_count = thread_count;
+
+        // inputs 0, 1 and 4 match
+        CHECK(matchers[1]->MatchBatch(mixed, options) == SelectionBitmap({ 0x13 }));
+
+        auto results = matchers[1]->SearchBatch(mixed, options);
+        CHECK(results.size() == mixed.size() && !results[2]);
+        CHECK(Span(mixed[1], results[1]) == "0-1048576" && Span(mixed[3], results[3]) == "0-1048576");
+        CHECK(Span(mixed[5], results[5]) == "1-1048577" && Span(mixed[4], results[4]) == "0-2");
+    }
+}
+
+// patterns parse into the trees a factory would build, and errors are reported
+static void TestParser()
+{
+    const struct
+    {
+        const char* pattern;
+        const char* text;
+        const char* spans;
+    } cases[] = {
+        { "(ab|aa)+", "ab aa ba abaa", "0-2 3-5 9-13" },
+        { "\\d+", "a1 22 333", "1-2 3-5 6-9" },
+        { "[a-cx]+", "abxyd cax", "0-3 6-9" },
+        { "[^a-z]", "a\xff" "b.", "1-2 3-4" },
+        { "\\bab\\b", "ab cab ab_ ab", "0-2 11-13" },
+        { "^a+", "aa\na ba\naaa", "0-2 3-4 8-11" },
+        { "a(?=b)", "acab a", "2-3" },
+        { "a(?!b)", "acab a", "0-1 5-6" },
+        { "a{2,3}", "a aaaa", "2-5" },
+        { "(a+)b\\1", "xaaba", "2-5" },
+    };
+
+    for (const auto& item : cases)
+    {
+        string error;
+        auto regex = ParseRegex(item.pattern, &error);
+        CHECK(regex != nullptr && error.empty());
+        if (regex == nullptr)
+        {
+            continue;
+        }
+
+        auto matcher = CreateMatcher(*BuildNfa(*regex));
+        auto spans = Spans(item.text, matcher->SearchAll(item.text));
+        if (spans != item.spans)
+        {
+            fprintf(stderr, "  %s: %s, %s expected\n", item.pattern, spans.c_str(), item.spans);
+        }
+
+        CHECK(spans == item.spans);
+    }
+
+    // captures are numbered from 1 in the pattern and from 0 in a match
+    auto regex = ParseRegex("(a)(?:b)(c)");
+    auto match = CreateMatcher(*BuildNfa(*regex))->Search("xabc");
+    CHECK(match && match->capture.size() == 2 && match->capture[0] == "a" && match->capture[1] == "c");
+
+    for (auto pattern : { "(ab", "ab)", "[a-", "a{3,2}", "*a", "\\" })
+    {
+        string error;
+        CHECK(ParseRegex(pattern, &error) == nullptr && !error.empty());
+    }
+}
+
+// lines with a match are found in order, with their numbers and offsets
+static void TestLineMatching()
+{
+    const string_view text = "foo\nbar\nfoobar\n\nbaz";
+
+    auto regex = ParseRegex("o+b|fo");
+    auto nfa = BuildNfa(*regex);
+    RegexMatcher::Ptr matchers[] = { CreateNfaMatcher(EliminateEpsilon(*nfa)), CreateDfaMatcher(GenerateDfa(*nfa)) };
+
+    for (const auto& matcher : matchers)
+    {
+        vector<LineMatch> lines;
+        CHECK(matcher->MatchLines(text, lines) == 5);
+        CHECK(lines.size() == 2 && lines[0].number == 0 && lines[1].number == 2);
+        CHECK(lines.size() == 2 && lines[1].begin == 8 && lines[1].end == 14);
+        CHECK(matcher->CountMatchingLines(text) == 2);
+
+        // a line break at the end ends a line, and max_count stops the scan
+        lines.clear();
+        CHECK(matcher->MatchLines("fo\nfo\nfo\n", lines) == 3 && lines.size() == 3);
+
+        lines.clear();
+        CHECK(matcher->MatchLines("fo\nfo\nfo\n", lines, 2) == 2 && lines.size() == 2);
+    }
+
+    // the first line break, or the end
+    string long_line(100, 'x');
+    long_line[70] = '\n';
+    const char* begin = long_line.data();
+    CHECK(FindLineBreak(begin, begin + long_line.size()) == begin + 70);
+    CHECK(FindLineBreak(begin, begin + 70) == begin + 70);
+    CHECK(FindLineBreak(begin + 71, begin + long_line.size()) == begin + long_line.size());
+}
+
+// a line with nothing but an empty match is selected, as grep does
+static void TestEmptyLineMatches()
+{
+    // "abc", "", "xyz", "foo bar"
+    const string_view text = "abc\n\nxyz\nfoo bar\n";
+
+    const struct
+    {
+        const char* pattern;
+        size_t count;
+    } cases[] = {
+        { "^$", 1 },
+        { "$", 4 },
+        { "x*", 4 },
+        { "x*$", 4 },
+        { "a*", 4 },
+        { "^a*", 4 },
+        { "\\bb*", 3 },
+        { "(?=o)", 1 },
+        { "(x)\\1|", 4 },
+        { "x", 1 },
+    };
+
+    for (const auto& item : cases)
+    {
+        for (auto captures : { false, true })
+        {
+            for (const auto& engine : CreateEngines(item.pattern, captures))
+            {
+                auto count = engine.matcher->CountMatchingLines(text);
+                if (count != item.count)
+                {
+                    fprintf(stderr, "  %s with %s: %zu lines\n", item.pattern, engine.name, count);
+                }
+
+                CHECK(count == item.count);
+
+                vector<LineMatch> lines;
+                CHECK(engine.matcher->MatchLines(text, lines) == 4 && lines.size() == item.count);
+            }
+        }
+    }
+
+    // an empty line in the middle, and the last one without a line break
+    for (const auto& engine : CreateEngines("^$"))
+    {
+        vector<LineMatch> lines;
+        engine.matcher->MatchLines("a\n\nb\n\n", lines);
+        CHECK(lines.size() == 2 && lines[0].number == 1 && lines[1].number == 3);
+        CHECK(engine.matcher->CountMatchingLines("a\nb") == 0);
+    }
+}
+
+// every engine yui-grep may pick selects the same lines, see CreateEngine of yui-grep
+static void TestLineEnginesAgree()
+{
+    const char* patterns[] = { "a*", "^a*", "b+$", "\\ba\\w*", "(a|b)b", "a(?=b)", "(a)\\1", "a.*c|^$" };
+
+    mt19937 rng{ 49 };
+    string text;
+    for (size_t i = 0; i < 2000; ++i)
+    {
+        text += "ab c\n"[rng() % 5];
+    }
+
+    for (auto pattern : patterns)
+    {
+        auto engines = CreateEngines(pattern);
+        CHECK(!engines.empty());
+
+        vector<LineMatch> expected;
+        for (const auto& engine : engines)
+        {
+            vector<LineMatch> lines;
+            engine.matcher->MatchLines(text, lines);
+            if (&engine == &engines.front())
+            {
+                expected = lines;
+            }
+
+            auto same = lines.size() == expected.size();
+            for (size_t i = 0; same && i < lines.size(); ++i)
+            {
+                same = lines[i].number == expected[i].number;
+            }
+
+            if (!same)
+            {
+                fprintf(stderr, "  %s with %s: %zu lines, %zu expected\n", pattern, engine.name, lines.size(), expected.size());
+            }
+
+            CHECK(same);
+        }
+    }
+}
+
+// Perl mode takes the first alternative that matches, even if a later one is longer
+static void TestTaggedDfaPerlMode()
+{
+    auto regex = ParseRegex("(a|ab)", nullptr, true);
+    auto nfa = BuildNfa(*regex);
+
+    auto perl = CreateTaggedDfaMatcher(GenerateTaggedDfa(*nfa, TagDisambiguation::Perl));
+    auto match = perl->Search("ab");
+    CHECK(match && match->content == "a" && match->capture[0] == "a");
+    CHECK(!perl->Match("ab") && perl->Match("a"));
+
+    auto longest = CreateTaggedDfaMatcher(GenerateTaggedDfa(*nfa, TagDisambiguation::Longest));
+    match = longest->Search("ab");
+    CHECK(match && match->content == "ab" && match->capture[0] == "ab");
+    CHECK(longest->Match("ab") && longest->Match("a"));
+
+    // a later path is still taken where the first one fails
+    regex = ParseRegex("(?:a|ab)(c|bcd)", nullptr, true);
+    perl = CreateTaggedDfaMatcher(GenerateTaggedDfa(*BuildNfa(*regex), TagDisambiguation::Perl));
+    match = perl->Search("abcd");
+    CHECK(match && match->content == "abcd" && match->capture[0] == "bcd");
+}
+
+// automata built from a Glushkov NFA find the same matches as those built from the Thompson NFA,
+// while the backtracker is never run on it
+static void TestGlushkovAgainstThompson()
+{
+    const char* patterns[] = { "(?:[ab])bb*|(?:(?:b*a*a?))?", "(a|ab)(c|bcd)", "a*?b|[ab]{2,3}", "(?:a|b)*abb",
+                               "\\bab*\\b|b$", "(?:ab|a)(?:ba|b)?", "[^a]+|a{2}" };
+
+    mt19937 rng{ 41 };
+    for (auto pattern : patterns)
+    {
+        auto regex = ParseRegex(pattern, nullptr, false);
+        auto thompson = BuildNfa(*regex);
+        auto glushkov = GenerateGlushkovNfa(*regex->Expr());
+        CHECK(thompson->SimulationCompatible() && !glushkov->SimulationCompatible());
+
+        auto expected = CreateDfaMatcher(GenerateDfa(*thompson));
+        auto dfa = CreateDfaMatcher(GenerateDfa(*glushkov));
+        auto lazy = CreateLazyDfaMatcher(GenerateLazyDfa(*glushkov));
+
+        // out of budget, it takes a lazy DFA rather than the backtracker
+        auto fallback = CreateMatcher(*glushkov, 1);
+
+        for (size_t i = 0; i < 300; ++i)
+        {
+            string text;
+            for (size_t length = rng() % 16; length > 0; --length)
+            {
+                text += "ab c"[rng() % 4];
+            }
+
+            auto matches = expected->SearchAll(text);
+            for (const auto& matcher : { dfa.get(), lazy.get(), fallback.get() })
+            {
+                auto found = matcher->SearchAll(text);
+
+                auto same = found.size() == matches.size();
+                for (size_t k = 0; same && k < found.size(); ++k)
+                {
+                    same = found[k].content.data() == matches[k].content.data() && found[k].content.size() == matches[k].content.size();
+                }
+
+                CHECK(same);
+            }
+        }
+    }
+
+    // references need the backtracker
+    auto regex = ParseRegex("(a+)b\\1");
+    CHECK(CreateMatcher(*GenerateGlushkovNfa(*regex->Expr())) == nullptr);
+    CHECK(CreateMatcher(*BuildNfa(*regex))->Search("xaabaa")->content == "aabaa");
+}
+
+// the backtracker CreateMatcher falls back to finds the same matches as on the Thompson NFA,
+// which it did not when it simulated the reduced NFA
+static void TestReducedNfaNotSimulated()
+{
+    // reduced, both alternatives share the state after "b", from which the backtracker goes on to "bb"
+    // NOTE the tree is not simplified, as a simplified one is never simulated
+    auto nfa = BuildNfa(*TestFactory{ [](TestFactory& f) {
+        auto any = f.Class(CharClass{ { 'a', 'b' } });
+        return f.Alter({ f.Plus(f.Alter({ any, any })), f.Concat({ f.Star(f.Char('b')), f.Optional(f.Char('b')) }) });
+    }, false }.Generate());
+    auto reduced = ReduceNfa(*EliminateEpsilon(*nfa));
+    CHECK(!reduced->SimulationCompatible());
+
+    auto expected = CreateNfaMatcher(EliminateEpsilon(*nfa));
+    auto fallback = CreateMatcher(*nfa, 0);
+
+    auto matches = fallback->SearchAll("bb");
+    CHECK(matches.size() == 2 && matches[0].content == "b" && matches[1].content == "b");
+
+    // the same on random text
+    mt19937 rng{ 42 };
+    for (size_t i = 0; i < 300; ++i)
+    {
+        string text;
+        for (size_t length = rng() % 12; length > 0; --length)
+        {
+            text += "abc"[rng() % 3];
+        }
+
+        auto expected_matches = expected->SearchAll(text);
+        auto found = fallback->SearchAll(text);
+
+        auto same = found.size() == expected_matches.size();
+        for (size_t k = 0; same && k < found.size(); ++k)
+        {
+            same = found[k].content.data() == expected_matches[k].content.data()
+                && found[k].content.size() == expected_matches[k].content.size();
+        }
+
+        CHECK(same);
+    }
+
+    // the reduced NFA still feeds subset construction
+    auto dfa = CreateDfaMatcher(GenerateDfa(*reduced));
+    CHECK(dfa->Search("cbb")->content == "bb");
+    CHECK(CreateMatcher(*reduced, 0)->Search("cbb")->content == "bb");
+}
+
+// parallel scans find and count the matches of SearchAll, however the input is split into chunks
+static void TestParallelScan()
+{
+    const char* patterns[] = { "ab+", "(?:ab|b)a*", "a\\b|ba", "(a)\\1" };
+
+    mt19937 rng{ 28 };
+    for (auto pattern : patterns)
+    {
+        for (const auto& engine : CreateEngines(pattern))
+        {
+            for (size_t i = 0; i < 50; ++i)
+            {
+                string text;
+                for (size_t length = rng() % 200; length > 0; --length)
+                {
+                    text += "ab "[rng() % 3];
+                }
+
+                ParallelOptions options;
+                options.thread_count = 1 + rng() % 8;
+                options.min_chunk_size = 1 + rng() % 40;
+
+                auto expected = engine.matcher->SearchAll(text);
+                auto found = engine.matcher->SearchAllParallel(text, options);
+
+                auto same = found.size() == expected.size();
+                for (size_t k = 0; same && k < found.size(); ++k)
+                {
+                    same = found[k].content.data() == expected[k].content.data() && found[k].content.size() == expected[k].content.size();
+                }
+
+                if (!same)
+                {
+                    fprintf(stderr, "  %s with %s: %zu matches, %zu expected\n", pattern, engine.name, found.size(), expected.size());
+                }
+
+                CHECK(same);
+                CHECK(engine.matcher->CountAllParallel(text, options) == expected.size());
+            }
+        }
+    }
+}
+
+// builds [ab](bb|b), where the alternation is captured if captures is true
+class FactoredFactory : public RegexFactoryBase
+{
+public:
+    FactoredFactory(bool simplify, bool captures)
+        : RegexFactoryBase(simplify), captures_(captures) { }
+
+protected:
+    RegexExpr* Construct() override
+    {
+        auto any = Alter({ String("bb"), Char('b') });
+        return Concat({ Class(CharClass{ { 'a', 'b' } }), captures_ ? Capture(0, any) : any });
+    }
+
+private:
+    bool captures_;
+};
+
+// the backtracker finds the matches of the tree as constructed, which factoring bb|b into b(b|) once changed
+static void TestSimplifyKeepsBacktrack()
+{
+    const auto Backtrack = [](FactoredFactory factory) {
+        return CreateNfaMatcher(EliminateEpsilon(*BuildNfa(*factory.Generate())))->Search("bbb");
+    };
+
+    // a tree taken as is, whose DFA finds the same match either way
+    auto match = Backtrack(FactoredFactory{ false, false });
+    CHECK(match && match->content == "bb");
+    CHECK(CreateMatcher(*BuildNfa(*FactoredFactory{ false, false }.Generate()), 0)->Search("bbb")->content == "bb");
+    CHECK(CreateDfaMatcher(GenerateDfa(*BuildNfa(*FactoredFactory{ false, false }.Generate())))->Search("bbb")->content == "bbb");
+    CHECK(CreateDfaMatcher(GenerateDfa(*BuildNfa(*FactoredFactory{ true, false }.Generate())))->Search("bbb")->content == "bbb");
+
+    // a simplified tree finds the match of its DFA, whatever the budget is
+    for (size_t limit : { size_t{ 0 }, size_t{ 1 }, kDefaultDfaStateLimit })
+    {
+        FactoredFactory factory{ true, false };
+        CHECK(CompileRegex(factory, limit)->Search("bbb")->content == "bbb");
+    }
+
+    // a tree with captures is never simplified
+    for (auto simplify : { false, true })
+    {
+        match = Backtrack(FactoredFactory{ simplify, true });
+        CHECK(match && match->content == "bb" && match->capture[0] == "b");
+    }
+
+    // and so it is with the parser
+    auto regex = ParseRegex("[ab](bb|b)", nullptr, true);
+    match = CreateMatcher(*BuildNfa(*regex))->Search("bbb");
+    CHECK(match && match->content == "bb" && match->capture[0] == "b");
+}
+
+// a loop whose body may consume nothing, which once made the backtracker take it forever
+static void TestZeroWidthLoops()
+{
+    const struct
+    {
+        const char* pattern;
+        const char* text;
+        const char* spans;
+    } cases[] = {
+        { "(?:(?=a))*a", "ba", "1-2" },
+        { "(?:(?=a)|b)*c", "bbc", "0-3" },
+        { "(?:(?=a)|b)*", "bab", "0-1 2-3" },
+        { "(?:^)*a", "a\na", "0-1 2-3" },
+        { "(?:\\b)*x", "x x", "0-1 2-3" },
+        { "(a*)*b", "aab", "0-3" },
+        { "(?:()|a)*b", "aab", "0-3" },
+    };
+
+    for (const auto& item : cases)
+    {
+        for (auto captures : { false, true })
+        {
+            for (const auto& engine : CreateEngines(item.pattern, captures))
+            {
+                auto spans = Spans(item.text, engine.matcher->SearchAll(item.text));
+                if (spans != item.spans)
+                {
+                    fprintf(stderr, "  %s with %s: %s\n", item.pattern, engine.name, spans.c_str());
+                }
+
+                CHECK(spans == item.spans);
+            }
+        }
+    }
+
+    // an empty match found at once, where the loop is taken while looking for a longer one
+    for (auto pattern : { "(?:(?=a))*", "(?:^)*", "((?:\\b)*)" })
+    {
+        for (const auto& engine : CreateEngines(pattern, true))
+        {
+            CHECK(engine.matcher->CountMatchingLines("a\nb") == 2);
+        }
+    }
+}
+
+// Test Driver
+//
+
+static const struct
+{
+    const char* name;
+    void(*run)();
+} kTests[] = {
+    { "BasicMatching", TestBasicMatching },
+    { "JitMatcher", TestJitMatcher },
+    { "MatchColumn", TestMatchColumn },
+    { "ParallelSearch", TestParallelSearch },
+    { "ByteAlphabet", TestByteAlphabet },
+    { "Utf8Codepoints", TestUtf8Codepoints },
+    { "DfaAnchors", TestDfaAnchors },
+    { "OnePassCaptures", TestOnePassCaptures },
+    { "TaggedDfaCaptures", TestTaggedDfaCaptures },
+    { "Lookahead", TestLookahead },
+    { "IsMatchAndCount", TestIsMatchAndCount },
+    { "MatchBuffer", TestMatchBuffer },
+    { "SearchLazy", TestSearchLazy },
+    { "ReplaceAndSplit", TestReplaceAndSplit },
+    { "SimplifiedMatches", TestSimplifiedMatches },
+    { "CharClass", TestCharClass },
+    { "GlushkovNfa", TestGlushkovNfa },
+    { "ReduceNfa", TestReduceNfa },
+    { "DfaSubsets", TestDfaSubsets },
+    { "DfaStateLimit", TestDfaStateLimit },
+    { "MatcherStats", TestMatcherStats },
+    { "CompileReport", TestCompileReport },
+    { "LazyDfa", TestLazyDfa },
+    { "Batch", TestBatch },
+    { "Parser", TestParser },
+    { "LineMatching", TestLineMatching },
+    { "EmptyLineMatches", TestEmptyLineMatches },
+    { "LineEnginesAgree", TestLineEnginesAgree },
+    { "TaggedDfaPerlMode", TestTaggedDfaPerlMode },
+    { "GlushkovAgainstThompson", TestGlushkovAgainstThompson },
+    { "ReducedNfaNotSimulated", TestReducedNfaNotSimulated },
+    { "ParallelScan", TestParallelScan },
+    { "SimplifyKeepsBacktrack", TestSimplifyKeepsBacktrack },
+    { "ZeroWidthLoops", TestZeroWidthLoops },
+};
+
+int main()
+{
+    for (const auto& test : kTests)
+    {
+        auto failures_before = failure_count;
+        test.run();
+
+        printf("%-24s %s\n", test.name, failure_count == failures_before ? "ok" : "FAILED");
+    }
+
+    printf("%zu check(s) failed\n", failure_count);
+    return failure_count == 0 ? 0 : 1;
+}